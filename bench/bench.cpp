@@ -0,0 +1,376 @@
+// Performance benchmark: generates parametric meshes and times each pipeline stage separately.
+// Output is JSON (default) or CSV, one record per mesh and stage, from fixed seeds so runs are comparable.
+#include "stl_reader.h"
+#include "parallel.h"
+#include "ray_kernel.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef StlReader::Vec3 Vec3;
+typedef StlReader::Triangle Triangle;
+
+static Triangle makeTri(const Vec3& a, const Vec3& b, const Vec3& c) {
+    Triangle t{};
+    t.v0 = a; t.v1 = b; t.v2 = c;
+    t.normal = StlReader::facetNormal(a, b, c);
+    return t;
+}
+
+// UV sphere of about `target` triangles, outward winding.
+static void appendSphere(std::vector<Triangle>& tris, const Vec3& c, float radius, size_t target) {
+    const int stacks = std::max(3, static_cast<int>(std::lround(std::sqrt(target / 4.0))));
+    const int slices = 2 * stacks;
+    auto point = [&](int i, int j) {
+        const float pi = 3.14159265358979f;
+        float theta = pi * i / stacks, phi = 2.f * pi * (j % slices) / slices;
+        return Vec3{ c.x + radius * std::sin(theta) * std::cos(phi), c.y + radius * std::sin(theta) * std::sin(phi),
+            c.z + radius * std::cos(theta) };
+    };
+    for (int i = 0; i < stacks; ++i) {
+        for (int j = 0; j < slices; ++j) {
+            Vec3 p00 = point(i, j), p01 = point(i, j + 1), p10 = point(i + 1, j), p11 = point(i + 1, j + 1);
+            if (i > 0) tris.push_back(makeTri(p00, p10, p01));
+            if (i + 1 < stacks) tris.push_back(makeTri(p01, p10, p11));
+        }
+    }
+}
+
+// Axis-aligned box with every face split into a k x k grid; normals point out (or in, for a cavity wall).
+// Grid points are computed from the same per-axis formula on every face, so shared edges weld exactly.
+static void appendBox(std::vector<Triangle>& tris, const float lo[3], const float hi[3], int k, bool inward) {
+    auto coord = [&](int axis, int i) { return i == k ? hi[axis] : lo[axis] + (hi[axis] - lo[axis]) * i / k; };
+    for (int axis = 0; axis < 3; ++axis) {
+        const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        for (int side = 0; side < 2; ++side) {
+            const float outward = (side ? 1.f : -1.f) * (inward ? -1.f : 1.f);
+            for (int i = 0; i < k; ++i) {
+                for (int j = 0; j < k; ++j) {
+                    Vec3 p[4];
+                    const int du[4] = { 0, 1, 1, 0 }, dv[4] = { 0, 0, 1, 1 };
+                    for (int q = 0; q < 4; ++q) {
+                        float xyz[3];
+                        xyz[axis] = side ? hi[axis] : lo[axis];
+                        xyz[u] = coord(u, i + du[q]);
+                        xyz[v] = coord(v, j + dv[q]);
+                        p[q] = Vec3{ xyz[0], xyz[1], xyz[2] };
+                    }
+                    Triangle a = makeTri(p[0], p[1], p[2]), b = makeTri(p[0], p[2], p[3]);
+                    const float* na = &a.normal.x;
+                    if (na[axis] * outward < 0.f) {
+                        a = makeTri(p[0], p[2], p[1]);
+                        b = makeTri(p[0], p[3], p[2]);
+                    }
+                    tris.push_back(a);
+                    tris.push_back(b);
+                }
+            }
+        }
+    }
+}
+
+// Plate with `channels` sealed internal channels (cavities), like the cold plate in data/.
+static void appendChannelPlate(std::vector<Triangle>& tris, int channels, size_t target) {
+    const int k = std::max(1, static_cast<int>(std::lround(std::sqrt(target / (12.0 * (channels + 1))))));
+    const float plateLo[3] = { 0.f, 0.f, 0.f }, plateHi[3] = { 100.f, 60.f, 10.f };
+    appendBox(tris, plateLo, plateHi, k, false);
+    const float pitch = 60.f / channels;
+    for (int c = 0; c < channels; ++c) {
+        const float lo[3] = { 5.f, c * pitch + 0.25f * pitch, 3.f };
+        const float hi[3] = { 95.f, c * pitch + 0.75f * pitch, 7.f };
+        appendBox(tris, lo, hi, k, true);
+    }
+}
+
+// Non-manifold soup: a sphere plus duplicated faces, fins on existing edges (edges shared by three triangles),
+// stray triangles and degenerates, from a fixed seed.
+static void appendNoisySoup(std::vector<Triangle>& tris, size_t target) {
+    std::mt19937 rng(20240611u);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    const size_t first = tris.size();
+    appendSphere(tris, Vec3{ 0.f, 0.f, 0.f }, 10.f, target * 17 / 20);
+    const size_t base = tris.size() - first;
+    std::uniform_int_distribution<size_t> pick(first, first + base - 1);
+    for (size_t i = 0; i < base / 20; ++i) tris.push_back(tris[pick(rng)]);
+    for (size_t i = 0; i < base / 20; ++i) {
+        const Triangle t = tris[pick(rng)];
+        const Vec3 apex{ t.v0.x + 2.f * unit(rng), t.v0.y + 2.f * unit(rng), t.v0.z + 2.f * unit(rng) };
+        tris.push_back(makeTri(t.v0, t.v1, apex));
+    }
+    for (size_t i = 0; i < base / 50; ++i) {
+        const Vec3 a{ 12.f * unit(rng), 12.f * unit(rng), 12.f * unit(rng) };
+        tris.push_back(makeTri(a, Vec3{ a.x + unit(rng), a.y, a.z }, Vec3{ a.x, a.y + unit(rng), a.z + unit(rng) }));
+    }
+    for (size_t i = 0; i < base / 100; ++i) {
+        const Triangle t = tris[pick(rng)];
+        tris.push_back(makeTri(t.v0, t.v1, t.v1));
+    }
+}
+
+struct Record {
+    std::string mesh;
+    size_t triangles;
+    std::string stage;
+    std::vector<double> ms;
+};
+
+static double millisecondsOf(const std::function<void()>& fn) {
+    const auto t0 = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Time `timed` `repeat` times, running `setup` (untimed) before each run.
+static void timeStage(std::vector<Record>& out, const std::string& mesh, size_t triangles, const std::string& stage,
+    int repeat, const std::function<void()>& setup, const std::function<void()>& timed) {
+    Record r{ mesh, triangles, stage, {} };
+    for (int i = 0; i < repeat; ++i) {
+        if (setup) setup();
+        r.ms.push_back(millisecondsOf(timed));
+    }
+    out.push_back(r);
+    std::cerr << "  " << stage << ": " << std::fixed << std::setprecision(2) << *std::min_element(r.ms.begin(), r.ms.end())
+              << " ms\n";
+}
+
+// Returns false, dropping the mesh's records, if reading the written inputs back fails.
+static bool benchMesh(std::vector<Record>& out, const std::string& name, const std::vector<Triangle>& tris,
+    const std::string& workDir, unsigned threads, int repeat) {
+    const size_t n = tris.size();
+    const size_t firstRecord = out.size();
+    std::cerr << name << " (" << n << " triangles)\n";
+    const std::string asciiPath = workDir + "/bench_" + name + "_ascii.stl";
+    const std::string binaryPath = workDir + "/bench_" + name + "_binary.stl";
+    const std::string outPath = workDir + "/bench_" + name + "_out.stl";
+    StlReader::FluidOptions opts;
+    opts.threads = threads;
+    StlReader::ReadOptions readOpts;
+    readOpts.threads = threads;
+
+    timeStage(out, name, n, "write_ascii_triangles", repeat, nullptr,
+        [&] { StlReader::writeAsciiStlFromTriangles(asciiPath, tris, threads); });
+    timeStage(out, name, n, "write_binary_triangles", repeat, nullptr,
+        [&] { StlReader::writeBinaryStlFromTriangles(binaryPath, tris); });
+
+    StlReader r;
+    bool readOk = true;
+    auto readFailed = [&](const char* stage) {
+        if (readOk)
+            return false;
+        std::cerr << "  " << stage << " failed; skipping " << name << "\n";
+        out.erase(out.begin() + static_cast<std::ptrdiff_t>(firstRecord), out.end());
+        std::remove(asciiPath.c_str());
+        std::remove(binaryPath.c_str());
+        return true;
+    };
+    timeStage(out, name, n, "read_ascii", repeat, nullptr, [&] { readOk = r.read(asciiPath, readOpts) && readOk; });
+    if (readFailed("read_ascii")) return false;
+    timeStage(out, name, n, "read_binary", repeat, nullptr, [&] { readOk = r.read(binaryPath, readOpts) && readOk; });
+    if (readFailed("read_binary")) return false;
+    timeStage(out, name, n, "remove_duplicate_vertices", repeat, [&] { readOk = r.read(binaryPath, readOpts) && readOk; },
+        [&] { r.removeDuplicateVertices(); });
+    if (readFailed("remove_duplicate_vertices")) return false;
+    timeStage(out, name, n, "read_indexed_binary", repeat, nullptr,
+        [&] { readOk = r.readIndexed(binaryPath, readOpts) && readOk; });
+    if (readFailed("read_indexed_binary")) return false;
+    timeStage(out, name, n, "build_bvh", repeat, nullptr, [&] { r.buildBvh(); });
+
+    std::vector<size_t> evenHit;
+    timeStage(out, name, n, "classify_even_hit", repeat, nullptr, [&] { r.classifyEvenHit(evenHit, opts); });
+    StlReader::FluidOptions reuseOpts = opts;
+    reuseOpts.classifier = StlReader::Classifier::RayReuse;
+    std::vector<size_t> reuseHit;
+    timeStage(out, name, n, "classify_ray_reuse", repeat, nullptr, [&] { r.classifyEvenHit(reuseHit, reuseOpts); });
+    if (reuseHit != evenHit)
+        std::cerr << "  classify_ray_reuse: " << reuseHit.size() << " even-hit triangles vs " << evenHit.size() << " per triangle\n";
+    StlReader::FluidOptions windingOpts = opts;
+    windingOpts.classifier = StlReader::Classifier::WindingNumber;
+    std::vector<size_t> windingHit;
+    timeStage(out, name, n, "classify_winding_number", repeat, nullptr, [&] { r.classifyEvenHit(windingHit, windingOpts); });
+    if (windingHit != evenHit)
+        std::cerr << "  classify_winding_number: " << windingHit.size() << " fluid triangles vs " << evenHit.size() << " even-hit\n";
+    std::vector<Triangle> capped;
+    timeStage(out, name, n, "add_caps", repeat, nullptr, [&] { r.addCaps(evenHit, capped); });
+    std::vector<Triangle> cleaned;
+    std::ostringstream discard;
+    timeStage(out, name, n, "clean_mesh", repeat, [&] { cleaned = capped; },
+        [&] { discard.str(""); StlReader::cleanMesh(cleaned, discard); });
+    std::vector<Triangle> fluid;
+    timeStage(out, name, n, "compute_fluid_mesh", repeat, nullptr,
+        [&] { discard.str(""); r.computeFluidMesh(fluid, discard, opts); });
+
+    timeStage(out, name, n, "write_ascii_indexed", repeat, nullptr, [&] { r.writeAsciiStl(outPath, threads); });
+    timeStage(out, name, n, "write_binary_indexed", repeat, nullptr, [&] { r.writeBinaryStl(outPath); });
+    std::remove(asciiPath.c_str());
+    std::remove(binaryPath.c_str());
+    std::remove(outPath.c_str());
+    return true;
+}
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    const size_t m = v.size() / 2;
+    return v.size() % 2 ? v[m] : 0.5 * (v[m - 1] + v[m]);
+}
+
+static void writeJson(std::ostream& os, const std::vector<Record>& records, unsigned threads, int repeat) {
+    os << "{\n  \"tool\": \"stl_bench\",\n  \"threads\": " << threads << ",\n  \"ray_kernel\": \""
+       << rayKernelName(activeRayKernel()) << "\",\n  \"repeat\": " << repeat << ",\n  \"results\": [\n";
+    os << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < records.size(); ++i) {
+        const Record& r = records[i];
+        os << "    { \"mesh\": \"" << r.mesh << "\", \"triangles\": " << r.triangles << ", \"stage\": \"" << r.stage
+           << "\", \"median_ms\": " << median(r.ms) << ", \"min_ms\": " << *std::min_element(r.ms.begin(), r.ms.end())
+           << " }" << (i + 1 < records.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}\n";
+}
+
+static void writeCsv(std::ostream& os, const std::vector<Record>& records) {
+    os << "mesh,triangles,stage,median_ms,min_ms\n" << std::fixed << std::setprecision(3);
+    for (const Record& r : records)
+        os << r.mesh << "," << r.triangles << "," << r.stage << "," << median(r.ms) << ","
+           << *std::min_element(r.ms.begin(), r.ms.end()) << "\n";
+}
+
+// Non-negative decimal integer up to max, the whole of text (as stl_tool parses its counts).
+static bool parseCount(const char* text, unsigned long long max, unsigned long long& value) {
+    if (!text || *text < '0' || *text > '9')
+        return false;
+    errno = 0;
+    char* end = nullptr;
+    value = std::strtoull(text, &end, 10);
+    return errno == 0 && *end == '\0' && value <= max;
+}
+
+static bool parseSizes(const std::string& text, std::vector<size_t>& sizes) {
+    sizes.clear();
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        char* end = nullptr;
+        double v = std::strtod(item.c_str(), &end);
+        if (end && (*end == 'k' || *end == 'K')) { v *= 1e3; ++end; }
+        else if (end && (*end == 'm' || *end == 'M')) { v *= 1e6; ++end; }
+        if (!end || *end != '\0' || v < 1.) return false;
+        sizes.push_back(static_cast<size_t>(v));
+    }
+    return !sizes.empty();
+}
+
+static const unsigned long long kMaxChannels = 1000;
+static const unsigned long long kMaxRepeat = 1000000;
+static const unsigned long long kMaxThreadOption = 65536;  // as stl_tool --threads
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--sizes 1k,10k,100k] [--meshes sphere,plate,soup] [--channels N]\n"
+              << "       [--repeat N] [--threads N] [--format json|csv] [--out FILE] [--work-dir DIR]\n"
+              << "  --sizes     target triangle counts (k / M suffixes; up to 10M and beyond)\n"
+              << "  --meshes    generators to run: sphere, plate (internal channels), soup (non-manifold)\n"
+              << "  --channels  internal channels in the plate (default 6)\n"
+              << "  --repeat    runs per stage; median and minimum are reported (default 3)\n"
+              << "  --threads   worker threads (default 0 = all hardware threads)\n"
+              << "  --work-dir  where temporary STL files go (default .)\n";
+}
+
+int main(int argc, char* argv[]) {
+    const char* prog = argv[0] ? argv[0] : "stl_bench";
+    std::vector<size_t> sizes = { 1000, 10000, 100000 };
+    std::vector<std::string> meshes = { "sphere", "plate", "soup" };
+    int channels = 6, repeat = 3;
+    unsigned threads = 0;
+    std::string format = "json", outPath, workDir = ".";
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue) {
+            if (!parseSizes(argv[++i], sizes)) {
+                std::cerr << "Invalid sizes: " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--meshes" && hasValue) {
+            meshes.clear();
+            std::stringstream ss(argv[++i]);
+            std::string m;
+            while (std::getline(ss, m, ',')) {
+                if (m != "sphere" && m != "plate" && m != "soup") {
+                    std::cerr << "Unknown mesh generator: " << m << "\n";
+                    return 1;
+                }
+                meshes.push_back(m);
+            }
+        } else if (arg == "--channels" && hasValue) {
+            unsigned long long v = 0;
+            if (!parseCount(argv[++i], kMaxChannels, v) || v == 0) {
+                std::cerr << "Invalid channel count: " << argv[i] << " (expected 1 to " << kMaxChannels << ")\n";
+                return 1;
+            }
+            channels = static_cast<int>(v);
+        } else if (arg == "--repeat" && hasValue) {
+            unsigned long long v = 0;
+            if (!parseCount(argv[++i], kMaxRepeat, v) || v == 0) {
+                std::cerr << "Invalid repeat count: " << argv[i] << " (expected 1 to " << kMaxRepeat << ")\n";
+                return 1;
+            }
+            repeat = static_cast<int>(v);
+        } else if (arg == "--threads" && hasValue) {
+            unsigned long long v = 0;
+            if (!parseCount(argv[++i], kMaxThreadOption, v)) {
+                std::cerr << "Invalid thread count: " << argv[i] << " (expected 0 to " << kMaxThreadOption << ")\n";
+                return 1;
+            }
+            threads = static_cast<unsigned>(v);
+        } else if (arg == "--format" && hasValue) {
+            format = argv[++i];
+            if (format != "json" && format != "csv") {
+                std::cerr << "Invalid format '" << format << "' (expected json or csv)\n";
+                return 1;
+            }
+        } else if (arg == "--out" && hasValue) {
+            outPath = argv[++i];
+        } else if (arg == "--work-dir" && hasValue) {
+            workDir = argv[++i];
+        } else {
+            printUsage(prog);
+            return 1;
+        }
+    }
+    threads = resolveThreadCount(threads);
+
+    std::vector<Record> records;
+    bool failed = false;
+    for (size_t size : sizes) {
+        for (const std::string& m : meshes) {
+            std::vector<Triangle> tris;
+            if (m == "sphere") appendSphere(tris, Vec3{ 0.f, 0.f, 0.f }, 10.f, size);
+            else if (m == "plate") appendChannelPlate(tris, channels, size);
+            else appendNoisySoup(tris, size);
+            if (!benchMesh(records, m + "_" + std::to_string(size), tris, workDir, threads, repeat))
+                failed = true;
+        }
+    }
+
+    std::ofstream file;
+    if (!outPath.empty()) {
+        file.open(outPath);
+        if (!file) {
+            std::cerr << "Cannot write " << outPath << "\n";
+            return 1;
+        }
+    }
+    std::ostream& os = outPath.empty() ? std::cout : file;
+    if (format == "csv") writeCsv(os, records);
+    else writeJson(os, records, threads, repeat);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+#include "arena.h"
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+namespace {
+// Offset in block at or after used where an object of the given alignment can start.
+size_t alignedOffset(const char* block, size_t used, size_t align)
+{
+    const uintptr_t p = reinterpret_cast<uintptr_t>(block) + used;
+    return used + static_cast<size_t>(((p + align - 1) & ~static_cast<uintptr_t>(align - 1)) - p);
+}
+} // namespace
+
+Arena::Arena(size_t blockBytes) : blockBytes_(std::max(blockBytes, size_t(4096)))
+{
+}
+
+Arena::~Arena()
+{
+    for (const Block& b : blocks_)
+        ::operator delete(b.data);
+}
+
+void* Arena::allocate(size_t bytes, size_t align)
+{
+    if (bytes == 0) bytes = 1;
+    if (!blocks_.empty())
+    {
+        const Block& b = blocks_[current_];
+        const size_t start = alignedOffset(b.data, used_, align);
+        if (start <= b.size && bytes <= b.size - start)
+        {
+            used_ = start + bytes;
+            return b.data + start;
+        }
+    }
+    if (bytes > static_cast<size_t>(-1) / 2 - align) throw std::bad_alloc();
+
+    // Move to the next cached block that is large enough, dropping smaller ones, or add a block.
+    const size_t need = bytes + align;
+    const size_t next = blocks_.empty() ? 0 : current_ + 1;
+    while (next < blocks_.size() && blocks_[next].size < need)
+    {
+        ::operator delete(blocks_[next].data);
+        blocks_.erase(blocks_.begin() + static_cast<std::ptrdiff_t>(next));
+    }
+    if (next == blocks_.size())
+    {
+        size_t size = std::max(blockBytes_, need);
+        if (!blocks_.empty()) size = std::max(size, blocks_.back().size * 2);
+        blocks_.reserve(blocks_.size() + 1);
+        Block block = { static_cast<char*>(::operator new(size)), size };
+        blocks_.push_back(block);
+    }
+    current_ = next;
+    const Block& b = blocks_[current_];
+    const size_t start = alignedOffset(b.data, 0, align);
+    used_ = start + bytes;
+    return b.data + start;
+}
+
+void Arena::deallocate(void* p, size_t bytes)
+{
+    if (blocks_.empty() || bytes == 0) return;
+    char* c = static_cast<char*>(p);
+    const Block& b = blocks_[current_];
+    if (c >= b.data && c + bytes == b.data + used_)
+        used_ = static_cast<size_t>(c - b.data);
+}
+
+void Arena::rewind(const Mark& m)
+{
+    if (blocks_.empty()) return;
+    current_ = m.block;
+    used_ = m.used;
+}
+
+void Arena::trim()
+{
+    if (blocks_.empty()) return;
+    for (size_t i = current_ + 1; i < blocks_.size(); ++i)
+        ::operator delete(blocks_[i].data);
+    blocks_.resize(current_ + 1);
+}
+
+size_t Arena::reserved() const
+{
+    size_t total = 0;
+    for (const Block& b : blocks_)
+        total += b.size;
+    return total;
+}
+
+Arena& threadArena()
+{
+    thread_local Arena arena;
+    return arena;
+}
@@ -0,0 +1,104 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/** Monotonic scratch memory for the temporaries of one pipeline stage (edge tables, weld tables, loop and
+ *  label arrays). Allocation bumps a pointer in the current block; freeing is a no-op except for the most
+ *  recent allocation, which is handed back. rewind() returns to an earlier mark but keeps the blocks, so the
+ *  next stage or the next call reuses memory that is already mapped instead of going back to malloc and
+ *  faulting in fresh pages. Blocks grow geometrically and are released by trim() or the destructor.
+ *  Single-threaded: use threadArena() for the calling thread's own instance. */
+class Arena {
+public:
+    struct Mark {
+        size_t block;
+        size_t used;
+    };
+
+    explicit Arena(size_t blockBytes = size_t(1) << 20);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t align);
+    void deallocate(void* p, size_t bytes);
+
+    Mark mark() const { return { current_, used_ }; }
+    /** Drop everything allocated since m (which must belong to this arena and not be older than a trim()). */
+    void rewind(const Mark& m);
+    /** Free the blocks past the one in use. */
+    void trim();
+    /** Bytes held in blocks, used or cached. */
+    size_t reserved() const;
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    size_t current_ = 0;  // block being filled (blocks_ past it are free for reuse)
+    size_t used_ = 0;     // bytes used in blocks_[current_]
+    size_t blockBytes_;
+};
+
+/** This thread's arena. Stages running on worker threads each get their own; memory lives until thread exit. */
+Arena& threadArena();
+
+/** Stage lifetime: everything allocated from the arena while the scope is alive is dropped when it ends.
+ *  Declare it before the containers that use the arena. Scopes nest. */
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena& arena) : arena_(arena), mark_(arena.mark()) {}
+    ~ArenaScope() { arena_.rewind(mark_); }
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    Arena& arena() const { return arena_; }
+
+private:
+    Arena& arena_;
+    Arena::Mark mark_;
+};
+
+/** Standard allocator over an Arena; with no arena it uses the heap, so one container type serves both
+ *  stage temporaries and long-lived data. */
+template<class T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena* arena = nullptr) noexcept : arena_(arena) {}
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena_(other.arena()) {}
+
+    T* allocate(size_t n)
+    {
+        if (!arena_) return std::allocator<T>().allocate(n);
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t n)
+    {
+        if (!arena_) std::allocator<T>().deallocate(p, n);
+        else arena_->deallocate(p, n * sizeof(T));
+    }
+
+    Arena* arena() const { return arena_; }
+
+private:
+    Arena* arena_;
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() == b.arena(); }
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() != b.arena(); }
+
+template<class T>
+using ScratchVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
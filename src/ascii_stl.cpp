@@ -0,0 +1,287 @@
+#include "ascii_stl.h"
+#include "compressed_io.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+
+namespace {
+// libstdc++ (GCC 11+) and MSVC provide floating-point from_chars / to_chars; older libc++ does not.
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define ASCII_STL_CHARCONV 1
+#endif
+
+const size_t kMinChunkBytes = 1 << 20;
+const size_t kWriteChunkFacets = 1 << 14;
+const size_t kMaxFacetBytes = 320;  // fixed text ~104 bytes + 12 floats of at most 15 characters
+
+inline bool isSpace(char c) { return static_cast<unsigned char>(c) <= ' '; }
+
+struct Cursor {
+    const char* p;
+    const char* end;
+
+    // Next whitespace-delimited token; false at end of input.
+    bool next(const char*& tok, size_t& len)
+    {
+        while (p < end && isSpace(*p)) ++p;
+        if (p == end) return false;
+        tok = p;
+        while (p < end && !isSpace(*p)) ++p;
+        len = static_cast<size_t>(p - tok);
+        return true;
+    }
+};
+
+bool keyword(const char* tok, size_t len, const char* kw)
+{
+    const size_t n = std::strlen(kw);
+    if (len != n) return false;
+    for (size_t i = 0; i < n; ++i)
+    {
+        char c = tok[i];
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+        if (c != kw[i]) return false;
+    }
+    return true;
+}
+
+bool parseFloat(const char* tok, size_t len, float& out)
+{
+    if (len > 0 && *tok == '+') { ++tok; --len; }
+    if (len == 0) return false;
+#ifdef ASCII_STL_CHARCONV
+    auto r = std::from_chars(tok, tok + len, out);
+    return r.ec == std::errc() && r.ptr == tok + len;
+#else
+    char buf[64];
+    if (len >= sizeof buf) return false;
+    std::memcpy(buf, tok, len);
+    buf[len] = '\0';
+    char* endp = nullptr;
+    out = std::strtof(buf, &endp);
+    return endp == buf + len;
+#endif
+}
+
+bool nextFloat(Cursor& c, float& out)
+{
+    const char* tok;
+    size_t len;
+    return c.next(tok, len) && parseFloat(tok, len, out);
+}
+
+// Parse the body of one facet after its "facet" token. Returns 1 for a triangle, 0 if the normal is
+// malformed (facet skipped, cursor left behind the bad token), -1 if a vertex is malformed.
+int parseFacet(Cursor& c, StlReader::Triangle& t)
+{
+    const char* tok;
+    size_t len;
+    Cursor save = c;
+    if (!c.next(tok, len) || !keyword(tok, len, "normal")) { c = save; return 0; }
+    Cursor afterNormal = c;
+    if (!nextFloat(c, t.normal.x) || !nextFloat(c, t.normal.y) || !nextFloat(c, t.normal.z)) { c = afterNormal; return 0; }
+    for (StlReader::Vec3* v : { &t.v0, &t.v1, &t.v2 })
+    {
+        for (;;)
+        {
+            if (!c.next(tok, len)) return -1;
+            if (keyword(tok, len, "vertex")) break;
+            if (keyword(tok, len, "outer") || keyword(tok, len, "loop")) continue;
+            return -1;
+        }
+        if (!nextFloat(c, v->x) || !nextFloat(c, v->y) || !nextFloat(c, v->z)) return -1;
+    }
+    // Optional closing tokens.
+    for (const char* kw : { "endloop", "endfacet" })
+    {
+        save = c;
+        if (!c.next(tok, len) || !keyword(tok, len, kw)) c = save;
+    }
+    return 1;
+}
+
+// Parse every facet whose "facet" token starts in [begin, stop); the last one may run past stop.
+bool parseRange(const char* begin, const char* stop, const char* end, std::vector<StlReader::Triangle>& out)
+{
+    Cursor c{ begin, end };
+    const char* tok;
+    size_t len;
+    while (c.next(tok, len))
+    {
+        if (tok >= stop) break;
+        if (!keyword(tok, len, "facet")) continue;  // solid / endsolid lines and stray tokens
+        StlReader::Triangle t;
+        int r = parseFacet(c, t);
+        if (r < 0) return false;
+        if (r > 0) out.push_back(t);
+    }
+    return true;
+}
+
+// First position >= from where a "facet" token starts (token boundaries are whitespace, so this agrees with a
+// serial scan from the start of the body).
+const char* nextFacetStart(const char* bodyBegin, const char* from, const char* end)
+{
+    const char* p = from;
+    if (p > bodyBegin)
+        while (p < end && !isSpace(*p) && !isSpace(p[-1])) ++p;  // move off a token we landed inside
+    Cursor c{ p, end };
+    const char* tok;
+    size_t len;
+    while (c.next(tok, len))
+        if (keyword(tok, len, "facet")) return tok;
+    return end;
+}
+
+// Shortest text that reads back as the same float.
+char* formatFloat(char* p, char* end, float v)
+{
+#ifdef ASCII_STL_CHARCONV
+    return std::to_chars(p, end, v).ptr;
+#else
+    int n = std::snprintf(p, static_cast<size_t>(end - p), "%.9g", v);
+    return p + (n > 0 ? n : 0);
+#endif
+}
+
+char* appendText(char* p, const char* text)
+{
+    const size_t n = std::strlen(text);
+    std::memcpy(p, text, n);
+    return p + n;
+}
+
+char* formatVec3Line(char* p, char* end, const char* prefix, const StlReader::Vec3& v)
+{
+    p = appendText(p, prefix);
+    p = formatFloat(p, end, v.x);
+    *p++ = ' ';
+    p = formatFloat(p, end, v.y);
+    *p++ = ' ';
+    p = formatFloat(p, end, v.z);
+    *p++ = '\n';
+    return p;
+}
+
+// Format t at p (at least kMaxFacetBytes available); returns the end of the written text.
+char* formatFacet(char* p, const StlReader::Triangle& t)
+{
+    char* end = p + kMaxFacetBytes;
+    p = formatVec3Line(p, end, "  facet normal ", t.normal);
+    p = appendText(p, "    outer loop\n");
+    p = formatVec3Line(p, end, "      vertex ", t.v0);
+    p = formatVec3Line(p, end, "      vertex ", t.v1);
+    p = formatVec3Line(p, end, "      vertex ", t.v2);
+    return appendText(p, "    endloop\n  endfacet\n");
+}
+} // namespace
+
+void appendAsciiFacet(std::string& out, const StlReader::Triangle& t)
+{
+    char buf[kMaxFacetBytes];
+    out.append(buf, static_cast<size_t>(formatFacet(buf, t) - buf));
+}
+
+bool writeAsciiStlFile(const std::string& path, const std::string& name, size_t n,
+    const std::function<StlReader::Triangle(size_t)>& facet, unsigned threads)
+{
+    CompressedWriter f;
+    if (!f.open(path) || !f.write("solid " + name + "\n"))
+        return false;
+    threads = resolveThreadCount(threads);
+    const size_t chunks = (n + kWriteChunkFacets - 1) / kWriteChunkFacets;
+    std::vector<std::string> bufs(std::min<size_t>(chunks, threads));
+    // Each round formats one range per buffer in parallel, then writes the buffers in order (a compressed
+    // file's previous blocks are being compressed meanwhile).
+    bool ok = true;
+    for (size_t round = 0; round < chunks && ok; round += bufs.size())
+    {
+        const size_t inRound = std::min(bufs.size(), chunks - round);
+        parallelFor(inRound, 1, threads, [&](size_t b, size_t e, unsigned) {
+            for (size_t k = b; k < e; ++k)
+            {
+                const size_t first = (round + k) * kWriteChunkFacets;
+                const size_t last = std::min(n, first + kWriteChunkFacets);
+                std::string& buf = bufs[k];
+                buf.resize((last - first) * kMaxFacetBytes);
+                char* p = &buf[0];
+                for (size_t i = first; i < last; ++i)
+                    p = formatFacet(p, facet(i));
+                buf.resize(static_cast<size_t>(p - buf.data()));
+            }
+        });
+        for (size_t k = 0; k < inRound && ok; ++k)
+            ok = f.write(bufs[k]);
+    }
+    ok = ok && f.write("endsolid " + name + "\n");
+    return f.close() && ok;
+}
+
+bool parseAsciiFacets(const char* data, size_t size, size_t& pos, size_t maxFacets,
+    std::vector<StlReader::Triangle>& out)
+{
+    Cursor c{ data + pos, data + size };
+    const char* tok;
+    size_t len;
+    size_t added = 0;
+    while (added < maxFacets)
+    {
+        if (!c.next(tok, len))
+            break;
+        if (!keyword(tok, len, "facet")) continue;
+        StlReader::Triangle t;
+        int r = parseFacet(c, t);
+        if (r < 0) return false;
+        if (r > 0) { out.push_back(t); ++added; }
+    }
+    pos = static_cast<size_t>(c.p - data);
+    return true;
+}
+
+bool parseAsciiStl(const char* data, size_t size, std::string& header, std::vector<StlReader::Triangle>& out,
+    unsigned threads)
+{
+    out.clear();
+    const char* end = data + size;
+    const char* nl = static_cast<const char*>(std::memchr(data, '\n', size));
+    const char* body = nl ? nl + 1 : end;
+    header.assign(data, static_cast<size_t>((nl ? nl : end) - data));
+
+    const size_t bodySize = static_cast<size_t>(end - body);
+    threads = resolveThreadCount(threads);
+    size_t chunks = std::min<size_t>(static_cast<size_t>(threads) * 4, bodySize / kMinChunkBytes);
+    if (chunks <= 1)
+        return parseRange(body, end, end, out);
+
+    std::vector<const char*> starts(chunks + 1);
+    starts[0] = body;
+    for (size_t k = 1; k < chunks; ++k)
+        starts[k] = nextFacetStart(body, std::max(starts[k - 1], body + bodySize * k / chunks), end);
+    starts[chunks] = end;
+
+    std::vector<std::vector<StlReader::Triangle>> parts(chunks);
+    std::atomic<bool> ok(true);
+    parallelFor(chunks, 1, threads, [&](size_t b, size_t e, unsigned) {
+        for (size_t k = b; k < e; ++k)
+        {
+            // Rough reserve: a typical facet is ~250 bytes of text.
+            parts[k].reserve(static_cast<size_t>(starts[k + 1] - starts[k]) / 200);
+            if (!parseRange(starts[k], starts[k + 1], end, parts[k]))
+                ok = false;
+        }
+    });
+    if (!ok)
+        return false;
+    size_t total = 0;
+    for (const auto& p : parts) total += p.size();
+    out.reserve(total);
+    for (const auto& p : parts)
+        out.insert(out.end(), p.begin(), p.end());
+    return true;
+}
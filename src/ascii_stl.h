@@ -0,0 +1,36 @@
+#ifndef ASCII_STL_H
+#define ASCII_STL_H
+
+#include "stl_reader.h"
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+/** Parse an ASCII STL held in memory (e.g. a mapped file). The first line becomes header; facets are read as
+ *  whitespace-separated, case-insensitive tokens, so line breaks and spacing inside a facet do not matter and
+ *  "outer loop" / "endloop" / "endfacet" may be missing. A facet whose normal does not parse is skipped; a
+ *  vertex that does not parse fails the whole read. Large inputs are split at facet boundaries and parsed on
+ *  `threads` workers (0 = hardware concurrency); chunks are concatenated in file order. */
+bool parseAsciiStl(const char* data, size_t size, std::string& header, std::vector<StlReader::Triangle>& out,
+    unsigned threads);
+
+/** Incremental form of parseAsciiStl() for streaming: parses facets starting at data + pos (pos initially just
+ *  past the header line), appending them to out until maxFacets have been added or the input ends, and advances
+ *  pos past the facets read. Returns false on a malformed vertex; the same facets are accepted as by
+ *  parseAsciiStl(). */
+bool parseAsciiFacets(const char* data, size_t size, size_t& pos, size_t maxFacets,
+    std::vector<StlReader::Triangle>& out);
+
+/** Append one facet in the StlReader::writeOneFacet() layout, each float in shortest round-trip form
+ *  (std::to_chars; "%.9g" where the library lacks it). */
+void appendAsciiFacet(std::string& out, const StlReader::Triangle& t);
+
+/** Write "solid name", facet(0) .. facet(n - 1), "endsolid name" to path. Fixed-size ranges of facets are
+ *  formatted on `threads` workers (0 = hardware concurrency) into separate buffers and written in order, a
+ *  bounded number of ranges at a time, so the bytes do not depend on the thread count. A path ending in .gz or
+ *  .zst is compressed on a background thread (CompressedWriter). */
+bool writeAsciiStlFile(const std::string& path, const std::string& name, size_t n,
+    const std::function<StlReader::Triangle(size_t)>& facet, unsigned threads);
+
+#endif
@@ -0,0 +1,208 @@
+#include "batch.h"
+#include "compressed_io.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace {
+const uint64_t kAsciiBytesPerTriangle = 250;  // typical facet block written with %g-style floats
+
+// Name without a compression extension: "part.stl.gz" -> "part.stl".
+fs::path withoutCompression(const fs::path& p)
+{
+    return compressionForPath(p.string()) == Compression::None ? p : fs::path(p).replace_extension();
+}
+
+bool isStlName(const fs::path& p)
+{
+    std::string ext = withoutCompression(p).extension().string();
+    for (char& c : ext)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return ext == ".stl";
+}
+
+std::string trim(const std::string& s)
+{
+    size_t b = 0, e = s.size();
+    while (b < e && std::isspace(static_cast<unsigned char>(s[b]))) ++b;
+    while (e > b && std::isspace(static_cast<unsigned char>(s[e - 1]))) --e;
+    return s.substr(b, e - b);
+}
+} // namespace
+
+bool listBatchInputs(const std::string& source, std::vector<std::string>& paths, std::string& error)
+{
+    paths.clear();
+    std::error_code ec;
+    if (fs::is_directory(source, ec))
+    {
+        for (fs::directory_iterator it(source, ec), end; !ec && it != end; it.increment(ec))
+            if (isStlName(it->path()) && it->is_regular_file(ec))
+                paths.push_back(it->path().string());
+        if (ec)
+        {
+            error = "cannot list " + source + ": " + ec.message();
+            return false;
+        }
+        std::sort(paths.begin(), paths.end());
+    }
+    else
+    {
+        std::ifstream f(source);
+        if (!f)
+        {
+            error = "cannot open manifest " + source;
+            return false;
+        }
+        const fs::path base = fs::path(source).parent_path();
+        std::string line;
+        while (std::getline(f, line))
+        {
+            line = trim(line);
+            if (line.empty() || line[0] == '#') continue;
+            const fs::path p(line);
+            paths.push_back(p.is_absolute() || base.empty() ? p.string() : (base / p).string());
+        }
+    }
+    if (paths.empty())
+    {
+        error = "no STL inputs in " + source;
+        return false;
+    }
+    return true;
+}
+
+uint64_t estimateTriangleCount(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return 0;
+    f.seekg(0, std::ios::end);
+    const uint64_t size = static_cast<uint64_t>(f.tellg());
+    f.seekg(0);
+    unsigned char header[84];
+    if (size >= sizeof header && f.read(reinterpret_cast<char*>(header), sizeof header) &&
+        std::memcmp(header, "solid", 5) != 0)
+    {
+        uint32_t count;
+        std::memcpy(&count, header + 80, 4);
+        if ((size - sizeof header) / 50 >= count)
+            return count;
+    }
+    return size / kAsciiBytesPerTriangle + 1;
+}
+
+std::string expandOutputTemplate(const std::string& outputTemplate, const std::string& inputPath)
+{
+    const std::string name = withoutCompression(inputPath).stem().string();
+    std::string out;
+    for (size_t i = 0; i < outputTemplate.size();)
+    {
+        if (outputTemplate.compare(i, 6, "{name}") == 0)
+        {
+            out += name;
+            i += 6;
+        }
+        else
+            out += outputTemplate[i++];
+    }
+    if (out.empty() || out.back() != '/')
+        out += '/';
+    return out;
+}
+
+bool findOutputCollision(const std::string& outputTemplate, const std::vector<std::string>& inputs, std::string& error)
+{
+    std::vector<std::pair<std::string, size_t>> dirs;  // (normalized output directory, input)
+    dirs.reserve(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i)
+        dirs.push_back({ fs::path(expandOutputTemplate(outputTemplate, inputs[i])).lexically_normal().string(), i });
+    std::sort(dirs.begin(), dirs.end());
+    for (size_t k = 1; k < dirs.size(); ++k)
+    {
+        if (dirs[k].first != dirs[k - 1].first)
+            continue;
+        error = inputs[dirs[k - 1].second] + " and " + inputs[dirs[k].second] + " both write to " + dirs[k].first;
+        return true;
+    }
+    return false;
+}
+
+void runBatch(const std::vector<uint64_t>& weights, const BatchOptions& opts,
+    const std::function<void(size_t, unsigned)>& job)
+{
+    const size_t n = weights.size();
+    if (n == 0) return;
+    const unsigned threads = resolveThreadCount(opts.threads);
+    const unsigned jobs = static_cast<unsigned>(std::min<size_t>(n, opts.jobs ? resolveThreadCount(opts.jobs) : threads));
+    const unsigned share = std::max(1u, threads / jobs);
+
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return weights[a] > weights[b]; });
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<char> started(n, 0);
+    size_t next = 0;  // first position in order not yet started
+    uint64_t resident = 0;
+    unsigned running = 0;
+    std::exception_ptr failure;
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(m);
+        for (;;)
+        {
+            while (next < n && started[order[next]]) ++next;
+            if (next == n || failure) return;
+            size_t pick = n;
+            for (size_t k = next; k < n && pick == n; ++k)
+            {
+                const size_t i = order[k];
+                if (!started[i] && (opts.maxResidentWeight == 0 || resident + weights[i] <= opts.maxResidentWeight))
+                    pick = i;
+            }
+            if (pick == n && running == 0)
+                pick = order[next];  // too large for the cap even alone
+            if (pick == n)
+            {
+                cv.wait(lock);
+                continue;
+            }
+            started[pick] = 1;
+            resident += weights[pick];
+            ++running;
+            lock.unlock();
+            try
+            {
+                job(pick, share);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(m);
+                if (!failure) failure = std::current_exception();
+            }
+            lock.lock();
+            resident -= weights[pick];
+            --running;
+            cv.notify_all();
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned j = 1; j < jobs; ++j)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& t : pool)
+        t.join();
+    if (failure)
+        std::rethrow_exception(failure);
+}
@@ -0,0 +1,49 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/** Batch processing (--batch): many inputs in one run, scheduled largest first with a cap on the triangles
+ *  loaded at once. The driver supplies the per-file work; this module lists inputs, estimates their size and
+ *  runs the schedule. */
+
+/** Inputs named by source: a directory (its *.stl, *.stl.gz and *.stl.zst files, any case, sorted by name) or
+ *  a manifest with one path per line (blank lines and lines starting with '#' skipped; relative paths are taken
+ *  from the manifest's directory). False with a message in error if the source cannot be read or lists nothing. */
+bool listBatchInputs(const std::string& source, std::vector<std::string>& paths, std::string& error);
+
+/** Triangle count of an STL without reading it: the header count of a binary file, or for ASCII (or an
+ *  unreadable header, e.g. a compressed file) an estimate from the file size. 0 if the file cannot be opened. */
+uint64_t estimateTriangleCount(const std::string& path);
+
+/** outputTemplate with every "{name}" replaced by the input's file name without directory and extension (and
+ *  without a .gz / .zst before it), and a trailing '/' added if missing. */
+std::string expandOutputTemplate(const std::string& outputTemplate, const std::string& inputPath);
+
+/** Whether two inputs expand outputTemplate to the same directory (compared after lexical normalization), e.g.
+ *  a/part.stl and b/part.stl under "{name}". Concurrent jobs would then overwrite each other's files, so the
+ *  driver refuses such a batch; error names the first colliding pair. */
+bool findOutputCollision(const std::string& outputTemplate, const std::vector<std::string>& inputs, std::string& error);
+
+struct BatchOptions {
+    /** Files processed at once (0 = one per hardware thread, at most one per file). */
+    unsigned jobs = 0;
+    /** Worker threads shared by the running files, split evenly between the jobs (0 = all hardware threads). */
+    unsigned threads = 0;
+    /** Cap on the summed weights (estimated triangles) of the files being processed (0 = no cap). A file over
+     *  the cap on its own still runs, once nothing else is resident. */
+    uint64_t maxResidentWeight = 0;
+};
+
+/** Run job(i, threads) for every item, on opts.jobs threads of their own. Items start in decreasing order of
+ *  weight (longest processing time first, index order on ties); a free job takes the first waiting item that
+ *  fits under maxResidentWeight, so small parts fill in beside a large one. `threads` is each job's share of
+ *  opts.threads. The first exception thrown by a job is rethrown after every started item has finished. */
+void runBatch(const std::vector<uint64_t>& weights, const BatchOptions& opts,
+    const std::function<void(size_t, unsigned)>& job);
+
+#endif
@@ -1,12 +1,32 @@
 #!/bin/bash
+# ./build.sh      CPU build: stl_tool
+# ./build.sh gpu  also builds stl_tool_gpu with the CUDA ray-casting backend (needs nvcc; NVCC and CUDA_HOME
+#                 override the compiler and toolkit location, CUDA_ARCH the target, e.g. sm_80)
 set -e
 CXX="${CXX:-clang++}"
 SDK=$(xcrun --show-sdk-path 2>/dev/null || true)
+# -ffp-contract=off: no fused multiply-add, so the scalar ray test rounds exactly as the vector kernels (and the
+# GPU build, --fmad=false) do; clang fuses a*b + c*d by default on arm64.
 if [ -n "$SDK" ]; then
   CXXINC="$SDK/usr/include/c++/v1"
-  CXXFLAGS="-std=c++17 -isysroot $SDK -stdlib=libc++ -I$CXXINC"
+  CXXFLAGS="-std=c++17 -ffp-contract=off -O2 -pthread -isysroot $SDK -stdlib=libc++ -I$CXXINC"
 else
-  CXXFLAGS="-std=c++17"
+  CXXFLAGS="-std=c++17 -ffp-contract=off -O2 -pthread"
 fi
-$CXX $CXXFLAGS -o stl_tool main.cpp stl_reader.cpp
+# gzip / zstd compressed STL where zlib / libzstd are installed (header and library both found).
+have() { printf '#include <%s>\nint main() { return 0; }\n' "$1" | $CXX $CXXFLAGS $EXTRA_CXXFLAGS -x c++ - -o /dev/null "$2" >/dev/null 2>&1; }
+LIBS=""
+if have zlib.h -lz; then CXXFLAGS="$CXXFLAGS -DSTL_TOOL_ZLIB"; LIBS="$LIBS -lz"; fi
+if have zstd.h -lzstd; then CXXFLAGS="$CXXFLAGS -DSTL_TOOL_ZSTD"; LIBS="$LIBS -lzstd"; fi
+SOURCES="main.cpp stl_reader.cpp compressed_io.cpp bvh.cpp parallel.cpp ray_kernel.cpp robust_ray.cpp mapped_file.cpp ascii_stl.cpp vertex_weld.cpp mesh_topology.cpp mesh_components.cpp morton.cpp arena.cpp batch.cpp even_hit_cache.cpp winding_number.cpp stl_stream.cpp fast_validate.cpp profile.cpp"
+$CXX $CXXFLAGS $EXTRA_CXXFLAGS -o stl_tool $SOURCES gpu_raycast_stub.cpp $LIBS
 echo "Run: ./stl_tool"
+if [ "$1" = "gpu" ]; then
+  CUDA_HOME="${CUDA_HOME:-/usr/local/cuda}"
+  NVCC="${NVCC:-$CUDA_HOME/bin/nvcc}"
+  # No fused multiply-add: the device must round exactly as the CPU kernels do.
+  $NVCC -std=c++17 -O3 --fmad=false ${CUDA_ARCH:+-arch=$CUDA_ARCH} -ccbin "$CXX" -c gpu_raycast.cu -o gpu_raycast.o
+  $CXX $CXXFLAGS $EXTRA_CXXFLAGS -o stl_tool_gpu $SOURCES gpu_raycast.o -L"$CUDA_HOME/lib64" -lcudart $LIBS
+  rm -f gpu_raycast.o
+  echo "Run: ./stl_tool_gpu --backend gpu"
+fi
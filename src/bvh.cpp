@@ -0,0 +1,168 @@
+#include "bvh.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const int kBins = 12;
+
+struct Box {
+    float lo[3] = { 3.4e38f, 3.4e38f, 3.4e38f };
+    float hi[3] = { -3.4e38f, -3.4e38f, -3.4e38f };
+    void grow(const float p[3])
+    {
+        for (int a = 0; a < 3; ++a) { lo[a] = std::min(lo[a], p[a]); hi[a] = std::max(hi[a], p[a]); }
+    }
+    void grow(const Box& b)
+    {
+        for (int a = 0; a < 3; ++a) { lo[a] = std::min(lo[a], b.lo[a]); hi[a] = std::max(hi[a], b.hi[a]); }
+    }
+    float area() const
+    {
+        float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+        if (dx < 0.f || dy < 0.f || dz < 0.f) return 0.f;
+        return dx * dy + dy * dz + dz * dx;
+    }
+};
+
+struct Prim {
+    Box box;
+    float centroid[3];
+};
+
+struct Builder {
+    const std::vector<Prim>& prims;
+    std::vector<uint32_t>& order;
+    std::vector<Bvh::Node>& nodes;
+    uint32_t maxLeafSize;
+    float pad;
+    int maxDepth;
+
+    uint32_t emit(uint32_t first, uint32_t count, int depth)
+    {
+        Box bounds, centroids;
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            bounds.grow(prims[order[i]].box);
+            centroids.grow(prims[order[i]].centroid);
+        }
+        const uint32_t self = static_cast<uint32_t>(nodes.size());
+        Bvh::Node node;
+        for (int a = 0; a < 3; ++a) { node.bmin[a] = bounds.lo[a] - pad; node.bmax[a] = bounds.hi[a] + pad; }
+        node.offset = first;
+        node.count = count;
+        nodes.push_back(node);
+        if (count <= maxLeafSize || depth >= maxDepth)
+            return self;
+
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = 3.4e38f;
+        for (int a = 0; a < 3; ++a)
+        {
+            const float extent = centroids.hi[a] - centroids.lo[a];
+            if (extent <= 0.f) continue;
+            Box binBox[kBins];
+            uint32_t binCount[kBins] = {};
+            const float scale = kBins / extent;
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                const Prim& p = prims[order[i]];
+                int b = std::min(kBins - 1, static_cast<int>((p.centroid[a] - centroids.lo[a]) * scale));
+                binBox[b].grow(p.box);
+                ++binCount[b];
+            }
+            float rightArea[kBins];
+            uint32_t rightCount[kBins];
+            Box acc;
+            uint32_t n = 0;
+            for (int b = kBins - 1; b > 0; --b)
+            {
+                acc.grow(binBox[b]);
+                n += binCount[b];
+                rightArea[b] = acc.area();
+                rightCount[b] = n;
+            }
+            acc = Box();
+            n = 0;
+            for (int b = 0; b < kBins - 1; ++b)
+            {
+                acc.grow(binBox[b]);
+                n += binCount[b];
+                if (n == 0 || rightCount[b + 1] == 0) continue;
+                float cost = acc.area() * n + rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost) { bestCost = cost; bestAxis = a; bestSplit = b; }
+            }
+        }
+
+        uint32_t mid;
+        if (bestAxis >= 0)
+        {
+            const int a = bestAxis;
+            const float lo = centroids.lo[a];
+            const float scale = kBins / (centroids.hi[a] - lo);
+            auto it = std::partition(order.begin() + first, order.begin() + first + count, [&](uint32_t p) {
+                return std::min(kBins - 1, static_cast<int>((prims[p].centroid[a] - lo) * scale)) <= bestSplit;
+            });
+            mid = static_cast<uint32_t>(it - order.begin());
+        }
+        else
+        {
+            // All centroids coincide: split the range in half so leaves stay bounded.
+            mid = first + count / 2;
+        }
+        if (mid == first || mid == first + count)
+            mid = first + count / 2;
+
+        nodes[self].count = 0;
+        emit(first, mid - first, depth + 1);
+        const uint32_t right = emit(mid, first + count - mid, depth + 1);
+        nodes[self].offset = right;
+        return self;
+    }
+};
+} // namespace
+
+void Bvh::clear()
+{
+    nodes_.clear();
+    primIndices_.clear();
+    soa_.clear();
+}
+
+void Bvh::build(const std::vector<StlReader::Vec3>& vertices, const std::vector<StlReader::IndexedTri>& triangles,
+    uint32_t maxLeafSize)
+{
+    clear();
+    if (triangles.empty())
+        return;
+    if (maxLeafSize == 0)
+        maxLeafSize = 1;
+
+    std::vector<Prim> prims(triangles.size());
+    Box scene;
+    for (size_t i = 0; i < triangles.size(); ++i)
+    {
+        const StlReader::IndexedTri& t = triangles[i];
+        Prim& p = prims[i];
+        for (size_t vi : { t.v0, t.v1, t.v2 })
+        {
+            const float v[3] = { vertices[vi].x, vertices[vi].y, vertices[vi].z };
+            p.box.grow(v);
+        }
+        for (int a = 0; a < 3; ++a)
+            p.centroid[a] = 0.5f * (p.box.lo[a] + p.box.hi[a]);
+        scene.grow(p.box);
+    }
+    // Pad node boxes so that hits the exact triangle test accepts on an edge are never culled by rounding.
+    float extent = 0.f;
+    for (int a = 0; a < 3; ++a)
+        extent = std::max({ extent, scene.hi[a] - scene.lo[a], std::fabs(scene.lo[a]), std::fabs(scene.hi[a]) });
+    const float pad = extent * 1e-5f + 1e-30f;
+
+    primIndices_.resize(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i)
+        primIndices_[i] = static_cast<uint32_t>(i);
+    nodes_.reserve(2 * (triangles.size() / maxLeafSize + 1));
+    Builder b{ prims, primIndices_, nodes_, maxLeafSize, pad, kMaxDepth };
+    b.emit(0, static_cast<uint32_t>(triangles.size()), 0);
+    soa_.build(vertices, triangles, primIndices_.data(), primIndices_.size());
+}
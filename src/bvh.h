@@ -0,0 +1,119 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "ray_kernel.h"
+#include "stl_reader.h"
+#include <cstdint>
+#include <vector>
+
+/** Bounding volume hierarchy over an indexed set of triangles. Built top-down with a binned surface area
+ *  heuristic and flattened depth-first into a linear node array: an interior node's left child is the next
+ *  node, its right child is stored in offset. Leaves reference a contiguous range of primIndices(), and soa()
+ *  holds the triangles in that same order so a leaf is one block for the packet kernel. */
+class Bvh {
+public:
+    struct Node {
+        float bmin[3];
+        float bmax[3];
+        uint32_t offset;  // leaf: first entry in primIndices(); interior: index of right child
+        uint32_t count;   // leaf: number of triangles; interior: 0
+    };
+
+    /** Build over all triangles. Leaves hold at most maxLeafSize triangles unless they cannot be split. */
+    void build(const std::vector<StlReader::Vec3>& vertices, const std::vector<StlReader::IndexedTri>& triangles,
+        uint32_t maxLeafSize = 4);
+    void clear();
+
+    bool empty() const { return nodes_.empty(); }
+    size_t triangleCount() const { return primIndices_.size(); }
+    const std::vector<Node>& nodes() const { return nodes_; }
+    /** Triangle indices in leaf order. */
+    const std::vector<uint32_t>& primIndices() const { return primIndices_; }
+    /** Triangle data in leaf order (slot k is triangle primIndices()[k]). */
+    const TriangleSoA& soa() const { return soa_; }
+
+    /** Visit every leaf whose box is touched by the ray ro + t * rd, t >= 0. Calls leaf(first, count) with a
+     *  range of slots in primIndices() / soa(); the caller does the exact triangle tests. conservative widens
+     *  each slab interval by its rounding error (Ize's bound, as in PBRT) so that rounding never skips a box
+     *  the ray touches, e.g. where it grazes a face shared with a triangle (FluidOptions::robust). */
+    template <class LeafFn>
+    void traverse(const StlReader::Vec3& ro, const StlReader::Vec3& rd, LeafFn&& leaf, bool conservative = false) const;
+    /** traverse() that stops as soon as leaf(first, count) returns true (e.g. for an any-hit query). Returns
+     *  whether it stopped early. */
+    template <class LeafFn>
+    bool traverseUntil(const StlReader::Vec3& ro, const StlReader::Vec3& rd, LeafFn&& leaf, bool conservative = false) const;
+
+private:
+    static const int kMaxDepth = 60;
+
+    static bool rayHitsBox(const Node& n, const float o[3], const float d[3], const float inv[3], float farScale);
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> primIndices_;
+    TriangleSoA soa_;
+};
+
+inline bool Bvh::rayHitsBox(const Node& n, const float o[3], const float d[3], const float inv[3], float farScale)
+{
+    float tnear = 0.f, tfar = 3.4e38f;
+    for (int a = 0; a < 3; ++a)
+    {
+        if (d[a] == 0.f)
+        {
+            if (o[a] < n.bmin[a] || o[a] > n.bmax[a])
+                return false;
+            continue;
+        }
+        float t0 = (n.bmin[a] - o[a]) * inv[a];
+        float t1 = (n.bmax[a] - o[a]) * inv[a];
+        if (t0 > t1) { float tmp = t0; t0 = t1; t1 = tmp; }
+        t1 *= farScale;
+        if (t0 > tnear) tnear = t0;
+        if (t1 < tfar) tfar = t1;
+        if (tnear > tfar)
+            return false;
+    }
+    return true;
+}
+
+template <class LeafFn>
+bool Bvh::traverseUntil(const StlReader::Vec3& ro, const StlReader::Vec3& rd, LeafFn&& leaf, bool conservative) const
+{
+    if (nodes_.empty())
+        return false;
+    // 1 + 2 * gamma(3), gamma(n) = n * 2^-24 / (1 - n * 2^-24): covers the rounding of both slab distances.
+    const float farScale = conservative ? 1.f + 2.f * (3.f * 5.9604645e-8f) / (1.f - 3.f * 5.9604645e-8f) : 1.f;
+    const float o[3] = { ro.x, ro.y, ro.z };
+    const float d[3] = { rd.x, rd.y, rd.z };
+    const float inv[3] = { d[0] != 0.f ? 1.f / d[0] : 0.f, d[1] != 0.f ? 1.f / d[1] : 0.f, d[2] != 0.f ? 1.f / d[2] : 0.f };
+    uint32_t stack[kMaxDepth + 4];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0)
+    {
+        const uint32_t ni = stack[--sp];
+        const Node& n = nodes_[ni];
+        if (!rayHitsBox(n, o, d, inv, farScale))
+            continue;
+        if (n.count > 0)
+        {
+            if (leaf(n.offset, n.count))
+                return true;
+            continue;
+        }
+        stack[sp++] = n.offset;
+        stack[sp++] = ni + 1;
+    }
+    return false;
+}
+
+template <class LeafFn>
+void Bvh::traverse(const StlReader::Vec3& ro, const StlReader::Vec3& rd, LeafFn&& leaf, bool conservative) const
+{
+    traverseUntil(ro, rd, [&](uint32_t first, uint32_t count) {
+        leaf(first, count);
+        return false;
+    }, conservative);
+}
+
+#endif
@@ -0,0 +1,441 @@
+#include "compressed_io.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#ifdef STL_TOOL_ZLIB
+#include <zlib.h>
+#endif
+#ifdef STL_TOOL_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+const size_t kBlockBytes = size_t(1) << 20;  // handed to the compression thread at a time
+const size_t kMaxQueuedBlocks = 4;           // producer waits beyond this
+const size_t kMaxCodecChunk = size_t(1) << 30;  // zlib counts in 32-bit unsigned
+const size_t kMaxTrustedRatio = 16;             // size hints beyond this many times the input are not believed
+#ifdef STL_TOOL_ZLIB
+const int kGzipLevel = 3;  // about twice the speed of the default 6 for ~30% more bytes on ASCII STL
+#endif
+#ifdef STL_TOOL_ZSTD
+const int kZstdLevel = 3;
+#endif
+
+bool endsWith(const std::string& s, const char* suffix)
+{
+    const size_t n = std::strlen(suffix);
+    if (s.size() < n) return false;
+    for (size_t i = 0; i < n; ++i)
+        if (std::tolower(static_cast<unsigned char>(s[s.size() - n + i])) != suffix[i])
+            return false;
+    return true;
+}
+
+// First output capacity for a decoder: the size the header claims, but no more than kMaxTrustedRatio times the
+// compressed size, so a few forged header bytes cannot cause a huge allocation. Output past it grows by doubling.
+size_t initialCapacity(uint64_t claimed, size_t compressed)
+{
+    const uint64_t trusted = static_cast<uint64_t>(compressed) * kMaxTrustedRatio;
+    return static_cast<size_t>(std::max<uint64_t>(std::min(claimed, trusted), 1 << 16));
+}
+
+#ifdef STL_TOOL_ZLIB
+bool inflateGzip(const unsigned char* data, size_t size, std::vector<unsigned char>& out)
+{
+    z_stream z{};
+    if (inflateInit2(&z, 15 + 16) != Z_OK)
+        return false;
+    // ISIZE trailer of the last member: uncompressed size mod 2^32, a good first capacity if it is plausible.
+    uint32_t isize = 0;
+    if (size >= 18)
+        std::memcpy(&isize, data + size - 4, 4);
+    out.resize(initialCapacity(isize, size));
+    size_t pos = 0, used = 0;
+    bool ok = false;
+    for (;;)
+    {
+        if (z.avail_in == 0 && pos < size)
+        {
+            const size_t m = std::min(size - pos, kMaxCodecChunk);
+            z.next_in = const_cast<Bytef*>(data + pos);
+            z.avail_in = static_cast<uInt>(m);
+            pos += m;
+        }
+        if (used == out.size())
+            out.resize(out.size() * 2);
+        const size_t room = std::min(out.size() - used, kMaxCodecChunk);
+        z.next_out = out.data() + used;
+        z.avail_out = static_cast<uInt>(room);
+        const int r = inflate(&z, Z_NO_FLUSH);
+        used += room - z.avail_out;
+        if (r == Z_STREAM_END)
+        {
+            if (z.avail_in == 0 && pos == size)
+            {
+                ok = true;
+                break;
+            }
+            inflateReset(&z);  // another member follows
+        }
+        else if (r != Z_OK)
+            break;  // corrupt, or Z_BUF_ERROR: input ended inside a member
+    }
+    inflateEnd(&z);
+    out.resize(ok ? used : 0);
+    return ok;
+}
+#endif
+
+#ifdef STL_TOOL_ZSTD
+bool inflateZstd(const unsigned char* data, size_t size, std::vector<unsigned char>& out)
+{
+    ZSTD_DCtx* d = ZSTD_createDCtx();
+    if (!d)
+        return false;
+    const unsigned long long hint = ZSTD_getFrameContentSize(data, size);
+    const bool known = hint != ZSTD_CONTENTSIZE_UNKNOWN && hint != ZSTD_CONTENTSIZE_ERROR;
+    out.resize(initialCapacity(known ? hint : 0, size));
+    ZSTD_inBuffer in{ data, size, 0 };
+    size_t used = 0;
+    bool ok = false;
+    for (;;)
+    {
+        if (used == out.size())
+            out.resize(out.size() * 2);
+        ZSTD_outBuffer o{ out.data() + used, out.size() - used, 0 };
+        const size_t r = ZSTD_decompressStream(d, &o, &in);
+        if (ZSTD_isError(r))
+            break;
+        used += o.pos;
+        if (in.pos == in.size && r == 0)
+        {
+            ok = true;  // every frame complete and flushed
+            break;
+        }
+        if (in.pos == in.size && o.pos < o.size)
+            break;  // the decoder wants input that is not there: truncated
+    }
+    ZSTD_freeDCtx(d);
+    out.resize(ok ? used : 0);
+    return ok;
+}
+#endif
+} // namespace
+
+Compression compressionForPath(const std::string& path)
+{
+    if (endsWith(path, ".gz")) return Compression::Gzip;
+    if (endsWith(path, ".zst")) return Compression::Zstd;
+    return Compression::None;
+}
+
+Compression compressionOfData(const void* data, size_t size)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    if (size >= 2 && p[0] == 0x1f && p[1] == 0x8b) return Compression::Gzip;
+    if (size >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd) return Compression::Zstd;
+    return Compression::None;
+}
+
+const char* compressionName(Compression c)
+{
+    switch (c)
+    {
+    case Compression::Gzip: return "gzip";
+    case Compression::Zstd: return "zstd";
+    default: return "none";
+    }
+}
+
+bool compressionSupported(Compression c)
+{
+    switch (c)
+    {
+#ifdef STL_TOOL_ZLIB
+    case Compression::Gzip: return true;
+#endif
+#ifdef STL_TOOL_ZSTD
+    case Compression::Zstd: return true;
+#endif
+    case Compression::None: return true;
+    default: return false;
+    }
+}
+
+bool decompress(const void* data, size_t size, Compression c, std::vector<unsigned char>& out)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    out.clear();
+    switch (c)
+    {
+#ifdef STL_TOOL_ZLIB
+    case Compression::Gzip: return inflateGzip(p, size, out);
+#endif
+#ifdef STL_TOOL_ZSTD
+    case Compression::Zstd: return inflateZstd(p, size, out);
+#endif
+    case Compression::None:
+        out.assign(p, p + size);
+        return true;
+    default: return false;
+    }
+}
+
+std::string temporaryPathFor(const std::string& path)
+{
+    static std::atomic<unsigned> serial{ 0 };
+    const uint64_t salt = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+        static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    return path + ".tmp" + std::to_string(salt) + "-" + std::to_string(serial++);
+}
+
+struct CompressedWriter::State {
+    std::string path;  // target, renamed to on close()
+    std::string temp;  // being written
+    std::ofstream file;
+    Compression codec = Compression::None;
+    bool failed = false;  // producer side; the thread reports through threadFailed
+    std::string block;    // being filled by write()
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::string> queued;
+    std::vector<std::string> spare;  // drained blocks, reused to keep allocations off the hot path
+    bool finishing = false;
+    bool threadFailed = false;
+    std::thread thread;
+    std::vector<unsigned char> out;  // codec output, touched only by the thread
+#ifdef STL_TOOL_ZLIB
+    z_stream z{};
+#endif
+#ifdef STL_TOOL_ZSTD
+    ZSTD_CCtx* zstd = nullptr;
+#endif
+
+    // Compress in (finish: and end the stream) and write the result. Runs on the thread only.
+    bool encode(const std::string& in, bool finish)
+    {
+#ifdef STL_TOOL_ZLIB
+        if (codec == Compression::Gzip)
+        {
+            z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+            z.avail_in = static_cast<uInt>(in.size());
+            int r;
+            do
+            {
+                z.next_out = out.data();
+                z.avail_out = static_cast<uInt>(out.size());
+                r = deflate(&z, finish ? Z_FINISH : Z_NO_FLUSH);
+                if (r == Z_STREAM_ERROR)
+                    return false;
+                file.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size() - z.avail_out));
+            } while (z.avail_out == 0 || (finish && r != Z_STREAM_END));
+            return !!file;
+        }
+#endif
+#ifdef STL_TOOL_ZSTD
+        if (codec == Compression::Zstd)
+        {
+            ZSTD_inBuffer src{ in.data(), in.size(), 0 };
+            for (;;)
+            {
+                ZSTD_outBuffer dst{ out.data(), out.size(), 0 };
+                const size_t r = ZSTD_compressStream2(zstd, &dst, &src, finish ? ZSTD_e_end : ZSTD_e_continue);
+                if (ZSTD_isError(r))
+                    return false;
+                file.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(dst.pos));
+                if (finish ? r == 0 : src.pos == src.size)
+                    break;
+            }
+            return !!file;
+        }
+#endif
+        (void)in;
+        (void)finish;
+        return false;
+    }
+
+    void run()
+    {
+        bool ok = true;
+        std::unique_lock<std::mutex> lock(m);
+        for (;;)
+        {
+            cv.wait(lock, [&] { return !queued.empty() || finishing; });
+            if (queued.empty())
+                break;
+            std::string in = std::move(queued.front());
+            queued.pop_front();
+            lock.unlock();
+            cv.notify_all();
+            if (ok)
+                ok = encode(in, false);
+            in.clear();
+            lock.lock();
+            spare.push_back(std::move(in));
+            threadFailed = !ok;
+        }
+        lock.unlock();
+        if (ok)
+            ok = encode(std::string(), true);
+        lock.lock();
+        threadFailed = !ok;
+    }
+
+    void submit()
+    {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return queued.size() < kMaxQueuedBlocks; });
+        queued.push_back(std::move(block));
+        block.clear();
+        if (!spare.empty())
+        {
+            block.swap(spare.back());
+            spare.pop_back();
+        }
+        lock.unlock();
+        cv.notify_all();
+    }
+
+    void releaseCodec()
+    {
+#ifdef STL_TOOL_ZLIB
+        if (codec == Compression::Gzip)
+            deflateEnd(&z);
+#endif
+#ifdef STL_TOOL_ZSTD
+        ZSTD_freeCCtx(zstd);
+        zstd = nullptr;
+#endif
+        codec = Compression::None;
+    }
+};
+
+CompressedWriter::CompressedWriter() = default;
+
+CompressedWriter::~CompressedWriter()
+{
+    finish(false);
+}
+
+bool CompressedWriter::open(const std::string& path)
+{
+    finish(false);
+    const Compression codec = compressionForPath(path);
+    if (!compressionSupported(codec))
+        return false;
+    std::unique_ptr<State> s(new State);
+    s->path = path;
+    s->temp = temporaryPathFor(path);
+    s->file.open(s->temp, std::ios::binary);
+    if (!s->file)
+        return false;
+    bool ready = codec == Compression::None;
+#ifdef STL_TOOL_ZLIB
+    // windowBits 15 + 16: gzip framing; the header carries no name or time, so output is reproducible.
+    if (codec == Compression::Gzip)
+        ready = deflateInit2(&s->z, kGzipLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+#endif
+#ifdef STL_TOOL_ZSTD
+    if (codec == Compression::Zstd)
+    {
+        s->zstd = ZSTD_createCCtx();
+        ready = s->zstd && !ZSTD_isError(ZSTD_CCtx_setParameter(s->zstd, ZSTD_c_compressionLevel, kZstdLevel));
+        if (!ready)
+        {
+            ZSTD_freeCCtx(s->zstd);
+            s->zstd = nullptr;
+        }
+    }
+#endif
+    if (!ready)
+    {
+        s->file.close();
+        std::remove(s->temp.c_str());
+        return false;
+    }
+    s->codec = codec;
+    if (codec != Compression::None)
+    {
+        s->block.reserve(kBlockBytes);
+        s->out.resize(kBlockBytes / 4);
+        State* raw = s.get();
+        s->thread = std::thread([raw] { raw->run(); });
+    }
+    state_ = std::move(s);
+    return true;
+}
+
+bool CompressedWriter::write(const void* data, size_t size)
+{
+    State* s = state_.get();
+    if (!s || s->failed)
+        return false;
+    if (s->codec == Compression::None)
+    {
+        s->file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        s->failed = !s->file;
+        return !s->failed;
+    }
+    const char* p = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        const size_t m = std::min(size, kBlockBytes - s->block.size());
+        s->block.append(p, m);
+        p += m;
+        size -= m;
+        if (s->block.size() == kBlockBytes)
+            s->submit();
+    }
+    std::lock_guard<std::mutex> lock(s->m);
+    s->failed = s->threadFailed;
+    return !s->failed;
+}
+
+bool CompressedWriter::close()
+{
+    return finish(true);
+}
+
+bool CompressedWriter::finish(bool commit)
+{
+    if (!state_)
+        return false;
+    State* s = state_.get();
+    if (s->thread.joinable())
+    {
+        if (!s->block.empty())
+            s->submit();
+        {
+            std::lock_guard<std::mutex> lock(s->m);
+            s->finishing = true;
+        }
+        s->cv.notify_all();
+        s->thread.join();
+        s->failed = s->failed || s->threadFailed;
+    }
+    s->releaseCodec();
+    s->file.close();
+    bool ok = commit && !s->failed && !s->file.fail();
+    if (ok)
+    {
+        std::error_code ec;
+        std::filesystem::rename(s->temp, s->path, ec);
+        ok = !ec;
+    }
+    if (!ok)
+        std::remove(s->temp.c_str());
+    state_.reset();
+    return ok;
+}
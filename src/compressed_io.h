@@ -0,0 +1,68 @@
+#ifndef COMPRESSED_IO_H
+#define COMPRESSED_IO_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** gzip / zstd framing of STL files. The writers stream through CompressedWriter, whose background thread
+ *  compresses and writes each full block while the caller formats the next records; the readers inflate a
+ *  compressed input into memory and parse that. A codec is available when the build found its library
+ *  (STL_TOOL_ZLIB for gzip, STL_TOOL_ZSTD for zstd; see build.sh). */
+
+enum class Compression { None, Gzip, Zstd };
+
+/** Codec named by a file's extension: ".gz" gzip, ".zst" zstd (any case), anything else None. */
+Compression compressionForPath(const std::string& path);
+
+/** Codec whose frame magic starts data (gzip 1f 8b, zstd 28 b5 2f fd), otherwise None. */
+Compression compressionOfData(const void* data, size_t size);
+
+/** "gzip", "zstd" or "none". */
+const char* compressionName(Compression c);
+
+/** Whether this build reads and writes c (always true for None). */
+bool compressionSupported(Compression c);
+
+/** Decompress size bytes at data (a gzip stream, concatenated members allowed, or one or more zstd frames) into
+ *  out. False if the codec is not supported or the stream is corrupt or truncated. */
+bool decompress(const void* data, size_t size, Compression c, std::vector<unsigned char>& out);
+
+/** A name beside path, unique to this process and call, for writing a file that is then renamed over path. */
+std::string temporaryPathFor(const std::string& path);
+
+/** Sequential file writer, compressing on a background thread when the file is gzip or zstd. Plain files are
+ *  written directly. Output bytes depend only on what is written, not on thread timing. The bytes go to a
+ *  temporary file beside the target that close() renames over it, so readers of the path see the previous
+ *  file or the complete new one, never a partial write. */
+class CompressedWriter {
+public:
+    CompressedWriter();
+    ~CompressedWriter();
+    CompressedWriter(const CompressedWriter&) = delete;
+    CompressedWriter& operator=(const CompressedWriter&) = delete;
+
+    /** Create path, compressed as compressionForPath(path) says. False if the codec is not supported or the
+     *  file cannot be created. */
+    bool open(const std::string& path);
+
+    /** Append size bytes. With compression they are copied into the current block; a full block is queued for
+     *  the background thread, waiting while a few blocks are already queued so memory stays bounded. False
+     *  once any write has failed. */
+    bool write(const void* data, size_t size);
+    bool write(const std::string& s) { return write(s.data(), s.size()); }
+
+    /** Queue the last block, finish the stream, close the file and rename it to the target. False if any step
+     *  failed, including an earlier write; the temporary file is then removed and the target left as it was. A
+     *  writer destroyed while still open is abandoned the same way. */
+    bool close();
+
+private:
+    bool finish(bool commit);
+
+    struct State;
+    std::unique_ptr<State> state_;
+};
+
+#endif
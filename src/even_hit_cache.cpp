@@ -0,0 +1,141 @@
+#include "even_hit_cache.h"
+#include "compressed_io.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+const char kMagic[8] = { 'S', 'T', 'L', 'E', 'V', 'E', 'N', '1' };
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+const size_t kChunkBytes = size_t(1) << 20;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t mixWord(uint64_t h, uint64_t w)
+{
+    return rotl(h ^ (w * kPrime2), 31) * kPrime1;
+}
+
+inline uint64_t finish(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime1;
+    h ^= h >> 32;
+    return h;
+}
+
+// Chunked hash of a byte range: each 1 MB chunk is hashed on its own (in parallel), then the chunk hashes are
+// folded in order, so the result does not depend on the worker count.
+uint64_t hashBytes(const unsigned char* data, size_t bytes, uint64_t seed, unsigned threads)
+{
+    const size_t chunks = (bytes + kChunkBytes - 1) / kChunkBytes;
+    std::vector<uint64_t> partial(chunks);
+    parallelFor(chunks, 1, threads, [&](size_t begin, size_t end, unsigned) {
+        for (size_t c = begin; c < end; ++c)
+        {
+            const unsigned char* p = data + c * kChunkBytes;
+            const size_t n = std::min(kChunkBytes, bytes - c * kChunkBytes);
+            uint64_t h = seed + c * kPrime1;
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                uint64_t w;
+                std::memcpy(&w, p + i, 8);
+                h = mixWord(h, w);
+            }
+            uint64_t tail = 0;
+            std::memcpy(&tail, p + i, n - i);
+            partial[c] = finish(mixWord(h, tail ^ (static_cast<uint64_t>(n) << 56)));
+        }
+    });
+    uint64_t h = seed ^ static_cast<uint64_t>(bytes) * kPrime2;
+    for (uint64_t p : partial)
+        h = mixWord(h, p);
+    return finish(h);
+}
+
+uint64_t floatBits(float f)
+{
+    uint32_t u;
+    std::memcpy(&u, &f, 4);
+    return u;
+}
+} // namespace
+
+uint64_t evenHitCacheKey(const std::vector<StlReader::Vec3>& vertices,
+    const std::vector<StlReader::IndexedTri>& triangles, const StlReader::FluidOptions& opts, unsigned threads)
+{
+    const unsigned workers = resolveThreadCount(threads);
+    uint64_t h = hashBytes(reinterpret_cast<const unsigned char*>(vertices.data()),
+        vertices.size() * sizeof(StlReader::Vec3), 1, workers);
+    h = mixWord(h, hashBytes(reinterpret_cast<const unsigned char*>(triangles.data()),
+        triangles.size() * sizeof(StlReader::IndexedTri), 2, workers));
+    h = mixWord(h, floatBits(opts.originOffset) | floatBits(opts.tMin) << 32);
+    h = mixWord(h, floatBits(opts.tEps) | static_cast<uint64_t>(opts.classifier) << 32 |
+        static_cast<uint64_t>(opts.bruteForce) << 40 |
+        static_cast<uint64_t>(opts.robust) << 41 | static_cast<uint64_t>(sizeof(StlReader::Index)) << 48);
+    return finish(h);
+}
+
+std::string evenHitCachePath(const std::string& dir, uint64_t key)
+{
+    char name[40];
+    std::snprintf(name, sizeof name, "evenhit-%016llx.bin", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(dir) / name).string();
+}
+
+bool loadEvenHitCache(const std::string& dir, uint64_t key, size_t triangleCount, std::vector<size_t>& evenHit)
+{
+    evenHit.clear();
+    std::ifstream f(evenHitCachePath(dir, key), std::ios::binary);
+    if (!f) return false;
+    char magic[8];
+    uint64_t header[3];  // key, triangle count, entries
+    if (!f.read(magic, 8) || std::memcmp(magic, kMagic, 8) != 0 ||
+        !f.read(reinterpret_cast<char*>(header), sizeof header) || header[0] != key || header[1] != triangleCount ||
+        header[2] > triangleCount)
+        return false;
+    std::vector<uint64_t> entries(static_cast<size_t>(header[2]));
+    if (!entries.empty() && !f.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(uint64_t)))
+        return false;
+    for (size_t i = 0; i < entries.size(); ++i)
+        if (entries[i] >= triangleCount || (i > 0 && entries[i] <= entries[i - 1]))
+            return false;
+    evenHit.assign(entries.begin(), entries.end());
+    return true;
+}
+
+bool storeEvenHitCache(const std::string& dir, uint64_t key, size_t triangleCount, const std::vector<size_t>& evenHit)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    const std::string path = evenHitCachePath(dir, key);
+    const std::string temp = temporaryPathFor(path);
+    {
+        std::ofstream f(temp, std::ios::binary);
+        const uint64_t header[3] = { key, static_cast<uint64_t>(triangleCount), static_cast<uint64_t>(evenHit.size()) };
+        const std::vector<uint64_t> entries(evenHit.begin(), evenHit.end());
+        f.write(kMagic, 8);
+        f.write(reinterpret_cast<const char*>(header), sizeof header);
+        f.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(uint64_t));
+        if (!f.flush())
+        {
+            f.close();
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    std::filesystem::rename(temp, path, ec);
+    if (ec)
+    {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
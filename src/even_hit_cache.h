@@ -0,0 +1,33 @@
+#ifndef EVEN_HIT_CACHE_H
+#define EVEN_HIT_CACHE_H
+
+#include "stl_reader.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** On-disk cache of the even-hit selection (FluidOptions::cacheDir, --cache-dir). The selection depends only on
+ *  the indexed mesh and the classifier settings, so one file per key holds the ascending triangle list and a
+ *  repeat run on the same part skips ray casting (and the BVH build) entirely. */
+
+/** Key of a selection: a 64-bit hash of the vertex and indexed-triangle bytes, hashed in parallel chunks on
+ *  `threads` workers (0 = all hardware threads; the value does not depend on it), combined with the bit
+ *  patterns of originOffset, tMin and tEps, the classifier, bruteForce and the index width. */
+uint64_t evenHitCacheKey(const std::vector<StlReader::Vec3>& vertices,
+    const std::vector<StlReader::IndexedTri>& triangles, const StlReader::FluidOptions& opts, unsigned threads);
+
+/** File of key in dir: dir/evenhit-<16 hex digits>.bin. */
+std::string evenHitCachePath(const std::string& dir, uint64_t key);
+
+/** Read the selection stored for key into evenHit. False (a miss) if there is no file, or it does not belong
+ *  to key and a mesh of triangleCount triangles, or it is truncated or not strictly ascending below
+ *  triangleCount. */
+bool loadEvenHitCache(const std::string& dir, uint64_t key, size_t triangleCount, std::vector<size_t>& evenHit);
+
+/** Store evenHit for key, creating dir if needed. The file is written under a temporary name and renamed into
+ *  place, so concurrent runs never read a partial entry. False if it cannot be written (the cache is then
+ *  simply not used). */
+bool storeEvenHitCache(const std::string& dir, uint64_t key, size_t triangleCount, const std::vector<size_t>& evenHit);
+
+#endif
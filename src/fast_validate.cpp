@@ -0,0 +1,299 @@
+#include "fast_validate.h"
+#include "parallel.h"
+#include "profile.h"
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+namespace {
+typedef StlReader::Vec3 Vec3;
+typedef StlReader::Index Index;
+
+const size_t kBlock = size_t(1) << 16;  // triangles per block of the per-triangle pass and the shard scatter
+const size_t kShards = 256;
+
+inline uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+struct EdgeKey {
+    Index lo, hi;
+    bool operator<(const EdgeKey& o) const { return lo != o.lo ? lo < o.lo : hi < o.hi; }
+    bool operator==(const EdgeKey& o) const { return lo == o.lo && hi == o.hi; }
+    size_t shard() const { return static_cast<size_t>(mix(static_cast<uint64_t>(lo) ^ mix(hi)) % kShards); }
+};
+
+struct FaceKey {
+    Index v[3];  // sorted
+    bool operator<(const FaceKey& o) const { return std::lexicographical_compare(v, v + 3, o.v, o.v + 3); }
+    bool operator==(const FaceKey& o) const { return v[0] == o.v[0] && v[1] == o.v[1] && v[2] == o.v[2]; }
+    size_t shard() const { return static_cast<size_t>(mix(static_cast<uint64_t>(v[0]) ^ mix(v[1] ^ mix(v[2]))) % kShards); }
+};
+
+// Runs of equal keys: how many, how many of length 1 and above 2, and the keys beyond the first of each run.
+struct RunTally {
+    uint64_t runs = 0, single = 0, overTwo = 0, repeats = 0;
+};
+
+// Tally the K keys keysOf(i, keys) yields for each of n triangles. Keys go to shards by hash; each block of
+// triangles owns a fixed range of each shard (counted first, then filled), so the layout and the sorted shards
+// do not depend on the thread count.
+template <size_t K, class Key, class KeysOf>
+RunTally tallyKeys(size_t n, unsigned threads, KeysOf keysOf)
+{
+    const size_t blocks = (n + kBlock - 1) / kBlock;
+    std::vector<size_t> slots(blocks * kShards, 0);  // per (block, shard): key count, then next free position
+    parallelFor(blocks, 1, threads, [&](size_t begin, size_t end, unsigned) {
+        Key keys[K];
+        for (size_t b = begin; b < end; ++b)
+            for (size_t i = b * kBlock; i < std::min(n, (b + 1) * kBlock); ++i)
+            {
+                keysOf(i, keys);
+                for (const Key& k : keys)
+                    ++slots[b * kShards + k.shard()];
+            }
+    });
+    std::vector<size_t> shardStart(kShards + 1);
+    size_t pos = 0;
+    for (size_t s = 0; s < kShards; ++s)
+    {
+        shardStart[s] = pos;
+        for (size_t b = 0; b < blocks; ++b)
+        {
+            const size_t count = slots[b * kShards + s];
+            slots[b * kShards + s] = pos;
+            pos += count;
+        }
+    }
+    shardStart[kShards] = pos;
+    std::vector<Key> sharded(pos);
+    parallelFor(blocks, 1, threads, [&](size_t begin, size_t end, unsigned) {
+        Key keys[K];
+        for (size_t b = begin; b < end; ++b)
+            for (size_t i = b * kBlock; i < std::min(n, (b + 1) * kBlock); ++i)
+            {
+                keysOf(i, keys);
+                for (const Key& k : keys)
+                    sharded[slots[b * kShards + k.shard()]++] = k;
+            }
+    });
+    std::vector<RunTally> perShard(kShards);
+    parallelFor(kShards, 1, threads, [&](size_t begin, size_t end, unsigned) {
+        for (size_t s = begin; s < end; ++s)
+        {
+            const auto first = sharded.begin() + shardStart[s], last = sharded.begin() + shardStart[s + 1];
+            std::sort(first, last);
+            RunTally& t = perShard[s];
+            for (auto i = first; i != last;)
+            {
+                auto j = i + 1;
+                while (j != last && *j == *i) ++j;
+                const size_t length = static_cast<size_t>(j - i);
+                ++t.runs;
+                t.single += length == 1;
+                t.overTwo += length > 2;
+                t.repeats += length - 1;
+                i = j;
+            }
+        }
+    });
+    RunTally total;
+    for (const RunTally& t : perShard)
+    {
+        total.runs += t.runs;
+        total.single += t.single;
+        total.overTwo += t.overTwo;
+        total.repeats += t.repeats;
+    }
+    return total;
+}
+
+// Per-triangle results of one block, merged in block order.
+struct BlockResult {
+    uint64_t degenerate = 0, windingOk = 0, windingOpposite = 0;
+    double volume = 0.;
+    std::vector<std::pair<size_t, float>> opposite;  // lowest input ids, at most maxListed
+};
+} // namespace
+
+void fastValidate(const StlReader& mesh, FastValidateReport& report, const FastValidateOptions& opts)
+{
+    ProfileScope scope("fast_validate");
+    report = FastValidateReport();
+    const std::vector<Vec3>& vertices = mesh.vertices();
+    const std::vector<StlReader::IndexedTri>& tris = mesh.indexedTriangles();
+    const std::vector<Vec3>& facetNormals = mesh.originalFacetNormals();
+    const size_t n = tris.size();
+    const unsigned threads = resolveThreadCount(opts.threads);
+    const bool winding = facetNormals.size() == n;
+    StreamReport& counts = report.counts;
+    counts.triangles = n;
+    counts.uniqueVertices = vertices.size();
+    if (n == 0)
+    {
+        report.firstFailure = FastValidateFailure::NoTriangles;
+        return;
+    }
+
+    {
+        // Same tests as checkWatertight() (degenerate) and checkRightHandWinding(), and volume().
+        ProfileScope triScope("triangles");
+        const float areaEps = 1e-10f, tol = 1e-5f;
+        std::vector<BlockResult> blocks((n + kBlock - 1) / kBlock);
+        parallelFor(blocks.size(), 1, threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t b = begin; b < end; ++b)
+            {
+                BlockResult& r = blocks[b];
+                for (size_t i = b * kBlock; i < std::min(n, (b + 1) * kBlock); ++i)
+                {
+                    const Vec3& a = vertices[tris[i].v0], &v1 = vertices[tris[i].v1], &v2 = vertices[tris[i].v2];
+                    const float ex = v1.x - a.x, ey = v1.y - a.y, ez = v1.z - a.z;
+                    const float fx = v2.x - a.x, fy = v2.y - a.y, fz = v2.z - a.z;
+                    const float nx = ey * fz - ez * fy, ny = ez * fx - ex * fz, nz = ex * fy - ey * fx;
+                    if (nx * nx + ny * ny + nz * nz <= areaEps * areaEps) ++r.degenerate;
+                    r.volume += (a.x * (v1.y * v2.z - v1.z * v2.y) + a.y * (v1.z * v2.x - v1.x * v2.z) +
+                        a.z * (v1.x * v2.y - v1.y * v2.x)) / 6.0;
+                    if (!winding)
+                        continue;
+                    const Vec3 nrm = StlReader::facetNormal(a, v1, v2);
+                    if (nrm.x * nrm.x + nrm.y * nrm.y + nrm.z * nrm.z <= 0.f)
+                        continue;
+                    const Vec3& orig = facetNormals[i];
+                    const float dot = nrm.x * orig.x + nrm.y * orig.y + nrm.z * orig.z;
+                    if (dot > tol)
+                    {
+                        ++r.windingOk;
+                    }
+                    else if (dot < -tol)
+                    {
+                        ++r.windingOpposite;
+                        r.opposite.push_back({ mesh.originalTriangleId(i), dot });
+                        // Keep the lowest ids only, so a badly wound mesh costs no more memory than a good one.
+                        if (r.opposite.size() >= 2 * opts.maxListed + 64)
+                        {
+                            std::nth_element(r.opposite.begin(), r.opposite.begin() + opts.maxListed, r.opposite.end());
+                            r.opposite.resize(opts.maxListed);
+                        }
+                    }
+                }
+            }
+        });
+        double volume = 0.;
+        for (BlockResult& r : blocks)
+        {
+            counts.degenerateTriangles += r.degenerate;
+            counts.windingOk += r.windingOk;
+            counts.windingOpposite += r.windingOpposite;
+            volume += r.volume;
+            report.oppositeWinding.insert(report.oppositeWinding.end(), r.opposite.begin(), r.opposite.end());
+        }
+        counts.volume = volume < 0 ? -volume : volume;
+        std::sort(report.oppositeWinding.begin(), report.oppositeWinding.end());
+        if (report.oppositeWinding.size() > opts.maxListed)
+            report.oppositeWinding.resize(opts.maxListed);
+        triScope.count("degenerate_triangles", counts.degenerateTriangles);
+        triScope.count("opposite_winding", counts.windingOpposite);
+    }
+    if (counts.degenerateTriangles > 0)
+        report.firstFailure = FastValidateFailure::Degenerate;
+    else if (counts.windingOpposite > 0)
+        report.firstFailure = FastValidateFailure::Winding;
+    if (opts.stopOnFailure && !report.passed())
+    {
+        report.stoppedEarly = true;
+        return;
+    }
+
+    {
+        ProfileScope edgeScope("edges");
+        const RunTally edges = tallyKeys<3, EdgeKey>(n, threads, [&](size_t i, EdgeKey* keys) {
+            const Index v[3] = { tris[i].v0, tris[i].v1, tris[i].v2 };
+            for (int k = 0; k < 3; ++k)
+                keys[k] = { std::min(v[k], v[(k + 1) % 3]), std::max(v[k], v[(k + 1) % 3]) };
+        });
+        counts.uniqueEdges = edges.runs;
+        counts.boundaryEdges = edges.single;
+        counts.nonManifoldEdges = edges.overTwo;
+        edgeScope.count("unique_edges", edges.runs);
+    }
+    if (report.passed() && (counts.boundaryEdges > 0 || counts.nonManifoldEdges > 0))
+        report.firstFailure = FastValidateFailure::Edges;
+    if (opts.stopOnFailure && !report.passed())
+    {
+        report.stoppedEarly = true;
+        return;
+    }
+
+    {
+        ProfileScope faceScope("faces");
+        const RunTally faces = tallyKeys<1, FaceKey>(n, threads, [&](size_t i, FaceKey* keys) {
+            keys[0] = { { tris[i].v0, tris[i].v1, tris[i].v2 } };
+            std::sort(keys[0].v, keys[0].v + 3);
+        });
+        counts.duplicateTriangles = faces.repeats;
+        faceScope.count("duplicate_triangles", faces.repeats);
+    }
+    if (report.passed() && counts.duplicateTriangles > 0)
+        report.firstFailure = FastValidateFailure::Duplicates;
+}
+
+const char* fastValidateFailureName(FastValidateFailure f)
+{
+    switch (f)
+    {
+    case FastValidateFailure::NoTriangles: return "no triangles";
+    case FastValidateFailure::Degenerate: return "degenerate triangles";
+    case FastValidateFailure::Winding: return "opposite winding";
+    case FastValidateFailure::Edges: return "open or non-manifold edges";
+    case FastValidateFailure::Duplicates: return "duplicate triangles";
+    default: return "none";
+    }
+}
+
+void printFastValidateReport(const FastValidateReport& r, std::ostream& out)
+{
+    const StreamReport& c = r.counts;
+    if (r.firstFailure == FastValidateFailure::NoTriangles)
+    {
+        out << "Watertight: no triangles\n";
+        out << "Right-hand rule: 0 OK, 0 opposite winding\n";
+        out << "Volume: " << std::fixed << std::setprecision(10) << c.volume << "\n";
+        out << "Result: FAIL (" << fastValidateFailureName(r.firstFailure) << ")\n";
+        return;
+    }
+    const bool edgesChecked = !r.stoppedEarly || r.firstFailure == FastValidateFailure::Edges;
+    const bool facesChecked = !r.stoppedEarly;
+    for (const auto& w : r.oppositeWinding)
+        out << "  triangle " << w.first << " opposite winding (dot=" << w.second << ")\n";
+    if (c.windingOpposite > r.oppositeWinding.size())
+        out << "  ... " << (c.windingOpposite - r.oppositeWinding.size()) << " more opposite winding\n";
+    if (c.duplicateTriangles > 0)
+        out << "Duplicate triangles: " << c.duplicateTriangles << "\n";
+    if (edgesChecked)
+        out << "Edges: " << c.uniqueEdges << " unique; " << c.boundaryEdges << " boundary (count=1), "
+            << c.nonManifoldEdges << " non-manifold (count>2)\n";
+    else
+        out << "Edges: not checked\n";
+    if (c.degenerateTriangles > 0)
+        out << "Degenerate triangles (zero area): " << c.degenerateTriangles << "\n";
+    out << "Vertices: " << c.uniqueVertices << " unique (from " << c.triangles << " triangles)\n";
+    const bool known = c.degenerateTriangles > 0 || (edgesChecked && facesChecked) || c.boundaryEdges > 0 ||
+        c.nonManifoldEdges > 0;
+    out << "Watertight: " << (!known ? "not checked" : (c.watertight() ? "yes" : "no")) << "\n";
+    out << "Right-hand rule: " << c.windingOk << " OK, " << c.windingOpposite << " opposite winding\n";
+    out << "Volume: " << std::fixed << std::setprecision(10) << c.volume << "\n";
+    if (r.stoppedEarly)
+        out << "Stopped at the first failure; " << (edgesChecked ? "duplicate triangles" : "edges and duplicate triangles")
+            << " not checked\n";
+    if (r.passed())
+        out << "Result: PASS\n";
+    else
+        out << "Result: FAIL (" << fastValidateFailureName(r.firstFailure) << ")\n";
+}
@@ -0,0 +1,53 @@
+#ifndef FAST_VALIDATE_H
+#define FAST_VALIDATE_H
+
+#include "stl_reader.h"
+#include "stl_stream.h"
+#include <cstddef>
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+/** Pass/fail gate behind --validate --fast: the counts of checkWatertight(), checkRightHandWinding() and volume()
+ *  for an indexed mesh, computed in parallel without building MeshTopology. Per-triangle checks run over fixed
+ *  blocks of triangles; edges and faces are hash-partitioned into shards, each sorted and counted on its own.
+ *  The counts do not depend on the thread count. */
+
+struct FastValidateOptions {
+    unsigned threads = 0;
+    /** Skip the remaining checks once a class has failed. Classes run in FastValidateFailure order; degenerate
+     *  triangles and winding share the first pass, so both are always counted. */
+    bool stopOnFailure = false;
+    /** Opposite-winding triangles listed individually; the rest are only counted. */
+    size_t maxListed = 20;
+};
+
+/** The first failing check class, in the order the checks run. */
+enum class FastValidateFailure { None, NoTriangles, Degenerate, Winding, Edges, Duplicates };
+
+struct FastValidateReport {
+    /** Totals, laid out as the streaming validator's (uniqueEdges .. duplicateTriangles stay 0 when skipped). */
+    StreamReport counts;
+    /** (input triangle id, dot) of the opposite-winding triangles with the lowest ids, at most maxListed, ascending. */
+    std::vector<std::pair<size_t, float>> oppositeWinding;
+    FastValidateFailure firstFailure = FastValidateFailure::None;
+    /** Whether stopOnFailure skipped the edge or duplicate-face checks. */
+    bool stoppedEarly = false;
+
+    bool passed() const { return firstFailure == FastValidateFailure::None; }
+};
+
+/** Check mesh (after readIndexed() / removeDuplicateVertices()). The volume is summed per block, so it can
+ *  differ from volume() in the last digits. */
+void fastValidate(const StlReader& mesh, FastValidateReport& report,
+    const FastValidateOptions& opts = FastValidateOptions());
+
+/** Print the listed triangles and the counts in the layout of printStreamReport() (skipped checks say "not
+ *  checked"; a mesh without triangles says "Watertight: no triangles"), then "Result: PASS" or
+ *  "Result: FAIL (<class>)". */
+void printFastValidateReport(const FastValidateReport& r, std::ostream& out);
+
+/** "no triangles", "degenerate triangles", "opposite winding", "open or non-manifold edges", "duplicate triangles" or "none". */
+const char* fastValidateFailureName(FastValidateFailure f);
+
+#endif
@@ -0,0 +1,232 @@
+#include "gpu_raycast.h"
+#include "bvh.h"
+#include <cuda_runtime.h>
+#include <cstring>
+
+// Built only by `./build.sh gpu` (nvcc --fmad=false: the device must round every product and sum exactly as the
+// CPU kernels do, or grazing hits could be counted differently).
+
+namespace {
+const float kEps = 1e-6f;       // same as StlReader::rayIntersect()
+const int kMaxHits = 64;        // per-ray hit list; more hits fall back to the CPU
+const int kStackSize = 64;      // Bvh::kMaxDepth + 4
+
+struct DeviceNode {
+    float bmin[3];
+    float bmax[3];
+    uint32_t offset;
+    uint32_t count;
+};
+static_assert(sizeof(DeviceNode) == sizeof(Bvh::Node), "node layout must match Bvh::Node");
+
+struct DeviceMesh {
+    const DeviceNode* nodes;
+    const float* v0x; const float* v0y; const float* v0z;
+    const float* e1x; const float* e1y; const float* e1z;
+    const float* e2x; const float* e2y; const float* e2z;
+    const uint32_t* ids;
+    const float* centroids;  // xyz per triangle
+    const float* normals;
+};
+
+// Bvh::rayHitsBox().
+__device__ bool hitsBox(const DeviceNode& n, const float o[3], const float d[3], const float inv[3])
+{
+    float tnear = 0.f, tfar = 3.4e38f;
+    for (int a = 0; a < 3; ++a)
+    {
+        if (d[a] == 0.f)
+        {
+            if (o[a] < n.bmin[a] || o[a] > n.bmax[a])
+                return false;
+            continue;
+        }
+        float t0 = (n.bmin[a] - o[a]) * inv[a];
+        float t1 = (n.bmax[a] - o[a]) * inv[a];
+        if (t0 > t1) { float tmp = t0; t0 = t1; t1 = tmp; }
+        if (t0 > tnear) tnear = t0;
+        if (t1 < tfar) tfar = t1;
+        if (tnear > tfar)
+            return false;
+    }
+    return true;
+}
+
+// intersectScalar() in ray_kernel.cpp, slot i of the leaf-ordered arrays.
+__device__ bool intersect(const DeviceMesh& m, uint32_t i, const float ro[3], const float rd[3], float& t)
+{
+    const float e1x = m.e1x[i], e1y = m.e1y[i], e1z = m.e1z[i];
+    const float e2x = m.e2x[i], e2y = m.e2y[i], e2z = m.e2z[i];
+    float hx = rd[1] * e2z - rd[2] * e2y, hy = rd[2] * e2x - rd[0] * e2z, hz = rd[0] * e2y - rd[1] * e2x;
+    float a = e1x * hx + e1y * hy + e1z * hz;
+    if (a > -kEps && a < kEps)
+        return false;
+    float f = 1.f / a;
+    float sx = ro[0] - m.v0x[i], sy = ro[1] - m.v0y[i], sz = ro[2] - m.v0z[i];
+    float u = f * (sx * hx + sy * hy + sz * hz);
+    if (u < 0.f || u > 1.f)
+        return false;
+    float qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+    float v = f * (rd[0] * qx + rd[1] * qy + rd[2] * qz);
+    if (v < 0.f || u + v > 1.f)
+        return false;
+    float tt = f * (e2x * qx + e2y * qy + e2z * qz);
+    if (tt <= kEps)
+        return false;
+    t = tt;
+    return true;
+}
+
+__global__ void distinctHitKernel(DeviceMesh m, const uint32_t* rays, size_t nRays, float originOffset, float tMin,
+    float tEps, uint32_t* counts)
+{
+    const size_t r = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+    if (r >= nRays)
+        return;
+    const uint32_t self = rays[r];
+    const float* c = m.centroids + 3 * static_cast<size_t>(self);
+    const float* d = m.normals + 3 * static_cast<size_t>(self);
+    const float o[3] = { c[0] + originOffset * d[0], c[1] + originOffset * d[1], c[2] + originOffset * d[2] };
+    const float dir[3] = { d[0], d[1], d[2] };
+    const float inv[3] = { dir[0] != 0.f ? 1.f / dir[0] : 0.f, dir[1] != 0.f ? 1.f / dir[1] : 0.f,
+        dir[2] != 0.f ? 1.f / dir[2] : 0.f };
+
+    float hits[kMaxHits];  // kept sorted
+    int nHits = 0;
+    uint32_t stack[kStackSize];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0)
+    {
+        const uint32_t ni = stack[--sp];
+        const DeviceNode n = m.nodes[ni];
+        if (!hitsBox(n, o, dir, inv))
+            continue;
+        if (n.count == 0)
+        {
+            stack[sp++] = n.offset;
+            stack[sp++] = ni + 1;
+            continue;
+        }
+        for (uint32_t k = n.offset; k < n.offset + n.count; ++k)
+        {
+            float t;
+            if (!intersect(m, k, o, dir, t) || m.ids[k] == self || !(t > tMin))
+                continue;
+            if (nHits == kMaxHits)
+            {
+                counts[r] = kGpuHitOverflow;
+                return;
+            }
+            int h = nHits++;
+            for (; h > 0 && hits[h - 1] > t; --h)
+                hits[h] = hits[h - 1];
+            hits[h] = t;
+        }
+    }
+    uint32_t distinct = 0;
+    float lastT = -1e30f;
+    for (int h = 0; h < nHits; ++h)
+    {
+        if (hits[h] - lastT > tEps)
+        {
+            ++distinct;
+            lastT = hits[h];
+        }
+    }
+    counts[r] = distinct;
+}
+
+// Device buffers of one call, freed on every exit path.
+class DeviceBuffers {
+public:
+    ~DeviceBuffers()
+    {
+        for (void* p : ptrs_)
+            cudaFree(p);
+    }
+    template <class T>
+    const T* upload(const T* data, size_t n)
+    {
+        void* p = nullptr;
+        if (!ok_ || cudaMalloc(&p, n * sizeof(T) + 1) != cudaSuccess)
+            return fail();
+        ptrs_.push_back(p);
+        if (n > 0 && cudaMemcpy(p, data, n * sizeof(T), cudaMemcpyHostToDevice) != cudaSuccess)
+            return fail();
+        return static_cast<const T*>(p);
+    }
+    uint32_t* allocate(size_t n)
+    {
+        void* p = nullptr;
+        if (!ok_ || cudaMalloc(&p, n * sizeof(uint32_t) + 1) != cudaSuccess)
+            return fail();
+        ptrs_.push_back(p);
+        return static_cast<uint32_t*>(p);
+    }
+    bool ok() const { return ok_; }
+
+private:
+    std::nullptr_t fail()
+    {
+        ok_ = false;
+        return nullptr;
+    }
+
+    std::vector<void*> ptrs_;
+    bool ok_ = true;
+};
+} // namespace
+
+bool gpuRayCastAvailable(std::string* device)
+{
+    int count = 0;
+    if (cudaGetDeviceCount(&count) != cudaSuccess || count == 0)
+        return false;
+    if (device)
+    {
+        cudaDeviceProp prop;
+        *device = cudaGetDeviceProperties(&prop, 0) == cudaSuccess ? prop.name : "CUDA device";
+    }
+    return true;
+}
+
+bool gpuDistinctHitCounts(const Bvh& bvh, const StlReader::TriangleGeometry& geo, const std::vector<uint32_t>& rays,
+    float originOffset, float tMin, float tEps, std::vector<uint32_t>& counts)
+{
+    counts.assign(rays.size(), 0);
+    if (rays.empty())
+        return true;
+    if (bvh.empty() || !gpuRayCastAvailable())
+        return false;
+    const TriangleSoA& s = bvh.soa();
+    const size_t slots = s.v0x.size();  // includes the padding slots
+    DeviceBuffers buf;
+    DeviceMesh m;
+    m.nodes = buf.upload(reinterpret_cast<const DeviceNode*>(bvh.nodes().data()), bvh.nodes().size());
+    m.v0x = buf.upload(s.v0x.data(), slots);
+    m.v0y = buf.upload(s.v0y.data(), slots);
+    m.v0z = buf.upload(s.v0z.data(), slots);
+    m.e1x = buf.upload(s.e1x.data(), slots);
+    m.e1y = buf.upload(s.e1y.data(), slots);
+    m.e1z = buf.upload(s.e1z.data(), slots);
+    m.e2x = buf.upload(s.e2x.data(), slots);
+    m.e2y = buf.upload(s.e2y.data(), slots);
+    m.e2z = buf.upload(s.e2z.data(), slots);
+    m.ids = buf.upload(s.ids.data(), s.ids.size());
+    static_assert(sizeof(StlReader::Vec3) == 3 * sizeof(float), "Vec3 must be three packed floats");
+    m.centroids = buf.upload(reinterpret_cast<const float*>(geo.centroids.data()), 3 * geo.centroids.size());
+    m.normals = buf.upload(reinterpret_cast<const float*>(geo.normals.data()), 3 * geo.normals.size());
+    const uint32_t* deviceRays = buf.upload(rays.data(), rays.size());
+    uint32_t* deviceCounts = buf.allocate(rays.size());
+    if (!buf.ok())
+        return false;
+    const unsigned kBlock = 128;
+    const size_t blocks = (rays.size() + kBlock - 1) / kBlock;
+    distinctHitKernel<<<static_cast<unsigned>(blocks), kBlock>>>(m, deviceRays, rays.size(), originOffset, tMin, tEps,
+        deviceCounts);
+    if (cudaGetLastError() != cudaSuccess || cudaDeviceSynchronize() != cudaSuccess)
+        return false;
+    return cudaMemcpy(counts.data(), deviceCounts, rays.size() * sizeof(uint32_t), cudaMemcpyDeviceToHost) ==
+        cudaSuccess;
+}
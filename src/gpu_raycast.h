@@ -0,0 +1,33 @@
+#ifndef GPU_RAYCAST_H
+#define GPU_RAYCAST_H
+
+#include "stl_reader.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Bvh;
+
+/** Optional GPU backend for the per-triangle rays of the even-hit pass (FluidOptions::backend, --backend gpu).
+ *  The CUDA implementation (gpu_raycast.cu) is linked only by the opt-in `./build.sh gpu` target; every other
+ *  build links gpu_raycast_stub.cpp, which reports no device, so callers fall back to the CPU path. */
+
+/** Count returned for a ray whose hits did not fit the device's per-ray hit list; the caller casts that ray on
+ *  the CPU. */
+const uint32_t kGpuHitOverflow = 0xFFFFFFFFu;
+
+/** Whether this build has a GPU backend and a usable device; device (if given) receives its name. */
+bool gpuRayCastAvailable(std::string* device = nullptr);
+
+/** For each rays[r] = i, the number of distinct hits of the ray from geo.centroids[i] + originOffset *
+ *  geo.normals[i] along geo.normals[i], counted exactly as the CPU pass does: hits on triangles other than i
+ *  with t > tMin, sorted, a hit counting when it is more than tEps beyond the last counted one. The BVH and
+ *  geometry are uploaded once per call and every ray runs in one launch; the kernel repeats the CPU's scalar
+ *  Möller–Trumbore operations without fused multiply-add, so the counts equal the CPU ones. counts[r] is
+ *  kGpuHitOverflow where the ray had too many hits. False (counts unspecified) if there is no device or a
+ *  device call fails. */
+bool gpuDistinctHitCounts(const Bvh& bvh, const StlReader::TriangleGeometry& geo, const std::vector<uint32_t>& rays,
+    float originOffset, float tMin, float tEps, std::vector<uint32_t>& counts);
+
+#endif
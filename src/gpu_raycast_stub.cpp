@@ -0,0 +1,14 @@
+#include "gpu_raycast.h"
+
+// CPU-only builds: no device, so the even-hit pass always casts on the CPU.
+
+bool gpuRayCastAvailable(std::string*)
+{
+    return false;
+}
+
+bool gpuDistinctHitCounts(const Bvh&, const StlReader::TriangleGeometry&, const std::vector<uint32_t>&, float, float,
+    float, std::vector<uint32_t>&)
+{
+    return false;
+}
@@ -1,99 +1,616 @@
+#include "batch.h"
+#include "compressed_io.h"
+#include "fast_validate.h"
+#include "gpu_raycast.h"
+#include "mesh_components.h"
+#include "parallel.h"
+#include "profile.h"
 #include "stl_reader.h"
+#include "stl_stream.h"
+#include <chrono>
 #include <cerrno>
-#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
-#include <sys/stat.h>
 
-static void printGeometryQualityReport(const std::string& path, const std::string& label, std::ostream& out) {
-    StlReader r;
-    if (!r.read(path)) {
-        out << label << ": failed to read " << path << "\n";
+// Largest --threads / --jobs accepted; resolveThreadCount() caps the workers actually started further.
+static const unsigned long long kMaxThreadOption = 65536;
+
+// Decimal count for an option value: digits only (no sign, so "-1" does not wrap to a huge value) and at most max.
+static bool parseCount(const char* text, unsigned long long max, unsigned long long& value) {
+    if (!text || *text < '0' || *text > '9')
+        return false;
+    errno = 0;
+    char* end = nullptr;
+    value = std::strtoull(text, &end, 10);
+    return errno == 0 && *end == '\0' && value <= max;
+}
+
+// Per-body lines for meshes with more than one connected component (the first kListed, in component order).
+static void printComponentReport(const StlReader& mesh, std::ostream& out) {
+    const MeshComponents& comps = mesh.components();
+    if (comps.count() <= 1)
         return;
+    const size_t kListed = 20;
+    out << "Components: " << comps.count() << "\n";
+    for (size_t c = 0; c < comps.count() && c < kListed; ++c) {
+        const MeshComponents::Component& k = comps.components()[c];
+        out << "  Component " << c << ": " << k.triangles << " triangles, volume " << std::fixed << std::setprecision(10)
+            << k.volume << std::defaultfloat << ", box (" << k.lo.x << ", " << k.lo.y << ", " << k.lo.z << ") - ("
+            << k.hi.x << ", " << k.hi.y << ", " << k.hi.z << ")\n";
     }
-    r.removeDuplicateVertices();
+    if (comps.count() > kListed)
+        out << "  ... " << (comps.count() - kListed) << " more\n";
+}
+
+// Returns whether the mesh is watertight. writtenNormals: the mesh is written by writeAsciiStl() / writeBinaryStl(),
+// which recompute every facet normal from the winding, so the written file cannot disagree with itself: every
+// triangle with a direction counts as OK and none as opposite.
+static bool printGeometryQualityReport(const StlReader& mesh, const std::string& path, const std::string& label,
+    std::ostream& out, bool writtenNormals = false) {
     out << "--- " << label << " (" << path << ") ---\n";
-    r.checkWatertight(out);
-    r.checkRightHandWinding(out);
-    double vol = 0.;
-    if (StlReader::volumeFromFile(path, vol))
-        out << "Volume: " << std::fixed << std::setprecision(10) << vol << "\n";
+    const bool watertight = mesh.checkWatertight(out);
+    if (writtenNormals) {
+        size_t directed = 0;
+        for (const StlReader::Vec3& n : mesh.geometry().normals)
+            directed += n.x * n.x + n.y * n.y + n.z * n.z > 0.f;
+        out << "Right-hand rule: " << directed << " OK, 0 opposite winding\n";
+    } else {
+        mesh.checkRightHandWinding(out);
+    }
+    out << "Volume: " << std::fixed << std::setprecision(10) << mesh.volume() << "\n";
+    printComponentReport(mesh, out);
     out << "\n";
+    return watertight;
 }
 
-static int runValidateMode(const std::string& path) {
+// Re-read a written output and check that it indexes to the same mesh as the in-memory one.
+static bool verifyWrittenFile(const StlReader& mesh, const std::string& path, const std::string& label,
+    std::ostream& out) {
+    StlReader r;
+    if (!r.readIndexed(path)) {
+        out << label << ": failed to re-read " << path << "\n";
+        return false;
+    }
+    const bool same = r.triangleCount() == mesh.triangleCount() && r.vertices().size() == mesh.vertices().size() &&
+        r.volume() == mesh.volume();
+    out << label << " (" << path << "): " << r.triangleCount() << " triangles, " << r.vertices().size()
+        << " vertices, volume " << std::fixed << std::setprecision(10) << r.volume()
+        << (same ? " - matches in-memory mesh\n" : " - DIFFERS from in-memory mesh\n");
+    return same;
+}
+
+// --weld-eps: snap vertices closer than weldEps after the bit-exact weld and say how many merged.
+static void weldWithinTolerance(StlReader& r, float weldEps, unsigned threads, std::ostream& out) {
+    if (!(weldEps > 0.f))
+        return;
+    const size_t merged = r.weldVertices(weldEps, threads);
+    out << "Epsilon weld: merged " << merged << " vertices within " << weldEps << " (" << r.vertices().size()
+        << " remain)\n";
+}
+
+enum class OutputFormat { Ascii, Binary };
+
+// Settings shared by every input of a run.
+struct RunConfig {
+    StlReader::FluidOptions fluid;
+    float weldEps = 0.f;
+    bool spatialOrder = false;
+    OutputFormat format = OutputFormat::Ascii;
+    Compression compression = Compression::None;  // of the written STLs
+    bool verifyOutput = false;
+    bool fastValidate = false;  // --validate --fast: pass/fail gate instead of the full report
+    FastValidateOptions fastOpts;
+};
+
+// What the batch summary lists for one input.
+struct RunSummary {
+    size_t triangles = 0;
+    double solidVolume = 0.;
+    double fluidVolume = 0.;
+    bool watertight = false;  // the fluid mesh, or the input itself in validate mode
+};
+
+static int runValidateMode(const std::string& path, const RunConfig& config, std::ostream& out, std::ostream& err,
+    RunSummary& summary) {
     StlReader r;
-    if (!r.read(path)) {
-        std::cerr << "validate: read failed: " << path << "\n";
+    StlReader::ReadOptions readOpts;
+    readOpts.threads = config.fluid.threads;
+    readOpts.spatialOrder = config.spatialOrder;
+    {
+        ProfileScope scope("read");
+        if (!r.readIndexed(path, readOpts)) {
+            err << "validate: read failed: " << path << " (for meshes over 100M triangles use --stream)\n";
+            return 1;
+        }
+        scope.count("triangles", r.triangleCount());
+        scope.count("unique_vertices", r.vertices().size());
+    }
+    weldWithinTolerance(r, config.weldEps, config.fluid.threads, out);
+    if (config.fastValidate) {
+        FastValidateOptions fastOpts = config.fastOpts;
+        fastOpts.threads = config.fluid.threads;
+        FastValidateReport report;
+        fastValidate(r, report, fastOpts);
+        out << "Geometry quality report\n";
+        out << "--- " << path << " ---\n";
+        printFastValidateReport(report, out);
+        summary.watertight = report.counts.watertight() && !report.stoppedEarly;
+        summary.triangles = r.triangleCount();
+        summary.solidVolume = report.counts.volume;
+        return report.passed() ? 0 : 2;
+    }
+    ProfileScope scope("quality_report");
+    out << "Geometry quality report\n";
+    out << "--- " << path << " ---\n";
+    summary.watertight = r.checkWatertight(out);
+    r.checkRightHandWinding(out);
+    out << "Volume: " << std::fixed << std::setprecision(10) << r.volume() << "\n";
+    printComponentReport(r, out);
+    summary.triangles = r.triangleCount();
+    summary.solidVolume = r.volume();
+    return 0;
+}
+
+static int runStreamValidateMode(const std::string& path, const StreamOptions& streamOpts) {
+    StreamReport report;
+    ProfileScope scope("stream_validate");
+    if (!streamValidate(path, report, streamOpts)) {
+        std::cerr << "validate: streaming read failed: " << path << "\n";
         return 1;
     }
-    r.removeDuplicateVertices();
     std::cout << "Geometry quality report\n";
     std::cout << "--- " << path << " ---\n";
-    r.checkWatertight(std::cout);
-    r.checkRightHandWinding(std::cout);
-    std::cout << "Volume: " << std::fixed << std::setprecision(10) << r.volume() << "\n";
+    printStreamReport(report, std::cout);
+    scope.count("triangles", report.triangles);
+    scope.count("unique_vertices", report.uniqueVertices);
     return 0;
 }
 
-static int runPipeline(const std::string& inputPath, const std::string& outDir) {
-    if (mkdir(outDir.c_str(), 0755) != 0 && errno != EEXIST) {
-        std::cerr << "Cannot create output directory '" << outDir << "': " << std::strerror(errno) << "\n";
+static int runPipeline(const std::string& inputPath, const std::string& outDir, const RunConfig& config,
+    std::ostream& out, std::ostream& err, RunSummary& summary) {
+    const StlReader::FluidOptions& opts = config.fluid;
+    const bool binary = config.format == OutputFormat::Binary;
+    std::error_code ec;
+    std::filesystem::create_directories(outDir, ec);
+    if (ec) {
+        err << "Cannot create output directory '" << outDir << "': " << ec.message() << "\n";
         return 1;
     }
     StlReader r;
-    if (!r.read(inputPath)) {
-        std::cerr << "read failed: " << inputPath << "\n";
-        return 1;
+    {
+        ProfileScope scope("read");
+        StlReader::ReadOptions readOpts;
+        readOpts.threads = opts.threads;
+        readOpts.spatialOrder = config.spatialOrder;
+        if (!r.readIndexed(inputPath, readOpts)) {
+            err << "read failed: " << inputPath << "\n";
+            return 1;
+        }
+        scope.count("triangles", r.triangleCount());
+        scope.count("unique_vertices", r.vertices().size());
+    }
+    weldWithinTolerance(r, config.weldEps, opts.threads, out);
+    // With a cache the even-hit pass builds its own BVH, and only when the selection is not stored yet.
+    if (!opts.bruteForce && opts.cacheDir.empty()) {
+        ProfileScope scope("build_bvh");
+        r.buildBvh();
     }
-    r.removeDuplicateVertices();
     std::ostringstream discard;
     r.checkRightHandWinding(discard);
-    if (!r.writeAsciiStl(outDir + "solid_volume.stl")) {
-        std::cerr << "write ASCII STL failed\n";
-        return 1;
-    }
-    const double fullVolume = r.volume();
+    const std::string suffix = config.compression == Compression::Gzip ? ".gz"
+                             : config.compression == Compression::Zstd ? ".zst" : "";
+    const std::string solidPath = outDir + "solid_volume.stl" + suffix;
+    const std::string fluidPath = outDir + "fluid_volume.stl" + suffix;
 
+    // Task graph: the solid write and the solid report need only the input mesh, so they run beside the fluid
+    // extraction; the fluid write then runs beside the fluid indexing and report. Text is buffered and printed
+    // in the serial order once everything has joined.
+    bool solidOk = false, fluidOk = false, fluidWatertight = false;
+    std::ostringstream solidReport, fluidReport;
     std::vector<StlReader::Triangle> fluid;
-    r.computeFluidMesh(fluid, discard);
+    StlReader fluidMesh;
+    TaskGroup tasks;  // after everything the tasks touch: an exception joins them before those are destroyed
+    tasks.run([&] {
+        ProfileScope scope("write_solid");
+        solidOk = binary ? r.writeBinaryStl(solidPath) : r.writeAsciiStl(solidPath, opts.threads);
+        scope.count("triangles", r.triangleCount());
+    });
+    tasks.run([&] {
+        ProfileScope scope("quality_report_solid");
+        printGeometryQualityReport(r, solidPath, "Solid", solidReport, true);
+    });
+    const double fullVolume = r.volume();
+    r.computeFluidMesh(fluid, discard, opts);
+
+    tasks.run([&] {
+        ProfileScope scope("write_fluid");
+        fluidOk = binary ? StlReader::writeBinaryStlFromTriangles(fluidPath, fluid)
+                         : StlReader::writeAsciiStlFromTriangles(fluidPath, fluid, opts.threads);
+        scope.count("triangles", fluid.size());
+    });
 
-    const std::string fluidPath = outDir + "fluid_volume.stl";
-    if (!StlReader::writeAsciiStlFromTriangles(fluidPath, fluid)) {
-        std::cerr << "write fluid STL failed\n";
+    // Report on the meshes in memory; the written files are only re-read with --verify-output.
+    {
+        ProfileScope scope("index_fluid");
+        fluidMesh.setTriangles(fluid);
+        scope.count("triangles", fluidMesh.triangleCount());
+        scope.count("unique_vertices", fluidMesh.vertices().size());
+    }
+    {
+        ProfileScope scope("quality_report_fluid");
+        fluidWatertight = printGeometryQualityReport(fluidMesh, fluidPath, "Fluid", fluidReport);
+    }
+    tasks.wait();
+    if (!solidOk) {
+        err << (binary ? "write binary STL failed\n" : "write ASCII STL failed\n");
         return 1;
     }
+    if (!fluidOk) {
+        err << "write fluid STL failed\n";
+        return 1;
+    }
+    out << "Solid geometry volume: " << std::fixed << std::setprecision(10) << fullVolume << "\n";
+    out << "Fluid geometry volume: " << std::fixed << std::setprecision(10) << fluidMesh.volume() << "\n";
+    out << "Output: " << solidPath << ", " << fluidPath << "\n";
+    summary.triangles = r.triangleCount();
+    summary.solidVolume = fullVolume;
+    summary.fluidVolume = fluidMesh.volume();
+    summary.watertight = fluidWatertight;
 
-    std::cout << "Solid geometry volume: " << std::fixed << std::setprecision(10) << fullVolume << "\n";
-    double fluidVolume = 0.;
-    if (StlReader::volumeFromFile(fluidPath, fluidVolume))
-        std::cout << "Fluid geometry volume: " << std::fixed << std::setprecision(10) << fluidVolume << "\n";
-    else
-        std::cerr << "Failed to compute volume of fluid STL\n";
-    std::cout << "Output: " << outDir << "solid_volume.stl, " << outDir << "fluid_volume.stl\n";
-
-    std::cout << "\nGeometry quality report\n";
-    printGeometryQualityReport(outDir + "solid_volume.stl", "Solid", std::cout);
-    printGeometryQualityReport(fluidPath, "Fluid", std::cout);
+    out << "\nGeometry quality report\n" << solidReport.str() << fluidReport.str();
+    if (config.verifyOutput) {
+        ProfileScope scope("verify_output");
+        out << "Output verification\n";
+        const bool solidSame = verifyWrittenFile(r, solidPath, "Solid", out);
+        const bool fluidSame = verifyWrittenFile(fluidMesh, fluidPath, "Fluid", out);
+        if (!solidSame || !fluidSame)
+            return 1;
+    }
     return 0;
 }
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << (argv[0] ? argv[0] : "stl_tool") << " <input.stl>\n";
-        std::cerr << "       " << (argv[0] ? argv[0] : "stl_tool") << " --validate <path.stl>\n";
+// --batch: every input of a directory or manifest, reports buffered per file and printed in input order, then
+// one summary. Per-file stages are not profiled (they overlap); the batch scope carries the totals.
+static int runBatchMode(const std::string& source, const std::string& outputTemplate, bool validate,
+    const RunConfig& config, const BatchOptions& batchOpts) {
+    std::vector<std::string> inputs;
+    std::string error;
+    if (!listBatchInputs(source, inputs, error)) {
+        std::cerr << "batch: " << error << "\n";
+        return 1;
+    }
+    if (!validate && inputs.size() > 1 && outputTemplate.find("{name}") == std::string::npos) {
+        std::cerr << "batch: the output directory must contain {name} so inputs do not overwrite each other\n";
+        return 1;
+    }
+    if (!validate && findOutputCollision(outputTemplate, inputs, error)) {
+        std::cerr << "batch: " << error << "; rename one of the inputs\n";
         return 1;
     }
-    const std::string arg1 = argv[1];
-    if (arg1 == "--validate") {
-        if (argc < 3) {
-            std::cerr << "Usage: " << (argv[0] ? argv[0] : "stl_tool") << " --validate <path.stl>\n";
+    ProfileScope scope("batch");
+    std::vector<uint64_t> weights(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i)
+        weights[i] = estimateTriangleCount(inputs[i]);
+    std::vector<std::string> reports(inputs.size()), errors(inputs.size());
+    std::vector<RunSummary> summaries(inputs.size());
+    std::vector<int> status(inputs.size(), 1);
+    std::vector<double> wallMs(inputs.size(), 0.);
+    runBatch(weights, batchOpts, [&](size_t i, unsigned threads) {
+        ProfileMute mute;
+        RunConfig fileConfig = config;
+        fileConfig.fluid.threads = threads;
+        std::ostringstream out, err;
+        const auto start = std::chrono::steady_clock::now();
+        try {
+            status[i] = validate ? runValidateMode(inputs[i], fileConfig, out, err, summaries[i])
+                                 : runPipeline(inputs[i], expandOutputTemplate(outputTemplate, inputs[i]), fileConfig,
+                                       out, err, summaries[i]);
+        } catch (const std::exception& e) {
+            err << "failed: " << e.what() << "\n";
+            status[i] = 1;
+        }
+        wallMs[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        reports[i] = out.str();
+        errors[i] = err.str();
+    });
+
+    size_t failed = 0, triangles = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::cout << "=== " << inputs[i] << " ===\n" << reports[i];
+        if (!errors[i].empty())
+            std::cout << errors[i];
+        std::cout << "\n";
+        failed += status[i] != 0;
+        triangles += summaries[i].triangles;
+    }
+    std::cout << "Batch summary: " << inputs.size() << " files, " << (inputs.size() - failed) << " ok, " << failed
+              << " failed, " << triangles << " triangles\n";
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const RunSummary& s = summaries[i];
+        std::cout << "  " << inputs[i] << ": ";
+        if (status[i] != 0) {
+            std::cout << "FAILED";
+        } else {
+            std::cout << s.triangles << " triangles, " << (validate ? "volume " : "solid ") << std::fixed
+                      << std::setprecision(10) << s.solidVolume;
+            if (!validate)
+                std::cout << ", fluid " << s.fluidVolume;
+            std::cout << ", " << (validate ? "" : "fluid ") << "watertight " << (s.watertight ? "yes" : "no");
+        }
+        std::cout << ", " << std::fixed << std::setprecision(1) << wallMs[i] << " ms\n";
+    }
+    scope.count("files", inputs.size());
+    scope.count("failed", failed);
+    scope.count("triangles", triangles);
+    return failed ? 1 : 0;
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--brute-force] [--robust] [--classifier per-triangle|ray-reuse|winding-number]\n"
+              << "       [--backend cpu|gpu] [--threads N] [--weld-eps E] [--reorder] [--format ascii|binary]\n"
+              << "       [--compress gzip|zstd] [--verify-output] [--cache-dir DIR] [--profile FILE.json] <input.stl>\n";
+    std::cerr << "       " << prog << " [--threads N] [--weld-eps E] [--reorder] --validate <path.stl>\n";
+    std::cerr << "       " << prog << " [--threads N] --validate --fast [--fail-fast] [--max-listed N] <path.stl>\n";
+    std::cerr << "       " << prog << " --validate --stream [--memory-mb N] [--spill-dir DIR] <path.stl>\n";
+    std::cerr << "       " << prog << " [options] [--validate] --batch DIR|LIST [--output-dir T] [--jobs N]\n"
+              << "       [--max-resident-triangles N]\n";
+    std::cerr << "  --brute-force  test every ray against every triangle instead of using the BVH\n";
+    std::cerr << "  --robust       decide ray crossings exactly (float filter, then double, then exact), so rays through shared\n"
+              << "                 edges and vertices count them once; disables the gpu backend\n";
+    std::cerr << "  --classifier C fluid triangle selection: one ray per triangle (default), shared axis lines (ray-reuse)\n"
+              << "                 or fast winding number plus one any-hit ray (winding-number, tolerates small gaps)\n";
+    std::cerr << "  --backend B    per-triangle rays on the cpu (default) or gpu (needs the ./build.sh gpu binary and a CUDA\n"
+              << "                 device; falls back to the CPU otherwise)\n";
+    std::cerr << "  --threads N    worker threads for parsing and ray casting (default 0 = all hardware threads)\n";
+    std::cerr << "  --weld-eps E   also merge vertices closer than E (after exact welding), e.g. to close CAD export jitter\n";
+    std::cerr << "  --reorder      renumber vertices and triangles in Morton order of position after welding (faster on\n"
+              << "                 large unordered exports; reports keep input triangle ids)\n";
+    std::cerr << "  --format F     output STL format: ascii (default) or binary\n";
+    std::cerr << "  --compress C   write solid_volume.stl.gz / .zst etc., compressed on a background thread (gzip or zstd;\n"
+              << "                 compressed inputs are read whatever this option)\n";
+    std::cerr << "  --verify-output  re-read the written STLs and check they match the in-memory meshes\n";
+    std::cerr << "  --cache-dir D  reuse the even-hit selection stored in D for the same mesh and settings (stored on a miss)\n";
+    std::cerr << "  --profile F    write per-stage wall/CPU time, peak RSS and counters to F as JSON\n";
+    std::cerr << "  --stream       validate out of core with bounded memory, spilling to DIR (default .); no size limit\n";
+    std::cerr << "  --memory-mb N  memory budget for --stream, file buffers included (default 512)\n";
+    std::cerr << "  --fast         parallel pass/fail validation (edges, degenerate and duplicate triangles, winding, volume);\n"
+              << "                 exits with status 2 on FAIL\n";
+    std::cerr << "  --fail-fast    with --fast, skip the remaining checks after the first failing one\n";
+    std::cerr << "  --max-listed N with --fast, list at most N opposite-winding triangles (default 20)\n";
+    std::cerr << "  --batch S      process every *.stl in directory S, or every path listed in file S (one per line)\n";
+    std::cerr << "  --output-dir T output directory; {name} is replaced by the input name (default ../output/, and\n"
+              << "                 ../output/{name}/ with --batch)\n";
+    std::cerr << "  --jobs N       files processed at once with --batch, sharing the --threads budget (default 0 = one\n"
+              << "                 per thread)\n";
+    std::cerr << "  --max-resident-triangles N  with --batch, start no file that would take the triangles loaded at once\n"
+              << "                 past N (largest files go first; default 0 = no cap)\n";
+}
+
+int main(int argc, char* argv[]) {
+    const char* prog = argv[0] ? argv[0] : "stl_tool";
+    StlReader::FluidOptions opts;
+    std::string inputPath;
+    bool validate = false;
+    OutputFormat format = OutputFormat::Ascii;
+    Compression compression = Compression::None;
+    bool verifyOutput = false;
+    bool stream = false;
+    StreamOptions streamOpts;
+    bool fast = false, fastListSet = false;
+    FastValidateOptions fastOpts;
+    std::string profilePath;
+    float weldEps = 0.f;
+    bool spatialOrder = false;
+    std::string batchSource;
+    std::string outputDir;
+    BatchOptions batchOpts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--validate") {
+            validate = true;
+        } else if (arg == "--verify-output") {
+            verifyOutput = true;
+        } else if (arg == "--reorder") {
+            spatialOrder = true;
+        } else if (arg == "--brute-force") {
+            opts.bruteForce = true;
+        } else if (arg == "--robust") {
+            opts.robust = true;
+        } else if (arg == "--classifier") {
+            const std::string c = i + 1 < argc ? argv[++i] : "";
+            if (c == "per-triangle") {
+                opts.classifier = StlReader::Classifier::PerTriangle;
+            } else if (c == "ray-reuse") {
+                opts.classifier = StlReader::Classifier::RayReuse;
+            } else if (c == "winding-number") {
+                opts.classifier = StlReader::Classifier::WindingNumber;
+            } else {
+                std::cerr << "Invalid classifier '" << c << "' (expected per-triangle, ray-reuse or winding-number)\n";
+                return 1;
+            }
+        } else if (arg == "--backend") {
+            const std::string b = i + 1 < argc ? argv[++i] : "";
+            if (b == "cpu") {
+                opts.backend = StlReader::RayBackend::Cpu;
+            } else if (b == "gpu") {
+                opts.backend = StlReader::RayBackend::Gpu;
+            } else {
+                std::cerr << "Invalid backend '" << b << "' (expected cpu or gpu)\n";
+                return 1;
+            }
+        } else if (arg == "--threads") {
+            if (i + 1 >= argc) {
+                printUsage(prog);
+                return 1;
+            }
+            unsigned long long n = 0;
+            if (!parseCount(argv[++i], kMaxThreadOption, n)) {
+                std::cerr << "Invalid thread count: " << argv[i] << " (expected 0 to " << kMaxThreadOption << ")\n";
+                return 1;
+            }
+            opts.threads = static_cast<unsigned>(n);
+        } else if (arg == "--weld-eps") {
+            char* end = nullptr;
+            const float e = i + 1 < argc ? std::strtof(argv[++i], &end) : 0.f;
+            if (!end || *end != '\0' || !(e > 0.f) || !std::isfinite(e)) {
+                std::cerr << "Invalid weld tolerance: " << (end ? argv[i] : "") << "\n";
+                return 1;
+            }
+            weldEps = e;
+        } else if (arg == "--profile") {
+            if (i + 1 >= argc) {
+                printUsage(prog);
+                return 1;
+            }
+            profilePath = argv[++i];
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--fast") {
+            fast = true;
+        } else if (arg == "--fail-fast") {
+            fastOpts.stopOnFailure = true;
+        } else if (arg == "--max-listed") {
+            const char* value = i + 1 < argc ? argv[++i] : "";
+            unsigned long long n = 0;
+            if (!parseCount(value, SIZE_MAX, n)) {
+                std::cerr << "Invalid listing cap: " << value << "\n";
+                return 1;
+            }
+            fastOpts.maxListed = static_cast<size_t>(n);
+            fastListSet = true;
+        } else if (arg == "--memory-mb") {
+            const char* value = i + 1 < argc ? argv[++i] : "";
+            unsigned long long mb = 0;
+            if (!parseCount(value, SIZE_MAX >> 20, mb) || mb == 0) {
+                std::cerr << "Invalid memory budget: " << value << " (expected 1 to " << (SIZE_MAX >> 20) << ")\n";
+                return 1;
+            }
+            streamOpts.memoryBytes = static_cast<size_t>(mb) << 20;
+        } else if (arg == "--spill-dir") {
+            if (i + 1 >= argc) {
+                printUsage(prog);
+                return 1;
+            }
+            streamOpts.spillDir = argv[++i];
+        } else if (arg == "--batch" || arg == "--output-dir" || arg == "--cache-dir") {
+            if (i + 1 >= argc) {
+                printUsage(prog);
+                return 1;
+            }
+            (arg == "--batch" ? batchSource : arg == "--output-dir" ? outputDir : opts.cacheDir) = argv[++i];
+        } else if (arg == "--jobs" || arg == "--max-resident-triangles") {
+            const bool jobs = arg == "--jobs";
+            const char* value = i + 1 < argc ? argv[++i] : "";
+            unsigned long long n = 0;
+            if (!parseCount(value, jobs ? kMaxThreadOption : ~0ull, n)) {
+                std::cerr << "Invalid " << (jobs ? "job count" : "triangle cap") << ": " << value << "\n";
+                return 1;
+            }
+            if (jobs)
+                batchOpts.jobs = static_cast<unsigned>(n);
+            else
+                batchOpts.maxResidentWeight = n;
+        } else if (arg == "--format") {
+            const std::string f = i + 1 < argc ? argv[++i] : "";
+            if (f == "ascii") {
+                format = OutputFormat::Ascii;
+            } else if (f == "binary") {
+                format = OutputFormat::Binary;
+            } else {
+                std::cerr << "Invalid format '" << f << "' (expected ascii or binary)\n";
+                return 1;
+            }
+        } else if (arg == "--compress") {
+            const std::string c = i + 1 < argc ? argv[++i] : "";
+            if (c == "gzip") {
+                compression = Compression::Gzip;
+            } else if (c == "zstd") {
+                compression = Compression::Zstd;
+            } else {
+                std::cerr << "Invalid compression '" << c << "' (expected gzip or zstd)\n";
+                return 1;
+            }
+            if (!compressionSupported(compression)) {
+                std::cerr << "This build has no " << c << " support (./build.sh found no " << (c == "gzip" ? "zlib" : "libzstd")
+                          << ")\n";
+                return 1;
+            }
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << "\n";
+            printUsage(prog);
+            return 1;
+        } else if (inputPath.empty()) {
+            inputPath = arg;
+        } else {
+            printUsage(prog);
             return 1;
         }
-        return runValidateMode(argv[2]);
     }
-    return runPipeline(arg1, "../output/");
+    if (inputPath.empty() == batchSource.empty()) {
+        printUsage(prog);
+        return 1;
+    }
+    if (stream && !validate) {
+        std::cerr << "--stream is only supported with --validate\n";
+        return 1;
+    }
+    if (fast && (!validate || stream)) {
+        std::cerr << "--fast needs --validate and is not supported with --stream\n";
+        return 1;
+    }
+    if (!fast && (fastOpts.stopOnFailure || fastListSet)) {
+        std::cerr << (fastListSet ? "--max-listed" : "--fail-fast") << " is only supported with --validate --fast\n";
+        return 1;
+    }
+    if (stream && (weldEps > 0.f || spatialOrder)) {
+        std::cerr << (spatialOrder ? "--reorder" : "--weld-eps") << " is not supported with --stream\n";
+        return 1;
+    }
+    if (stream && !batchSource.empty()) {
+        std::cerr << "--stream is not supported with --batch\n";
+        return 1;
+    }
+    if (stream && compressionForPath(inputPath) != Compression::None) {
+        std::cerr << "--stream needs an uncompressed STL\n";
+        return 1;
+    }
+    if (opts.backend == StlReader::RayBackend::Gpu && !gpuRayCastAvailable())
+        std::cerr << "No GPU backend in this build or no device found; casting rays on the CPU\n";
+    if (!profilePath.empty())
+        enableProfiling();
+    RunConfig config;
+    config.fluid = opts;
+    config.weldEps = weldEps;
+    config.spatialOrder = spatialOrder;
+    config.format = format;
+    config.compression = compression;
+    config.verifyOutput = verifyOutput;
+    config.fastValidate = fast;
+    config.fastOpts = fastOpts;
+    RunSummary summary;
+    int status;
+    if (!batchSource.empty()) {
+        batchOpts.threads = opts.threads;
+        status = runBatchMode(batchSource, outputDir.empty() ? "../output/{name}/" : outputDir, validate, config,
+            batchOpts);
+    } else if (validate) {
+        status = stream ? runStreamValidateMode(inputPath, streamOpts)
+                        : runValidateMode(inputPath, config, std::cout, std::cerr, summary);
+    } else {
+        const std::string outDir = outputDir.empty() ? "../output/" : expandOutputTemplate(outputDir, inputPath);
+        status = runPipeline(inputPath, outDir, config, std::cout, std::cerr, summary);
+    }
+    if (!profilePath.empty() && !writeProfileJson(profilePath)) {
+        std::cerr << "Cannot write profile to " << profilePath << "\n";
+        return 1;
+    }
+    return status;
 }
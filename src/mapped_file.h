@@ -0,0 +1,36 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+/** Read-only mapping of a whole file: mmap on POSIX, CreateFileMapping/MapViewOfFile on Windows. */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /** Map path. Returns false if it cannot be opened or mapped (an empty file cannot be mapped). */
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return data_ != nullptr; }
+    const unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    /** Tell the OS the pages of [0, end) will not be read again, so a sequential pass over a file larger than
+     *  RAM does not keep it resident. The data stays readable (pages are re-read from the file). */
+    void releaseBefore(size_t end);
+
+private:
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "mesh_components.h"
+#include <algorithm>
+#include <numeric>
+
+namespace {
+// Root of x with path halving.
+StlReader::Index findRoot(std::vector<StlReader::Index>& parent, StlReader::Index x)
+{
+    while (parent[x] != x)
+    {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+
+// Union by smaller root id, so every root is the lowest vertex of its set.
+void unite(std::vector<StlReader::Index>& parent, StlReader::Index a, StlReader::Index b)
+{
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a == b)
+        return;
+    if (a < b)
+        parent[b] = a;
+    else
+        parent[a] = b;
+}
+} // namespace
+
+void MeshComponents::build(const std::vector<StlReader::Vec3>& vertices, const std::vector<StlReader::IndexedTri>& triangles)
+{
+    components_.clear();
+    componentOf_.assign(triangles.size(), 0);
+    grouped_.clear();
+    groupStarts_.assign(1, 0);
+    std::vector<StlReader::Index> parent(vertices.size());
+    std::iota(parent.begin(), parent.end(), StlReader::Index(0));
+    for (const StlReader::IndexedTri& t : triangles)
+    {
+        unite(parent, t.v0, t.v1);
+        unite(parent, t.v0, t.v2);
+    }
+    // Number roots in order of first use by a triangle.
+    const uint32_t unnumbered = UINT32_MAX;
+    std::vector<uint32_t> rootId(vertices.size(), unnumbered);
+    for (size_t i = 0; i < triangles.size(); ++i)
+    {
+        const StlReader::IndexedTri& t = triangles[i];
+        const StlReader::Index root = findRoot(parent, t.v0);
+        if (rootId[root] == unnumbered)
+        {
+            rootId[root] = static_cast<uint32_t>(components_.size());
+            Component c;
+            c.lo = c.hi = vertices[t.v0];
+            components_.push_back(c);
+        }
+        const uint32_t id = rootId[root];
+        componentOf_[i] = id;
+        Component& c = components_[id];
+        ++c.triangles;
+        for (size_t v : { t.v0, t.v1, t.v2 })
+        {
+            const StlReader::Vec3& p = vertices[v];
+            c.lo.x = std::min(c.lo.x, p.x); c.lo.y = std::min(c.lo.y, p.y); c.lo.z = std::min(c.lo.z, p.z);
+            c.hi.x = std::max(c.hi.x, p.x); c.hi.y = std::max(c.hi.y, p.y); c.hi.z = std::max(c.hi.z, p.z);
+        }
+        const StlReader::Vec3& a = vertices[t.v0], b = vertices[t.v1], cc = vertices[t.v2];
+        c.volume += (a.x * (b.y * cc.z - b.z * cc.y) + a.y * (b.z * cc.x - b.x * cc.z) + a.z * (b.x * cc.y - b.y * cc.x)) / 6.0;
+    }
+    // Counting sort of triangle indices by component.
+    groupStarts_.assign(components_.size() + 1, 0);
+    for (size_t c = 0; c < components_.size(); ++c)
+        groupStarts_[c + 1] = groupStarts_[c] + components_[c].triangles;
+    grouped_.resize(triangles.size());
+    std::vector<size_t> next(groupStarts_.begin(), groupStarts_.end() - 1);
+    for (size_t i = 0; i < triangles.size(); ++i)
+        grouped_[next[componentOf_[i]]++] = static_cast<StlReader::Index>(i);
+}
+
+void MeshComponents::split(const std::vector<size_t>& triangles, std::vector<std::vector<size_t>>& out) const
+{
+    out.assign(components_.size(), std::vector<size_t>());
+    for (size_t i : triangles)
+    {
+        if (i < componentOf_.size())
+            out[componentOf_[i]].push_back(i);
+    }
+}
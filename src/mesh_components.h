@@ -0,0 +1,41 @@
+#ifndef MESH_COMPONENTS_H
+#define MESH_COMPONENTS_H
+
+#include "stl_reader.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/** Connected components of an indexed set of triangles: triangles sharing a vertex belong to the same
+ *  component (union-find over vertex ids, so bodies that only touch at a welded vertex are joined). Components
+ *  are numbered in order of their lowest triangle index, so the numbering depends only on the mesh. */
+class MeshComponents {
+public:
+    struct Component {
+        size_t triangles = 0;
+        StlReader::Vec3 lo{ 0.f, 0.f, 0.f }, hi{ 0.f, 0.f, 0.f };  // bounding box of its vertices
+        double volume = 0.;  // signed tetrahedron sum as in StlReader::volume(); negative for inward-facing shells
+    };
+
+    void build(const std::vector<StlReader::Vec3>& vertices, const std::vector<StlReader::IndexedTri>& triangles);
+
+    size_t count() const { return components_.size(); }
+    const std::vector<Component>& components() const { return components_; }
+    /** Component of each triangle. */
+    const std::vector<uint32_t>& componentOf() const { return componentOf_; }
+    /** Triangle indices grouped by component, ascending within a component: component c is
+     *  [groupBegin(c), groupBegin(c + 1)) in grouped(). */
+    const std::vector<StlReader::Index>& grouped() const { return grouped_; }
+    size_t groupBegin(size_t c) const { return groupStarts_[c]; }
+
+    /** Split triangle indices (ascending) by component; out[c] keeps the order of component c's entries. */
+    void split(const std::vector<size_t>& triangles, std::vector<std::vector<size_t>>& out) const;
+
+private:
+    std::vector<Component> components_;
+    std::vector<uint32_t> componentOf_;
+    std::vector<StlReader::Index> grouped_;
+    std::vector<size_t> groupStarts_;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "mesh_topology.h"
+#include <algorithm>
+#include <array>
+#include <numeric>
+
+namespace {
+bool edgeLess(const MeshTopology::HalfEdge& a, const MeshTopology::HalfEdge& b)
+{
+    if (a.lo != b.lo) return a.lo < b.lo;
+    if (a.hi != b.hi) return a.hi < b.hi;
+    if (a.tri != b.tri) return a.tri < b.tri;
+    return a.from < b.from;
+}
+
+MeshTopology::HalfEdge halfEdge(StlReader::Index from, StlReader::Index to, size_t tri)
+{
+    return { std::min(from, to), std::max(from, to), from, to, static_cast<StlReader::Index>(tri) };
+}
+
+struct FromLess {
+    bool operator()(const MeshTopology::HalfEdge& e, size_t v) const { return e.from < v; }
+    bool operator()(size_t v, const MeshTopology::HalfEdge& e) const { return v < e.from; }
+};
+} // namespace
+
+const size_t MeshTopology::kNoSlot;
+
+MeshTopology::MeshTopology(Arena* arena)
+    : arena_(arena), halfEdges_(arena), edgeStarts_(arena), boundary_(arena), boundaryByFrom_(arena),
+      outStarts_(arena), fromSlot_(arena), toSlot_(arena), position_(arena)
+{
+}
+
+void MeshTopology::build(const std::vector<StlReader::IndexedTri>& triangles)
+{
+    ScratchVector<size_t> order(triangles.size(), 0, arena_);
+    std::iota(order.begin(), order.end(), size_t(0));
+    finish(triangles, order);
+}
+
+void MeshTopology::build(const std::vector<StlReader::IndexedTri>& triangles, const std::vector<size_t>& subset)
+{
+    ScratchVector<size_t> order(arena_);
+    order.reserve(subset.size());
+    for (size_t ti : subset)
+        if (ti < triangles.size())
+            order.push_back(ti);
+    finish(triangles, order);
+}
+
+void MeshTopology::finish(const std::vector<StlReader::IndexedTri>& triangles, const ScratchVector<size_t>& order)
+{
+    halfEdges_.clear();
+    halfEdges_.reserve(order.size() * 3);
+    for (size_t ti : order)
+    {
+        const StlReader::IndexedTri& t = triangles[ti];
+        halfEdges_.push_back(halfEdge(t.v0, t.v1, ti));
+        halfEdges_.push_back(halfEdge(t.v1, t.v2, ti));
+        halfEdges_.push_back(halfEdge(t.v2, t.v0, ti));
+    }
+    std::sort(halfEdges_.begin(), halfEdges_.end(), edgeLess);
+
+    edgeStarts_.clear();
+    boundary_.clear();
+    nonManifold_ = 0;
+    for (size_t i = 0; i < halfEdges_.size();)
+    {
+        size_t j = i + 1;
+        while (j < halfEdges_.size() && halfEdges_[j].lo == halfEdges_[i].lo && halfEdges_[j].hi == halfEdges_[i].hi)
+            ++j;
+        edgeStarts_.push_back(i);
+        if (j - i == 1) boundary_.push_back(halfEdges_[i]);
+        else if (j - i > 2) ++nonManifold_;
+        i = j;
+    }
+    edgeStarts_.push_back(halfEdges_.size());
+
+    // Boundary edges grouped by start vertex (edge order kept within a vertex), with slot numbers for both ends.
+    ScratchVector<size_t> byFrom(boundary_.size(), 0, arena_);
+    std::iota(byFrom.begin(), byFrom.end(), size_t(0));
+    std::stable_sort(byFrom.begin(), byFrom.end(),
+        [this](size_t a, size_t b) { return boundary_[a].from < boundary_[b].from; });
+    boundaryByFrom_.resize(boundary_.size());
+    position_.resize(boundary_.size());
+    fromSlot_.resize(boundary_.size());
+    outStarts_.clear();
+    for (size_t p = 0; p < byFrom.size(); ++p)
+    {
+        boundaryByFrom_[p] = boundary_[byFrom[p]];
+        position_[byFrom[p]] = p;
+        if (p == 0 || boundaryByFrom_[p].from != boundaryByFrom_[p - 1].from)
+            outStarts_.push_back(p);
+        fromSlot_[p] = outStarts_.size() - 1;
+    }
+    if (!boundaryByFrom_.empty())
+        outStarts_.push_back(boundaryByFrom_.size());
+    toSlot_.resize(boundary_.size());
+    for (size_t p = 0; p < boundaryByFrom_.size(); ++p)
+    {
+        auto it = std::lower_bound(boundaryByFrom_.begin(), boundaryByFrom_.end(), boundaryByFrom_[p].to, FromLess());
+        toSlot_[p] = it != boundaryByFrom_.end() && it->from == boundaryByFrom_[p].to
+            ? fromSlot_[static_cast<size_t>(it - boundaryByFrom_.begin())] : kNoSlot;
+    }
+
+    // Faces keyed by sorted vertex triple; within a run of equal keys the first in build order is kept.
+    struct FaceKey {
+        std::array<size_t, 3> v;
+        size_t pos;
+        bool operator<(const FaceKey& o) const { return v != o.v ? v < o.v : pos < o.pos; }
+    };
+    ScratchVector<FaceKey> faces(order.size(), FaceKey(), arena_);
+    for (size_t k = 0; k < order.size(); ++k)
+    {
+        const StlReader::IndexedTri& t = triangles[order[k]];
+        faces[k].v = { { t.v0, t.v1, t.v2 } };
+        std::sort(faces[k].v.begin(), faces[k].v.end());
+        faces[k].pos = k;
+    }
+    std::sort(faces.begin(), faces.end());
+    duplicateFaces_.clear();
+    for (size_t k = 1; k < faces.size(); ++k)
+        if (faces[k].v == faces[k - 1].v)
+            duplicateFaces_.push_back(order[faces[k].pos]);
+    std::sort(duplicateFaces_.begin(), duplicateFaces_.end());
+}
+
+std::pair<const MeshTopology::HalfEdge*, const MeshTopology::HalfEdge*> MeshTopology::boundaryFrom(size_t v) const
+{
+    auto range = std::equal_range(boundaryByFrom_.begin(), boundaryByFrom_.end(), v, FromLess());
+    const HalfEdge* base = boundaryByFrom_.data();
+    return { base + (range.first - boundaryByFrom_.begin()), base + (range.second - boundaryByFrom_.begin()) };
+}
@@ -0,0 +1,72 @@
+#ifndef MESH_TOPOLOGY_H
+#define MESH_TOPOLOGY_H
+
+#include "arena.h"
+#include "stl_reader.h"
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/** Edge and face adjacency of an indexed set of triangles, built once and queried by checkWatertight(),
+ *  addCaps() and cleanMesh() in place of per-call std::map / std::set tables. Every triangle side is stored as
+ *  a half-edge in one array sorted by undirected edge (lower vertex, higher vertex), so an edge is a contiguous
+ *  run and the edges come out in the order a std::map keyed on (min, max) vertex pairs would visit them. */
+class MeshTopology {
+public:
+    struct HalfEdge {
+        StlReader::Index lo, hi;    // undirected key, lo <= hi
+        StlReader::Index from, to;  // direction within its triangle
+        StlReader::Index tri;       // triangle index
+    };
+
+    /** With an arena, the tables and build temporaries are taken from it (see ArenaScope); otherwise the heap. */
+    explicit MeshTopology(Arena* arena = nullptr);
+
+    /** Build over all triangles, or only over the listed indices (entries out of range are ignored). */
+    void build(const std::vector<StlReader::IndexedTri>& triangles);
+    void build(const std::vector<StlReader::IndexedTri>& triangles, const std::vector<size_t>& subset);
+
+    /** All half-edges, grouped by undirected edge. */
+    const ScratchVector<HalfEdge>& halfEdges() const { return halfEdges_; }
+    size_t edgeCount() const { return edgeStarts_.empty() ? 0 : edgeStarts_.size() - 1; }
+    /** Half-edges of undirected edge e: [edgeBegin(e), edgeBegin(e + 1)) in halfEdges(). */
+    size_t edgeBegin(size_t e) const { return edgeStarts_[e]; }
+    /** Edges used by exactly one triangle / by more than two. */
+    size_t boundaryEdgeCount() const { return boundary_.size(); }
+    size_t nonManifoldEdgeCount() const { return nonManifold_; }
+
+    /** The half-edge of every boundary edge, in edge order. */
+    const ScratchVector<HalfEdge>& boundaryEdges() const { return boundary_; }
+    /** Boundary half-edges leaving vertex v, in edge order (pointer range into an internal array). */
+    std::pair<const HalfEdge*, const HalfEdge*> boundaryFrom(size_t v) const;
+
+    /** Boundary edges as a flat adjacency for loop tracing. The vertices with an outgoing boundary edge are
+     *  numbered 0..boundaryVertexCount()-1 in vertex order ("slots"); boundaryByFrom() holds the boundary
+     *  half-edges grouped by slot, slot s owning positions [boundaryOutBegin(s), boundaryOutBegin(s + 1)) in edge
+     *  order. For position p, boundaryFromSlot(p) / boundaryToSlot(p) give the slots of its end points (kNoSlot if
+     *  the end vertex has no outgoing boundary edge); boundaryPosition(b) is the position of boundaryEdges()[b]. */
+    static const size_t kNoSlot = static_cast<size_t>(-1);
+    const ScratchVector<HalfEdge>& boundaryByFrom() const { return boundaryByFrom_; }
+    size_t boundaryVertexCount() const { return outStarts_.empty() ? 0 : outStarts_.size() - 1; }
+    size_t boundaryOutBegin(size_t slot) const { return outStarts_[slot]; }
+    size_t boundaryFromSlot(size_t p) const { return fromSlot_[p]; }
+    size_t boundaryToSlot(size_t p) const { return toSlot_[p]; }
+    size_t boundaryPosition(size_t b) const { return position_[b]; }
+
+    /** Triangles (ascending) with the same vertex set as an earlier triangle in the build order. */
+    const std::vector<size_t>& duplicateFaces() const { return duplicateFaces_; }
+
+private:
+    void finish(const std::vector<StlReader::IndexedTri>& triangles, const ScratchVector<size_t>& order);
+
+    Arena* arena_;
+    ScratchVector<HalfEdge> halfEdges_;
+    ScratchVector<size_t> edgeStarts_;
+    ScratchVector<HalfEdge> boundary_;
+    ScratchVector<HalfEdge> boundaryByFrom_;
+    ScratchVector<size_t> outStarts_, fromSlot_, toSlot_, position_;
+    size_t nonManifold_ = 0;
+    std::vector<size_t> duplicateFaces_;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "morton.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+const uint32_t kMortonMax = (1u << 21) - 1;
+
+// Spread the low 21 bits of v to every third bit.
+inline uint64_t spreadBits(uint64_t v)
+{
+    v &= 0x1FFFFF;
+    v = (v | v << 32) & 0x1F00000000FFFFull;
+    v = (v | v << 16) & 0x1F0000FF0000FFull;
+    v = (v | v << 8) & 0x100F00F00F00F00Full;
+    v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+inline uint32_t quantise(float x, float lo, float scale)
+{
+    const float q = (x - lo) * scale;
+    if (!(q > 0.f)) return 0;  // also NaN
+    return q >= static_cast<float>(kMortonMax) ? kMortonMax : static_cast<uint32_t>(q);
+}
+} // namespace
+
+uint64_t mortonCode(const StlReader::Vec3& p, const float lo[3], const float scale[3])
+{
+    return spreadBits(quantise(p.x, lo[0], scale[0])) | spreadBits(quantise(p.y, lo[1], scale[1])) << 1 |
+        spreadBits(quantise(p.z, lo[2], scale[2])) << 2;
+}
+
+void mortonOrder(const std::vector<StlReader::Vec3>& points, unsigned threads, std::vector<StlReader::Index>& order)
+{
+    const size_t n = points.size();
+    order.resize(n);
+    if (n == 0) return;
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (const StlReader::Vec3& p : points)
+    {
+        const float c[3] = { p.x, p.y, p.z };
+        for (int a = 0; a < 3; ++a)
+        {
+            if (!std::isfinite(c[a])) continue;
+            lo[a] = std::min(lo[a], c[a]);
+            hi[a] = std::max(hi[a], c[a]);
+        }
+    }
+    float scale[3];
+    for (int a = 0; a < 3; ++a)
+    {
+        if (!(hi[a] >= lo[a])) lo[a] = hi[a] = 0.f;  // no finite coordinate on this axis
+        const float extent = hi[a] - lo[a];
+        scale[a] = extent > 0.f ? static_cast<float>(kMortonMax) / extent : 0.f;
+    }
+    std::vector<std::pair<uint64_t, StlReader::Index>> keyed(n);
+    parallelFor(n, 16384, resolveThreadCount(threads), [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; ++i)
+            keyed[i] = { mortonCode(points[i], lo, scale), static_cast<StlReader::Index>(i) };
+    });
+    std::sort(keyed.begin(), keyed.end());
+    for (size_t k = 0; k < n; ++k)
+        order[k] = keyed[k].second;
+}
@@ -0,0 +1,18 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include "stl_reader.h"
+#include <cstdint>
+#include <vector>
+
+/** 3D Morton (Z-order) code of p: each coordinate is quantised to 21 bits over the box [lo, lo + extent] and the
+ *  bits are interleaved (x lowest), so points close in space mostly get close codes. scale[a] is
+ *  (2^21 - 1) / extent[a], or 0 for a flat axis. */
+uint64_t mortonCode(const StlReader::Vec3& p, const float lo[3], const float scale[3]);
+
+/** Permutation sorting points by Morton code over their bounding box: order[k] is the point placed k-th. Ties
+ *  keep index order, so the result does not depend on the thread count (codes are computed on `threads`
+ *  workers, 0 = all hardware threads). Non-finite coordinates sort as the box's low corner. */
+void mortonOrder(const std::vector<StlReader::Vec3>& points, unsigned threads, std::vector<StlReader::Index>& order);
+
+#endif
@@ -0,0 +1,159 @@
+#include "parallel.h"
+#include "profile.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+struct ChunkQueue {
+    std::mutex m;
+    std::deque<std::pair<size_t, size_t>> chunks;
+
+    bool popFront(std::pair<size_t, size_t>& c)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (chunks.empty()) return false;
+        c = chunks.front();
+        chunks.pop_front();
+        return true;
+    }
+    bool stealBack(std::pair<size_t, size_t>& c)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (chunks.empty()) return false;
+        c = chunks.back();
+        chunks.pop_back();
+        return true;
+    }
+};
+} // namespace
+
+unsigned resolveThreadCount(unsigned requested)
+{
+    unsigned hw = std::thread::hardware_concurrency();
+    if (hw == 0)
+        hw = 1;
+    if (requested > 0)
+        return std::min(requested, hw * kMaxOversubscription);
+    return hw;
+}
+
+void parallelFor(size_t n, size_t grain, unsigned threads, const std::function<void(size_t, size_t, unsigned)>& body)
+{
+    if (n == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+    const size_t chunkCount = (n + grain - 1) / grain;
+    threads = static_cast<unsigned>(std::min<size_t>(resolveThreadCount(threads), chunkCount));
+    if (threads <= 1)
+    {
+        for (size_t b = 0; b < n; b += grain)
+            body(b, std::min(n, b + grain), 0);
+        return;
+    }
+
+    std::vector<std::unique_ptr<ChunkQueue>> queues;
+    for (unsigned w = 0; w < threads; ++w)
+        queues.emplace_back(new ChunkQueue);
+    for (size_t c = 0; c < chunkCount; ++c)
+    {
+        const size_t b = c * grain;
+        queues[c * threads / chunkCount]->chunks.push_back({ b, std::min(n, b + grain) });
+    }
+
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    // CPU time of the pool threads, credited to the caller so its ProfileScope covers its workers.
+    const bool profiled = profile_detail::enabled.load(std::memory_order_relaxed);
+    double poolCpuMs = 0.;
+    auto worker = [&](unsigned self) {
+        std::pair<size_t, size_t> c;
+        for (;;)
+        {
+            if (failed.load(std::memory_order_relaxed))
+                return;
+            bool got = queues[self]->popFront(c);
+            for (unsigned k = 1; !got && k < threads; ++k)
+                got = queues[(self + k) % threads]->stealBack(c);
+            if (!got)
+                return;  // chunks are never added after start, so every queue is drained
+            try
+            {
+                body(c.first, c.second, self);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < threads; ++w)
+        pool.emplace_back([&, w] {
+            worker(w);
+            if (profiled)
+            {
+                const double ms = profileCpuMs();
+                std::lock_guard<std::mutex> lock(errorMutex);
+                poolCpuMs += ms;
+            }
+        });
+    worker(0);
+    for (std::thread& t : pool)
+        t.join();
+    if (profiled)
+        addProfileCpuMs(poolCpuMs);
+    if (error)
+        std::rethrow_exception(error);
+}
+
+TaskGroup::~TaskGroup()
+{
+    for (std::thread& t : threads_)
+        t.join();
+    addProfileCpuMs(taskCpuMs_);
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+    ProfileContext context = currentProfileContext();
+    threads_.emplace_back([this, task = std::move(task), context = std::move(context)] {
+        ProfileAdopt adopt(context);
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            if (!failure_) failure_ = std::current_exception();
+        }
+        const double ms = profile_detail::enabled.load(std::memory_order_relaxed) ? profileCpuMs() : 0.;
+        std::lock_guard<std::mutex> lock(m_);
+        taskCpuMs_ += ms;
+    });
+}
+
+void TaskGroup::wait()
+{
+    for (std::thread& t : threads_)
+        t.join();
+    threads_.clear();
+    addProfileCpuMs(taskCpuMs_);
+    taskCpuMs_ = 0.;
+    std::exception_ptr failure;
+    std::swap(failure, failure_);
+    if (failure)
+        std::rethrow_exception(failure);
+}
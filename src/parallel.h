@@ -0,0 +1,46 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Worker count for a requested thread count: 0 means one per hardware thread. Requests above
+ *  kMaxOversubscription workers per hardware thread are capped there, so per-worker tables stay small whatever
+ *  the caller asks for. Never returns 0. */
+const unsigned kMaxOversubscription = 4;
+unsigned resolveThreadCount(unsigned requested);
+
+/** Run body(begin, end, worker) over [0, n) in chunks of at most grain items on `threads` workers
+ *  (worker is in [0, threads)). Each worker starts with a contiguous share of the chunks and takes them from
+ *  the front of its own deque; a worker that runs dry steals from the back of another worker's deque, so
+ *  uneven per-item cost still balances. Runs inline when one worker suffices. The first exception thrown by
+ *  body is rethrown after all workers have stopped. */
+void parallelFor(size_t n, size_t grain, unsigned threads, const std::function<void(size_t, size_t, unsigned)>& body);
+
+/** Coarse independent tasks on threads of their own, e.g. a file write beside a computation. run() starts a task
+ *  at once; wait() joins every started task and rethrows the first exception one threw, so a stage that needs
+ *  a task's result starts after a wait(). Each task profiles as part of the stage open where it was started, and
+ *  its CPU time is credited to the thread that waits for it.
+ *  The destructor waits too, dropping any exception. */
+class TaskGroup {
+public:
+    TaskGroup() = default;
+    ~TaskGroup();
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> task);
+    void wait();
+
+private:
+    std::vector<std::thread> threads_;
+    std::mutex m_;
+    std::exception_ptr failure_;
+    double taskCpuMs_ = 0.;  // CPU time of finished tasks, credited to the waiting thread's profile
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "profile.h"
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace profile_detail {
+std::atomic<bool> enabled(false);
+thread_local int muted = 0;
+}
+
+namespace {
+struct Stage {
+    std::string name;
+    double wallMs = 0.;
+    double cpuMs = 0.;
+    uint64_t peakRssKb = 0;
+    std::vector<std::pair<std::string, uint64_t>> counters;
+};
+
+std::mutex gMutex;
+std::vector<Stage> gStages;
+thread_local std::vector<std::string> gOpen;  // this thread's open scopes, outermost first
+thread_local double gCreditedCpuMs = 0.;       // CPU time of workers and tasks that finished for this thread
+double gWallStart = 0.;
+double gCpuStart = 0.;
+
+double wallMs()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Process CPU time (user + system, all threads).
+double cpuMs()
+{
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+        return 0.;
+    auto ms = [](const FILETIME& f) { return ((static_cast<uint64_t>(f.dwHighDateTime) << 32) | f.dwLowDateTime) / 1e4; };
+    return ms(kernel) + ms(user);
+#else
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+#endif
+}
+
+// CPU time of the calling thread (user + system).
+double threadCpuMs()
+{
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+        return 0.;
+    auto ms = [](const FILETIME& f) { return ((static_cast<uint64_t>(f.dwHighDateTime) << 32) | f.dwLowDateTime) / 1e4; };
+    return ms(kernel) + ms(user);
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0.;
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
+}
+
+// Peak resident set size of the process so far, in KiB.
+uint64_t peakRssKb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc))
+        return 0;
+    return static_cast<uint64_t>(pmc.PeakWorkingSetSize) / 1024;
+#else
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return static_cast<uint64_t>(ru.ru_maxrss) / 1024;  // bytes on macOS
+#else
+    return static_cast<uint64_t>(ru.ru_maxrss);  // KiB on Linux and the BSDs
+#endif
+#endif
+}
+
+std::string jsonEscape(const std::string& s)
+{
+    std::string out;
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20) out += c;
+    }
+    return out;
+}
+} // namespace
+
+void enableProfiling()
+{
+    std::lock_guard<std::mutex> lock(gMutex);
+    if (profile_detail::enabled.load())
+        return;
+    gWallStart = wallMs();
+    gCpuStart = cpuMs();
+    profile_detail::enabled.store(true);
+}
+
+double profileCpuMs()
+{
+    return threadCpuMs() + gCreditedCpuMs;
+}
+
+void addProfileCpuMs(double ms)
+{
+    gCreditedCpuMs += ms;
+}
+
+ProfileContext currentProfileContext()
+{
+    ProfileContext c;
+    c.open = gOpen;
+    c.muted = profile_detail::muted;
+    return c;
+}
+
+ProfileAdopt::ProfileAdopt(const ProfileContext& context)
+{
+    saved_.open.swap(gOpen);
+    saved_.muted = profile_detail::muted;
+    gOpen = context.open;
+    profile_detail::muted = context.muted;
+}
+
+ProfileAdopt::~ProfileAdopt()
+{
+    gOpen.swap(saved_.open);
+    profile_detail::muted = saved_.muted;
+}
+
+ProfileScope::ProfileScope(const char* name)
+{
+    if (!profilingEnabled())
+        return;
+    std::lock_guard<std::mutex> lock(gMutex);
+    Stage s;
+    for (const std::string& parent : gOpen)
+        s.name += parent + "/";
+    s.name += name;
+    gOpen.push_back(name);
+    index_ = static_cast<long>(gStages.size());
+    gStages.push_back(s);
+    wallStart_ = wallMs();
+    cpuStart_ = profileCpuMs();
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (index_ < 0)
+        return;
+    const double wall = wallMs(), cpu = profileCpuMs();
+    std::lock_guard<std::mutex> lock(gMutex);
+    Stage& s = gStages[static_cast<size_t>(index_)];
+    s.wallMs = wall - wallStart_;
+    s.cpuMs = cpu - cpuStart_;
+    s.peakRssKb = peakRssKb();
+    gOpen.pop_back();
+}
+
+void ProfileScope::count(const char* counter, uint64_t value)
+{
+    if (index_ < 0)
+        return;
+    std::lock_guard<std::mutex> lock(gMutex);
+    auto& counters = gStages[static_cast<size_t>(index_)].counters;
+    for (auto& c : counters)
+    {
+        if (c.first == counter)
+        {
+            c.second += value;
+            return;
+        }
+    }
+    counters.push_back({ counter, value });
+}
+
+bool writeProfileJson(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(gMutex);
+    std::ofstream f(path);
+    if (!f)
+        return false;
+    f << std::fixed << std::setprecision(3);
+    f << "{\n  \"total\": { \"wall_ms\": " << (wallMs() - gWallStart) << ", \"cpu_ms\": " << (cpuMs() - gCpuStart)
+      << ", \"peak_rss_kb\": " << peakRssKb() << " },\n  \"stages\": [\n";
+    for (size_t i = 0; i < gStages.size(); ++i)
+    {
+        const Stage& s = gStages[i];
+        f << "    { \"name\": \"" << jsonEscape(s.name) << "\", \"wall_ms\": " << s.wallMs << ", \"cpu_ms\": " << s.cpuMs
+          << ", \"peak_rss_kb\": " << s.peakRssKb << ", \"counters\": {";
+        for (size_t k = 0; k < s.counters.size(); ++k)
+            f << (k ? ", " : " ") << "\"" << jsonEscape(s.counters[k].first) << "\": " << s.counters[k].second;
+        f << (s.counters.empty() ? "}" : " }") << " }" << (i + 1 < gStages.size() ? "," : "") << "\n";
+    }
+    f << "  ]\n}\n";
+    return !!f;
+}
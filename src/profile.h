@@ -0,0 +1,85 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** Process-wide stage profiler behind --profile. Off by default: a ProfileScope then costs one relaxed atomic
+ *  load and records nothing, so the instrumentation can stay in the hot paths. When enabled, every scope records
+ *  wall time, CPU time and the peak resident set size reached by its end, plus any counters added to it. A
+ *  scope's CPU time is that of its own thread plus the parallelFor workers and TaskGroup tasks it started, so
+ *  stages running side by side do not count each other's work; the total is the whole process. Scopes nest; a
+ *  nested stage is named "parent/child". Nesting is tracked per thread, so pipelines run side by side on
+ *  separate threads each record their own stages; the workers of one stage are tallied by the caller and added
+ *  to its scope once. */
+void enableProfiling();
+
+namespace profile_detail {
+extern std::atomic<bool> enabled;
+extern thread_local int muted;
+}
+
+inline bool profilingEnabled()
+{
+    return profile_detail::enabled.load(std::memory_order_relaxed) && profile_detail::muted == 0;
+}
+
+/** While alive, scopes opened on this thread record nothing. For stages run concurrently from worker threads;
+ *  the caller's own scope carries their totals. */
+class ProfileMute {
+public:
+    ProfileMute() { ++profile_detail::muted; }
+    ~ProfileMute() { --profile_detail::muted; }
+    ProfileMute(const ProfileMute&) = delete;
+    ProfileMute& operator=(const ProfileMute&) = delete;
+};
+
+/** CPU time of the calling thread plus what was credited to it with addProfileCpuMs(), in ms. */
+double profileCpuMs();
+/** Credit ms of CPU time spent on another thread on behalf of this one (finished workers and tasks). */
+void addProfileCpuMs(double ms);
+
+/** The calling thread's open scopes and mute state, captured to hand a stage to another thread. */
+struct ProfileContext {
+    std::vector<std::string> open;
+    int muted = 0;
+};
+ProfileContext currentProfileContext();
+
+/** While alive, this thread profiles as if it were inside context: its scopes are named under the context's
+ *  open scopes, and record nothing if the context was muted. For tasks started from a stage (TaskGroup). */
+class ProfileAdopt {
+public:
+    explicit ProfileAdopt(const ProfileContext& context);
+    ~ProfileAdopt();
+    ProfileAdopt(const ProfileAdopt&) = delete;
+    ProfileAdopt& operator=(const ProfileAdopt&) = delete;
+
+private:
+    ProfileContext saved_;
+};
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name);
+    ~ProfileScope();
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    /** True if this scope is recording (profiling was enabled when it opened). */
+    bool active() const { return index_ >= 0; }
+    /** Add value to the stage counter `counter` (no-op when inactive). */
+    void count(const char* counter, uint64_t value);
+
+private:
+    long index_ = -1;
+    double wallStart_ = 0.;
+    double cpuStart_ = 0.;
+};
+
+/** Write every recorded stage to path as JSON, with totals since enableProfiling(). */
+bool writeProfileJson(const std::string& path);
+
+#endif
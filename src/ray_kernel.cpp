@@ -0,0 +1,311 @@
+#include "ray_kernel.h"
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RAY_KERNEL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define RAY_TARGET_AVX2
+#else
+#define RAY_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define RAY_KERNEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+const float kEps = 1e-6f;  // same as StlReader::rayIntersect()
+
+unsigned intersectScalar(const TriangleSoA& s, size_t first, size_t n, const float ro[3], const float rd[3], float* tOut)
+{
+    unsigned mask = 0;
+    for (size_t k = 0; k < n; ++k)
+    {
+        const size_t i = first + k;
+        const float e1x = s.e1x[i], e1y = s.e1y[i], e1z = s.e1z[i];
+        const float e2x = s.e2x[i], e2y = s.e2y[i], e2z = s.e2z[i];
+        float hx = rd[1] * e2z - rd[2] * e2y, hy = rd[2] * e2x - rd[0] * e2z, hz = rd[0] * e2y - rd[1] * e2x;
+        float a = e1x * hx + e1y * hy + e1z * hz;
+        if (a > -kEps && a < kEps)
+            continue;
+        float f = 1.f / a;
+        float sx = ro[0] - s.v0x[i], sy = ro[1] - s.v0y[i], sz = ro[2] - s.v0z[i];
+        float u = f * (sx * hx + sy * hy + sz * hz);
+        if (u < 0.f || u > 1.f)
+            continue;
+        float qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+        float v = f * (rd[0] * qx + rd[1] * qy + rd[2] * qz);
+        if (v < 0.f || u + v > 1.f)
+            continue;
+        float tt = f * (e2x * qx + e2y * qy + e2z * qz);
+        if (tt <= kEps)
+            continue;
+        tOut[k] = tt;
+        mask |= 1u << k;
+    }
+    return mask;
+}
+
+#if RAY_KERNEL_X86
+unsigned intersectSse(const TriangleSoA& s, size_t first, size_t n, const float ro[3], const float rd[3], float* tOut)
+{
+    unsigned mask = 0;
+    const __m128 rx = _mm_set1_ps(rd[0]), ry = _mm_set1_ps(rd[1]), rz = _mm_set1_ps(rd[2]);
+    const __m128 ox = _mm_set1_ps(ro[0]), oy = _mm_set1_ps(ro[1]), oz = _mm_set1_ps(ro[2]);
+    const __m128 eps = _mm_set1_ps(kEps), negEps = _mm_set1_ps(-kEps);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+    for (size_t b = 0; b < n; b += 4)
+    {
+        const size_t i = first + b;
+        const __m128 e1x = _mm_loadu_ps(&s.e1x[i]), e1y = _mm_loadu_ps(&s.e1y[i]), e1z = _mm_loadu_ps(&s.e1z[i]);
+        const __m128 e2x = _mm_loadu_ps(&s.e2x[i]), e2y = _mm_loadu_ps(&s.e2y[i]), e2z = _mm_loadu_ps(&s.e2z[i]);
+        const __m128 hx = _mm_sub_ps(_mm_mul_ps(ry, e2z), _mm_mul_ps(rz, e2y));
+        const __m128 hy = _mm_sub_ps(_mm_mul_ps(rz, e2x), _mm_mul_ps(rx, e2z));
+        const __m128 hz = _mm_sub_ps(_mm_mul_ps(rx, e2y), _mm_mul_ps(ry, e2x));
+        const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+        __m128 miss = _mm_and_ps(_mm_cmpgt_ps(a, negEps), _mm_cmplt_ps(a, eps));
+        const __m128 f = _mm_div_ps(one, a);
+        const __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(&s.v0x[i]));
+        const __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(&s.v0y[i]));
+        const __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(&s.v0z[i]));
+        const __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+        miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)));
+        const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        const __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, qx), _mm_mul_ps(ry, qy)), _mm_mul_ps(rz, qz)));
+        miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(_mm_add_ps(u, v), one)));
+        const __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+        miss = _mm_or_ps(miss, _mm_cmple_ps(t, eps));
+        unsigned hit = static_cast<unsigned>(~_mm_movemask_ps(miss)) & 0xFu;
+        if (n - b < 4)
+            hit &= (1u << (n - b)) - 1u;
+        if (hit)
+        {
+            _mm_storeu_ps(tOut + b, t);
+            mask |= hit << b;
+        }
+    }
+    return mask;
+}
+
+RAY_TARGET_AVX2
+unsigned intersectAvx2(const TriangleSoA& s, size_t first, size_t n, const float ro[3], const float rd[3], float* tOut)
+{
+    const __m256 rx = _mm256_set1_ps(rd[0]), ry = _mm256_set1_ps(rd[1]), rz = _mm256_set1_ps(rd[2]);
+    const __m256 eps = _mm256_set1_ps(kEps), negEps = _mm256_set1_ps(-kEps);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+    const size_t i = first;
+    const __m256 e1x = _mm256_loadu_ps(&s.e1x[i]), e1y = _mm256_loadu_ps(&s.e1y[i]), e1z = _mm256_loadu_ps(&s.e1z[i]);
+    const __m256 e2x = _mm256_loadu_ps(&s.e2x[i]), e2y = _mm256_loadu_ps(&s.e2y[i]), e2z = _mm256_loadu_ps(&s.e2z[i]);
+    const __m256 hx = _mm256_sub_ps(_mm256_mul_ps(ry, e2z), _mm256_mul_ps(rz, e2y));
+    const __m256 hy = _mm256_sub_ps(_mm256_mul_ps(rz, e2x), _mm256_mul_ps(rx, e2z));
+    const __m256 hz = _mm256_sub_ps(_mm256_mul_ps(rx, e2y), _mm256_mul_ps(ry, e2x));
+    const __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+    __m256 miss = _mm256_and_ps(_mm256_cmp_ps(a, negEps, _CMP_GT_OQ), _mm256_cmp_ps(a, eps, _CMP_LT_OQ));
+    const __m256 f = _mm256_div_ps(one, a);
+    const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ro[0]), _mm256_loadu_ps(&s.v0x[i]));
+    const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ro[1]), _mm256_loadu_ps(&s.v0y[i]));
+    const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ro[2]), _mm256_loadu_ps(&s.v0z[i]));
+    const __m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+    miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ)));
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    const __m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rx, qx), _mm256_mul_ps(ry, qy)), _mm256_mul_ps(rz, qz)));
+    miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ)));
+    const __m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+    miss = _mm256_or_ps(miss, _mm256_cmp_ps(t, eps, _CMP_LE_OQ));
+    unsigned hit = static_cast<unsigned>(~_mm256_movemask_ps(miss)) & 0xFFu;
+    if (n < 8)
+        hit &= (1u << n) - 1u;
+    if (hit)
+        _mm256_storeu_ps(tOut, t);
+    return hit;
+}
+
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#if RAY_KERNEL_NEON
+unsigned intersectNeon(const TriangleSoA& s, size_t first, size_t n, const float ro[3], const float rd[3], float* tOut)
+{
+    unsigned mask = 0;
+    const float32x4_t rx = vdupq_n_f32(rd[0]), ry = vdupq_n_f32(rd[1]), rz = vdupq_n_f32(rd[2]);
+    const float32x4_t ox = vdupq_n_f32(ro[0]), oy = vdupq_n_f32(ro[1]), oz = vdupq_n_f32(ro[2]);
+    const float32x4_t eps = vdupq_n_f32(kEps), negEps = vdupq_n_f32(-kEps);
+    const float32x4_t zero = vdupq_n_f32(0.f), one = vdupq_n_f32(1.f);
+    for (size_t b = 0; b < n; b += 4)
+    {
+        const size_t i = first + b;
+        const float32x4_t e1x = vld1q_f32(&s.e1x[i]), e1y = vld1q_f32(&s.e1y[i]), e1z = vld1q_f32(&s.e1z[i]);
+        const float32x4_t e2x = vld1q_f32(&s.e2x[i]), e2y = vld1q_f32(&s.e2y[i]), e2z = vld1q_f32(&s.e2z[i]);
+        const float32x4_t hx = vsubq_f32(vmulq_f32(ry, e2z), vmulq_f32(rz, e2y));
+        const float32x4_t hy = vsubq_f32(vmulq_f32(rz, e2x), vmulq_f32(rx, e2z));
+        const float32x4_t hz = vsubq_f32(vmulq_f32(rx, e2y), vmulq_f32(ry, e2x));
+        const float32x4_t a = vaddq_f32(vaddq_f32(vmulq_f32(e1x, hx), vmulq_f32(e1y, hy)), vmulq_f32(e1z, hz));
+        uint32x4_t miss = vandq_u32(vcgtq_f32(a, negEps), vcltq_f32(a, eps));
+        const float32x4_t f = vdivq_f32(one, a);
+        const float32x4_t sx = vsubq_f32(ox, vld1q_f32(&s.v0x[i]));
+        const float32x4_t sy = vsubq_f32(oy, vld1q_f32(&s.v0y[i]));
+        const float32x4_t sz = vsubq_f32(oz, vld1q_f32(&s.v0z[i]));
+        const float32x4_t u = vmulq_f32(f, vaddq_f32(vaddq_f32(vmulq_f32(sx, hx), vmulq_f32(sy, hy)), vmulq_f32(sz, hz)));
+        miss = vorrq_u32(miss, vorrq_u32(vcltq_f32(u, zero), vcgtq_f32(u, one)));
+        const float32x4_t qx = vsubq_f32(vmulq_f32(sy, e1z), vmulq_f32(sz, e1y));
+        const float32x4_t qy = vsubq_f32(vmulq_f32(sz, e1x), vmulq_f32(sx, e1z));
+        const float32x4_t qz = vsubq_f32(vmulq_f32(sx, e1y), vmulq_f32(sy, e1x));
+        const float32x4_t v = vmulq_f32(f, vaddq_f32(vaddq_f32(vmulq_f32(rx, qx), vmulq_f32(ry, qy)), vmulq_f32(rz, qz)));
+        miss = vorrq_u32(miss, vorrq_u32(vcltq_f32(v, zero), vcgtq_f32(vaddq_f32(u, v), one)));
+        const float32x4_t t = vmulq_f32(f, vaddq_f32(vaddq_f32(vmulq_f32(e2x, qx), vmulq_f32(e2y, qy)), vmulq_f32(e2z, qz)));
+        miss = vorrq_u32(miss, vcleq_f32(t, eps));
+        uint32_t lanes[4];
+        vst1q_u32(lanes, miss);
+        unsigned hit = 0;
+        for (unsigned l = 0; l < 4; ++l)
+            if (!lanes[l]) hit |= 1u << l;
+        if (n - b < 4)
+            hit &= (1u << (n - b)) - 1u;
+        if (hit)
+        {
+            vst1q_f32(tOut + b, t);
+            mask |= hit << b;
+        }
+    }
+    return mask;
+}
+#endif
+
+RayKernelIsa detectIsa()
+{
+#if RAY_KERNEL_X86
+    return cpuHasAvx2() ? RayKernelIsa::Avx2 : RayKernelIsa::Sse;
+#elif RAY_KERNEL_NEON
+    return RayKernelIsa::Neon;
+#else
+    return RayKernelIsa::Scalar;
+#endif
+}
+
+std::atomic<int>& activeIsaSlot()
+{
+    static std::atomic<int> slot(static_cast<int>(detectIsa()));
+    return slot;
+}
+} // namespace
+
+void TriangleSoA::clear()
+{
+    for (std::vector<float>* a : { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z })
+        a->clear();
+    ids.clear();
+    count = 0;
+}
+
+void TriangleSoA::build(const std::vector<StlReader::Vec3>& vertices, const std::vector<StlReader::IndexedTri>& triangles,
+    const uint32_t* order, size_t n)
+{
+    clear();
+    count = n;
+    const size_t padded = n + kRayBlock;
+    for (std::vector<float>* a : { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z })
+        a->assign(padded, 0.f);
+    ids.assign(padded, UINT32_MAX);
+    for (size_t k = 0; k < n; ++k)
+    {
+        const uint32_t ti = order ? order[k] : static_cast<uint32_t>(k);
+        const StlReader::IndexedTri& t = triangles[ti];
+        const StlReader::Vec3& a = vertices[t.v0];
+        const StlReader::Vec3& b = vertices[t.v1];
+        const StlReader::Vec3& c = vertices[t.v2];
+        v0x[k] = a.x; v0y[k] = a.y; v0z[k] = a.z;
+        e1x[k] = b.x - a.x; e1y[k] = b.y - a.y; e1z[k] = b.z - a.z;
+        e2x[k] = c.x - a.x; e2y[k] = c.y - a.y; e2z[k] = c.z - a.z;
+        ids[k] = ti;
+    }
+}
+
+void TriangleSoA::build(const std::vector<StlReader::Vec3>& vertices, const std::vector<StlReader::IndexedTri>& triangles)
+{
+    build(vertices, triangles, nullptr, triangles.size());
+}
+
+unsigned intersectRayBlock(const TriangleSoA& soa, size_t first, size_t n, const float ro[3], const float rd[3], float* tOut)
+{
+    switch (static_cast<RayKernelIsa>(activeIsaSlot().load(std::memory_order_relaxed)))
+    {
+#if RAY_KERNEL_X86
+    case RayKernelIsa::Avx2:
+        // Small leaves do not fill an 8-wide register; the 4-wide kernel touches less data.
+        return n > 4 ? intersectAvx2(soa, first, n, ro, rd, tOut) : intersectSse(soa, first, n, ro, rd, tOut);
+    case RayKernelIsa::Sse:
+        return intersectSse(soa, first, n, ro, rd, tOut);
+#endif
+#if RAY_KERNEL_NEON
+    case RayKernelIsa::Neon:
+        return intersectNeon(soa, first, n, ro, rd, tOut);
+#endif
+    default:
+        return intersectScalar(soa, first, n, ro, rd, tOut);
+    }
+}
+
+RayKernelIsa activeRayKernel()
+{
+    return static_cast<RayKernelIsa>(activeIsaSlot().load());
+}
+
+bool rayKernelSupported(RayKernelIsa isa)
+{
+    switch (isa)
+    {
+    case RayKernelIsa::Scalar:
+        return true;
+#if RAY_KERNEL_X86
+    case RayKernelIsa::Sse:
+        return true;
+    case RayKernelIsa::Avx2:
+        return cpuHasAvx2();
+#endif
+#if RAY_KERNEL_NEON
+    case RayKernelIsa::Neon:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+bool setRayKernel(RayKernelIsa isa)
+{
+    if (!rayKernelSupported(isa))
+        return false;
+    activeIsaSlot().store(static_cast<int>(isa));
+    return true;
+}
+
+const char* rayKernelName(RayKernelIsa isa)
+{
+    switch (isa)
+    {
+    case RayKernelIsa::Sse: return "sse";
+    case RayKernelIsa::Avx2: return "avx2";
+    case RayKernelIsa::Neon: return "neon";
+    default: return "scalar";
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef RAY_KERNEL_H
+#define RAY_KERNEL_H
+
+#include "stl_reader.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/** Triangles as structure-of-arrays: v0 and the edges e1 = v1 - v0, e2 = v2 - v0, one array per component,
+ *  with ids[slot] giving the original triangle index. Arrays carry kRayBlock trailing degenerate slots so a
+ *  block read starting at any real slot never runs past the end. */
+struct TriangleSoA {
+    std::vector<float> v0x, v0y, v0z;
+    std::vector<float> e1x, e1y, e1z;
+    std::vector<float> e2x, e2y, e2z;
+    std::vector<uint32_t> ids;
+    size_t count = 0;  // real (unpadded) slots
+
+    /** Fill slots in the given triangle order (order[k] is the triangle stored in slot k). */
+    void build(const std::vector<StlReader::Vec3>& vertices, const std::vector<StlReader::IndexedTri>& triangles,
+        const uint32_t* order, size_t n);
+    /** Fill slots in index order 0..triangles.size()-1. */
+    void build(const std::vector<StlReader::Vec3>& vertices, const std::vector<StlReader::IndexedTri>& triangles);
+    void clear();
+    size_t size() const { return count; }
+};
+
+/** Widest block the kernels handle in one call. */
+const size_t kRayBlock = 8;
+
+enum class RayKernelIsa { Scalar, Sse, Avx2, Neon };
+
+/** Möller–Trumbore for one ray against slots [first, first + n) of soa, n <= kRayBlock. Bit k of the result is
+ *  set and tOut[k] written when slot first + k is hit. Uses the same operations in the same order as
+ *  StlReader::rayIntersect() (no fused multiply-add; the build scripts pass -ffp-contract=off so the compiler does
+ *  not fuse the scalar expressions either), so every ISA returns the scalar result. */
+unsigned intersectRayBlock(const TriangleSoA& soa, size_t first, size_t n, const float ro[3], const float rd[3], float* tOut);
+
+/** ISA chosen at first use from the running CPU (AVX2, then SSE or NEON, then scalar). */
+RayKernelIsa activeRayKernel();
+/** Whether this build and CPU can run isa. */
+bool rayKernelSupported(RayKernelIsa isa);
+/** Override the runtime choice (e.g. to compare ISAs). Returns false and keeps the current kernel if unsupported. */
+bool setRayKernel(RayKernelIsa isa);
+const char* rayKernelName(RayKernelIsa isa);
+
+#endif
@@ -0,0 +1,138 @@
+#include "robust_ray.h"
+#include <cmath>
+
+namespace {
+typedef StlReader::Vec3 Vec3;
+
+// Forward error bounds of the filtered determinant: seven rounded operations per term (two differences, the
+// cross product, its difference, the product with d, two sums), rounded up with room for the bound's own
+// rounding. Outside [kMinFloatPermanent, kMaxFloatPermanent] float products may under- or overflow.
+const float kFloatBound = 8.f * 5.9604645e-8f;     // 8 * 2^-24
+const double kDoubleBound = 8. * 1.1102230246251565e-16;  // 8 * 2^-53
+const float kMinFloatPermanent = 1e-30f, kMaxFloatPermanent = 1e30f;
+
+// Nonoverlapping expansion (Shewchuk), components in increasing magnitude, zeros dropped.
+struct Expansion {
+    double e[48];
+    int n = 0;
+
+    void add(double b)
+    {
+        double q = b;
+        int m = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            const double s = q + e[i];
+            const double bv = s - q;
+            const double err = (q - (s - bv)) + (e[i] - bv);
+            q = s;
+            if (err != 0.)
+                e[m++] = err;
+        }
+        if (q != 0.)
+            e[m++] = q;
+        n = m;
+    }
+    // x * y * z exactly: x * y is exact in double for float inputs, the product with z is split by fma.
+    void addProduct(float x, float y, float z, bool negate)
+    {
+        const double xy = static_cast<double>(x) * y;
+        const double hi = xy * z;
+        const double lo = std::fma(xy, static_cast<double>(z), -hi);
+        add(negate ? -lo : lo);
+        add(negate ? -hi : hi);
+    }
+    int sign() const { return n == 0 ? 0 : (e[n - 1] > 0. ? 1 : -1); }
+};
+
+// Exact d · (p × q) added to x.
+void addTriple(Expansion& x, const Vec3& d, const Vec3& p, const Vec3& q)
+{
+    x.addProduct(d.x, p.y, q.z, false);
+    x.addProduct(d.x, p.z, q.y, true);
+    x.addProduct(d.y, p.z, q.x, false);
+    x.addProduct(d.y, p.x, q.z, true);
+    x.addProduct(d.z, p.x, q.y, false);
+    x.addProduct(d.z, p.y, q.x, true);
+}
+
+// Exact sign of (b_i - a_i) * d_j - (b_j - a_j) * d_i (each float product is exact in double).
+int exactEdgeCrossSign(float ai, float aj, float bi, float bj, float di, float dj)
+{
+    Expansion x;
+    x.add(static_cast<double>(bi) * dj);
+    x.add(-static_cast<double>(ai) * dj);
+    x.add(-static_cast<double>(bj) * di);
+    x.add(static_cast<double>(aj) * di);
+    return x.sign();
+}
+
+// Sign of the edge determinant for (a, b), ties broken by shifting the origin by (e, e^2, e^3) for an
+// infinitesimal e: the determinant then gains -shift · ((b - a) × d), decided by its first non-zero component.
+int perturbedSide(const Vec3& o, const Vec3& d, const Vec3& a, const Vec3& b, RobustRayStats& stats)
+{
+    const int s = rayEdgeOrientation(o, d, a, b, stats);
+    if (s != 0)
+        return s;
+    int c = exactEdgeCrossSign(a.y, a.z, b.y, b.z, d.y, d.z);
+    if (c == 0) c = exactEdgeCrossSign(a.z, a.x, b.z, b.x, d.z, d.x);
+    if (c == 0) c = exactEdgeCrossSign(a.x, a.y, b.x, b.y, d.x, d.y);
+    return -c;  // 0 only for an edge parallel to the ray
+}
+} // namespace
+
+int rayEdgeOrientation(const Vec3& o, const Vec3& d, const Vec3& a, const Vec3& b, RobustRayStats& stats)
+{
+    {
+        const float ux = a.x - o.x, uy = a.y - o.y, uz = a.z - o.z;
+        const float vx = b.x - o.x, vy = b.y - o.y, vz = b.z - o.z;
+        const float value = d.x * (uy * vz - uz * vy) + d.y * (uz * vx - ux * vz) + d.z * (ux * vy - uy * vx);
+        const float permanent = std::fabs(d.x) * (std::fabs(uy * vz) + std::fabs(uz * vy)) +
+            std::fabs(d.y) * (std::fabs(uz * vx) + std::fabs(ux * vz)) +
+            std::fabs(d.z) * (std::fabs(ux * vy) + std::fabs(uy * vx));
+        if (permanent >= kMinFloatPermanent && permanent <= kMaxFloatPermanent &&
+            std::fabs(value) > kFloatBound * permanent)
+        {
+            ++stats.floatSigns;
+            return value > 0.f ? 1 : -1;
+        }
+    }
+    {
+        const double ux = static_cast<double>(a.x) - o.x, uy = static_cast<double>(a.y) - o.y, uz = static_cast<double>(a.z) - o.z;
+        const double vx = static_cast<double>(b.x) - o.x, vy = static_cast<double>(b.y) - o.y, vz = static_cast<double>(b.z) - o.z;
+        const double value = d.x * (uy * vz - uz * vy) + d.y * (uz * vx - ux * vz) + d.z * (ux * vy - uy * vx);
+        const double permanent = std::fabs(d.x) * (std::fabs(uy * vz) + std::fabs(uz * vy)) +
+            std::fabs(d.y) * (std::fabs(uz * vx) + std::fabs(ux * vz)) +
+            std::fabs(d.z) * (std::fabs(ux * vy) + std::fabs(uy * vx));
+        if (std::fabs(value) > kDoubleBound * permanent)
+        {
+            ++stats.doubleSigns;
+            return value > 0. ? 1 : -1;
+        }
+    }
+    // d · ((a - o) × (b - o)) = d · (a × b + b × o + o × a), a sum of 18 products of three floats.
+    ++stats.exactSigns;
+    Expansion x;
+    addTriple(x, d, a, b);
+    addTriple(x, d, b, o);
+    addTriple(x, d, o, a);
+    return x.sign();
+}
+
+bool robustRayCrossing(const Vec3& o, const Vec3& d, const Vec3& a, const Vec3& b, const Vec3& c, double& t,
+    RobustRayStats& stats)
+{
+    const int s0 = perturbedSide(o, d, b, c, stats);
+    if (s0 == 0)
+        return false;
+    if (perturbedSide(o, d, c, a, stats) != s0 || perturbedSide(o, d, a, b, stats) != s0)
+        return false;
+    const double e1x = static_cast<double>(b.x) - a.x, e1y = static_cast<double>(b.y) - a.y, e1z = static_cast<double>(b.z) - a.z;
+    const double e2x = static_cast<double>(c.x) - a.x, e2y = static_cast<double>(c.y) - a.y, e2z = static_cast<double>(c.z) - a.z;
+    const double nx = e1y * e2z - e1z * e2y, ny = e1z * e2x - e1x * e2z, nz = e1x * e2y - e1y * e2x;
+    const double dn = d.x * nx + d.y * ny + d.z * nz;
+    if (dn == 0.)
+        return false;  // three equal signs imply d · n != 0 exactly; only rounding gets here
+    t = ((static_cast<double>(a.x) - o.x) * nx + (static_cast<double>(a.y) - o.y) * ny + (static_cast<double>(a.z) - o.z) * nz) / dn;
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef ROBUST_RAY_H
+#define ROBUST_RAY_H
+
+#include "stl_reader.h"
+#include <cstdint>
+
+/** Exact-parity ray crossings for FluidOptions::robust. A ray o + t * d passes through triangle (a, b, c) when
+ *  the three edge determinants d · ((p - o) × (q - o)) over its edges (p, q) share one strict sign. Each sign
+ *  comes from a float evaluation when the value clears its forward error bound, else from double with its
+ *  own bound, else from exact floating-point expansions. A zero determinant (the ray through an edge or a
+ *  vertex) takes the sign it has after a fixed infinitesimal shift of the origin, the same shift for every
+ *  triangle. Neighbours see the same shifted ray: a ray through a shared edge or vertex crosses one triangle
+ *  where the surface passes through it and none or two where it folds back, so the crossing count of a closed
+ *  mesh with shared vertex coordinates has the exact parity. Degenerate triangles and triangles parallel to the
+ *  ray are never crossed. */
+
+/** Which stage settled the edge signs, summed for --profile. */
+struct RobustRayStats {
+    uint64_t floatSigns = 0;
+    uint64_t doubleSigns = 0;
+    uint64_t exactSigns = 0;
+};
+
+/** Whether o + t * d crosses triangle (a, b, c), either orientation. On a crossing t is its ray parameter in
+ *  double (rounded, unlike the crossing decision itself). */
+bool robustRayCrossing(const StlReader::Vec3& o, const StlReader::Vec3& d, const StlReader::Vec3& a,
+    const StlReader::Vec3& b, const StlReader::Vec3& c, double& t, RobustRayStats& stats);
+
+/** The exact sign (-1, 0 or 1) of d · ((a - o) × (b - o)), without the tie-breaking shift. */
+int rayEdgeOrientation(const StlReader::Vec3& o, const StlReader::Vec3& d, const StlReader::Vec3& a,
+    const StlReader::Vec3& b, RobustRayStats& stats);
+
+#endif
@@ -1,80 +1,412 @@
 #include "stl_reader.h"
+#include "arena.h"
+#include "ascii_stl.h"
+#include "bvh.h"
+#include "compressed_io.h"
+#include "even_hit_cache.h"
+#include "gpu_raycast.h"
+#include "mapped_file.h"
+#include "mesh_components.h"
+#include "mesh_topology.h"
+#include "morton.h"
+#include "parallel.h"
+#include "profile.h"
+#include "ray_kernel.h"
+#include "robust_ray.h"
+#include "vertex_weld.h"
+#include "winding_number.h"
 #include <algorithm>
-#include <array>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
-#include <map>
+#include <limits>
+#include <memory>
+#include <istream>
 #include <ostream>
-#include <set>
+#include <streambuf>
+#include <stdexcept>
 #include <utility>
 
 namespace {
-std::pair<size_t, size_t> edgeKey(size_t a, size_t b) {
-    return {std::min(a, b), std::max(a, b)};
+const size_t kBinaryHeaderSize = 84;   // 80-byte header + uint32 triangle count
+const size_t kBinaryRecordSize = 50;   // normal, 3 vertices (12 floats), uint16 attribute
+const size_t kFacetBytes = 48;         // the 12 floats, laid out like Triangle
+const uint32_t kMaxBinaryTriangles = 100000000;
+
+bool isAsciiStl(const unsigned char* data, size_t size) {
+    return size >= 5 && std::memcmp(data, "solid", 5) == 0;
+}
+
+// Triangle count of an in-memory binary STL; false if the header is missing, the count is over the limit,
+// or the data is too short to hold every record.
+bool binaryTriangleCount(const unsigned char* data, size_t size, size_t& n) {
+    if (size < kBinaryHeaderSize) return false;
+    uint32_t count;
+    std::memcpy(&count, data + 80, 4);
+    if (count > kMaxBinaryTriangles) return false;
+    if ((size - kBinaryHeaderSize) / kBinaryRecordSize < count) return false;
+    n = count;
+    return true;
+}
+
+// Read-only istream over bytes in memory, for the line parser without copying the buffer.
+class MemoryStreamBuf : public std::streambuf {
+public:
+    MemoryStreamBuf(const unsigned char* data, size_t size) {
+        char* p = const_cast<char*>(reinterpret_cast<const char*>(data));
+        setg(p, p, p + size);
+    }
+};
+// Binary header text: must not start with "solid" or readers (including this one) take the file for ASCII. A name
+// read from one of our binary headers keeps its prefix, so rewriting a file does not stack prefixes.
+std::string binaryHeaderText(const std::string& name) {
+    const std::string prefix = "binary STL ";
+    std::string h = name.compare(0, prefix.size(), prefix) == 0 ? name : prefix + name;
+    h.resize(80, '\0');
+    return h;
+}
+
+// Write a binary STL of n facets, facet(i) giving triangle i. Records are assembled in a buffer and written in
+// large blocks rather than one stream call per field.
+template <class FacetFn>
+bool writeBinaryRecords(const std::string& path, const std::string& name, size_t n, FacetFn&& facet) {
+    if (n > 0xFFFFFFFFull) return false;
+    CompressedWriter f;
+    if (!f.open(path)) return false;
+    const std::string header = binaryHeaderText(name);
+    const uint32_t count = static_cast<uint32_t>(n);
+    bool ok = f.write(header.data(), 80) && f.write(&count, 4);
+    const size_t kBlockRecords = 1 << 16;  // 3.2 MB per write
+    std::vector<char> buf(std::min(n, kBlockRecords) * kBinaryRecordSize);
+    for (size_t first = 0; first < n && ok; first += kBlockRecords) {
+        const size_t m = std::min(kBlockRecords, n - first);
+        char* p = buf.data();
+        for (size_t i = 0; i < m; ++i, p += kBinaryRecordSize) {
+            const StlReader::Triangle t = facet(first + i);
+            std::memcpy(p, &t, kFacetBytes);
+            p[48] = 0; p[49] = 0;
+        }
+        ok = f.write(buf.data(), m * kBinaryRecordSize);
+    }
+    return f.close() && ok;
+}
+
+// Solid name for output: header text without trailing padding, or "triangles" if empty.
+std::string solidName(const std::string& header) {
+    std::string name = header;
+    while (!name.empty() && (name.back() == '\0' || name.back() == ' '))
+        name.pop_back();
+    if (name.empty())
+        name = "triangles";
+    return name;
+}
+
+typedef std::vector<std::pair<float, size_t>> RayHits;
+
+float axisComponent(const StlReader::Vec3& p, int axis) {
+    return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+}
+
+// The welded mesh behind the slots of soa when FluidOptions::robust replaces the float kernel by
+// robustRayCrossing(), with one worker's tally of which stage settled the signs.
+struct RobustCast {
+    const std::vector<StlReader::Vec3>* vertices = nullptr;
+    const std::vector<StlReader::IndexedTri>* triangles = nullptr;
+    RobustRayStats stats;
+
+    bool crosses(size_t k, const StlReader::Vec3& ro, const StlReader::Vec3& rd, double& t) {
+        const StlReader::IndexedTri& tri = (*triangles)[k];
+        return robustRayCrossing(ro, rd, (*vertices)[tri.v0], (*vertices)[tri.v1], (*vertices)[tri.v2], t, stats);
+    }
+};
+
+// Hits of the ray ro + t * rd with t > tMin, skipping triangle `self`, sorted by t. With no BVH every slot of
+// soa is tested in index order (brute force). tests is incremented by the number of ray-triangle tests. With
+// robust the crossings are decided exactly and the BVH is traversed conservatively.
+void castRay(const TriangleSoA& soa, const Bvh* accel, const StlReader::Vec3& ro, const StlReader::Vec3& rd,
+    size_t self, float tMin, RayHits& hits, uint64_t& tests, RobustCast* robust = nullptr) {
+    const float o[3] = { ro.x, ro.y, ro.z };
+    const float d[3] = { rd.x, rd.y, rd.z };
+    hits.clear();
+    auto testBlock = [&](size_t first, size_t count) {
+        tests += count;
+        if (robust) {
+            for (size_t b = 0; b < count; ++b) {
+                const size_t k = soa.ids[first + b];
+                double t;
+                if (k != self && robust->crosses(k, ro, rd, t) && t > tMin)
+                    hits.push_back({ static_cast<float>(t), k });
+            }
+            return;
+        }
+        float t[kRayBlock];
+        unsigned mask = intersectRayBlock(soa, first, count, o, d, t);
+        for (size_t b = 0; mask; ++b, mask >>= 1) {
+            if (!(mask & 1u)) continue;
+            const size_t k = soa.ids[first + b];
+            if (k != self && t[b] > tMin)
+                hits.push_back({ t[b], k });
+        }
+    };
+    if (!accel) {
+        for (size_t k = 0; k < soa.size(); k += kRayBlock)
+            testBlock(k, std::min(kRayBlock, soa.size() - k));
+    } else {
+        accel->traverse(ro, rd, [&](uint32_t first, uint32_t count) {
+            for (uint32_t c = 0; c < count; c += kRayBlock)
+                testBlock(first + c, std::min<size_t>(kRayBlock, count - c));
+        }, robust != nullptr);
+    }
+    std::sort(hits.begin(), hits.end());
+}
+
+// Whether the ray ro + t * rd hits any triangle other than `self` with t > tMin; stops at the first such hit.
+bool anyHit(const TriangleSoA& soa, const Bvh* accel, const StlReader::Vec3& ro, const StlReader::Vec3& rd,
+    size_t self, float tMin, uint64_t& tests, RobustCast* robust = nullptr) {
+    const float o[3] = { ro.x, ro.y, ro.z };
+    const float d[3] = { rd.x, rd.y, rd.z };
+    auto testBlock = [&](size_t first, size_t count) {
+        tests += count;
+        if (robust) {
+            for (size_t b = 0; b < count; ++b) {
+                const size_t k = soa.ids[first + b];
+                double t;
+                if (k != self && robust->crosses(k, ro, rd, t) && t > tMin)
+                    return true;
+            }
+            return false;
+        }
+        float t[kRayBlock];
+        unsigned mask = intersectRayBlock(soa, first, count, o, d, t);
+        for (size_t b = 0; mask; ++b, mask >>= 1) {
+            if ((mask & 1u) && soa.ids[first + b] != self && t[b] > tMin)
+                return true;
+        }
+        return false;
+    };
+    if (!accel) {
+        for (size_t k = 0; k < soa.size(); k += kRayBlock)
+            if (testBlock(k, std::min(kRayBlock, soa.size() - k)))
+                return true;
+        return false;
+    }
+    return accel->traverseUntil(ro, rd, [&](uint32_t first, uint32_t count) {
+        for (uint32_t c = 0; c < count; c += kRayBlock)
+            if (testBlock(first + c, std::min<size_t>(kRayBlock, count - c)))
+                return true;
+        return false;
+    }, robust != nullptr);
 }
 } // namespace
 
+static_assert(sizeof(StlReader::Triangle) == kFacetBytes, "Triangle must match the binary STL facet layout");
+
 bool StlReader::read(const std::string& path) 
 {
-    triangles_.clear();
-    header_.clear();
-    std::ifstream f(path, std::ios::binary);
-    if (!f) 
+    return read(path, ReadOptions());
+}
+
+bool StlReader::readAsciiLines(std::istream& f)
+{
+    std::string line;
+    if (!std::getline(f, line))
         return false;
-    char buf[6] = {};
-    f.read(buf, 5);
-    f.seekg(0);
-    bool ascii = (std::strncmp(buf, "solid", 5) == 0);
-    if (ascii) 
-    {
-        std::string line;
-        if (!std::getline(f, line))
-            return false;
-        header_ = line;
-        while (std::getline(f, line)) 
+    header_ = line;
+    while (std::getline(f, line)) 
+    {
+        size_t fn = line.find("facet normal");
+        if (fn != std::string::npos) 
         {
-            size_t fn = line.find("facet normal");
-            if (fn != std::string::npos) 
+            Triangle t;
+            float x, y, z;
+            if (sscanf(line.c_str() + fn, "facet normal %f %f %f", &x, &y, &z) != 3) continue;
+            t.normal.x = x; t.normal.y = y; t.normal.z = z;
+            std::getline(f, line); // outer loop
+            for (Vec3* v : {&t.v0, &t.v1, &t.v2}) 
             {
-                Triangle t;
-                float x, y, z;
-                if (sscanf(line.c_str() + fn, "facet normal %f %f %f", &x, &y, &z) != 3) continue;
-                t.normal.x = x; t.normal.y = y; t.normal.z = z;
-                std::getline(f, line); // outer loop
-                for (Vec3* v : {&t.v0, &t.v1, &t.v2}) 
-                {
-                    if (!std::getline(f, line))
-                        return false;
-                    size_t vx = line.find("vertex");
-                    if (vx == std::string::npos || sscanf(line.c_str() + vx, "vertex %f %f %f", &v->x, &v->y, &v->z) != 3) return false;
-                }
-                std::getline(f, line); // endloop
-                std::getline(f, line); // endfacet
-                triangles_.push_back(t);
+                if (!std::getline(f, line))
+                    return false;
+                size_t vx = line.find("vertex");
+                if (vx == std::string::npos || sscanf(line.c_str() + vx, "vertex %f %f %f", &v->x, &v->y, &v->z) != 3) return false;
             }
+            std::getline(f, line); // endloop
+            std::getline(f, line); // endfacet
+            triangles_.push_back(t);
         }
-        return !triangles_.empty();
     }
+    return !triangles_.empty();
+}
 
-    char h[80];
-    f.read(h, 80);
-    header_.assign(h, 80);
-    uint32_t n;
-    f.read(reinterpret_cast<char*>(&n), 4);
-    if (!f || n > 100000000)
+bool StlReader::read(const std::string& path, const ReadOptions& opts)
+{
+    MappedFile map;
+    if (!map.open(path))
+    {
+        triangles_.clear();
+        header_.clear();
         return false;
+    }
+    return read(map.data(), map.size(), opts);
+}
+
+bool StlReader::read(const void* data, size_t size)
+{
+    return read(data, size, ReadOptions());
+}
+
+bool StlReader::read(const void* data, size_t size, const ReadOptions& opts)
+{
+    triangles_.clear();
+    header_.clear();
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    if (!inflateInput(bytes, size))
+        return false;
+    if (isAsciiStl(bytes, size))
+    {
+        if (!opts.fastAscii)
+        {
+            MemoryStreamBuf buf(bytes, size);
+            std::istream in(&buf);
+            return readAsciiLines(in);
+        }
+        return parseAsciiStl(reinterpret_cast<const char*>(bytes), size, header_, triangles_, opts.threads)
+            && !triangles_.empty();
+    }
+
+    size_t n;
+    if (!binaryTriangleCount(bytes, size, n))
+        return false;
+    header_.assign(reinterpret_cast<const char*>(bytes), 80);
     triangles_.resize(n);
-    for (uint32_t i = 0; i < n; ++i)
+    const unsigned char* rec = bytes + kBinaryHeaderSize;
+    for (size_t i = 0; i < n; ++i, rec += kBinaryRecordSize)
+        std::memcpy(&triangles_[i], rec, kFacetBytes);
+    return true;
+}
+
+bool StlReader::read(std::istream& in)
+{
+    return read(in, ReadOptions());
+}
+
+bool StlReader::read(std::istream& in, const ReadOptions& opts)
+{
+    return readStream(in) && read(streamBuffer_.data(), streamBuffer_.size(), opts);
+}
+
+bool StlReader::readIndexed(const std::string& path)
+{
+    return readIndexed(path, ReadOptions());
+}
+
+bool StlReader::readIndexed(const std::string& path, const ReadOptions& opts)
+{
+    MappedFile map;
+    if (!map.open(path))
+        return false;
+    return readIndexed(map.data(), map.size(), opts);
+}
+
+bool StlReader::readIndexed(const void* data, size_t size)
+{
+    return readIndexed(data, size, ReadOptions());
+}
+
+bool StlReader::readIndexed(const void* data, size_t size, const ReadOptions& opts)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    if (!inflateInput(bytes, size))
+        return false;
+    if (isAsciiStl(bytes, size))
+    {
+        if (!read(bytes, size, opts))
+            return false;
+        removeDuplicateVertices();
+    }
+    else
     {
-        f.read(reinterpret_cast<char*>(&triangles_[i].normal.x), 12);
-        f.read(reinterpret_cast<char*>(&triangles_[i].v0.x), 12);
-        f.read(reinterpret_cast<char*>(&triangles_[i].v1.x), 12);
-        f.read(reinterpret_cast<char*>(&triangles_[i].v2.x), 12);
-        f.ignore(2);
+        size_t n;
+        if (!binaryTriangleCount(bytes, size, n))
+            return false;
+        header_.assign(reinterpret_cast<const char*>(bytes), 80);
+        triangles_.clear();
+        indexFacets(bytes + kBinaryHeaderSize, kBinaryRecordSize, n);
     }
-    return !!f;
+    weldVertices(opts.weldEpsilon, opts.threads);
+    if (opts.spatialOrder)
+        reorderSpatially(opts.threads);
+    return true;
+}
+
+bool StlReader::readIndexed(std::istream& in)
+{
+    return readIndexed(in, ReadOptions());
+}
+
+bool StlReader::readIndexed(std::istream& in, const ReadOptions& opts)
+{
+    return readStream(in) && readIndexed(streamBuffer_.data(), streamBuffer_.size(), opts);
+}
+
+bool StlReader::readStream(std::istream& in)
+{
+    const size_t kChunk = size_t(1) << 20;
+    streamBuffer_.clear();
+    for (;;)
+    {
+        const size_t used = streamBuffer_.size();
+        streamBuffer_.resize(used + kChunk);
+        in.read(reinterpret_cast<char*>(streamBuffer_.data() + used), static_cast<std::streamsize>(kChunk));
+        streamBuffer_.resize(used + static_cast<size_t>(in.gcount()));
+        if (!in)
+            return !in.bad();
+    }
+}
+
+bool StlReader::inflateInput(const unsigned char*& bytes, size_t& size)
+{
+    const Compression codec = compressionOfData(bytes, size);
+    if (codec == Compression::None)
+        return true;
+    // Into a fresh vector: bytes may be the previous contents of inflated_.
+    std::vector<unsigned char> plain;
+    if (!decompress(bytes, size, codec, plain))
+        return false;
+    inflated_.swap(plain);
+    bytes = inflated_.data();
+    size = inflated_.size();
+    return true;
+}
+
+void StlReader::reset()
+{
+    header_.clear();
+    triangles_.clear();
+    vertices_.clear();
+    indexedTriangles_.clear();
+    originalFacetNormals_.clear();
+    triangleIds_.clear();
+    streamBuffer_.clear();
+    inflated_.clear();
+    dropDerived();
+}
+
+void StlReader::takeMesh(std::vector<Vec3>& vertices, std::vector<IndexedTri>& triangles)
+{
+    vertices.clear();
+    triangles.clear();
+    vertices.swap(vertices_);
+    triangles.swap(indexedTriangles_);
+    reset();
+}
+
+void StlReader::dropDerived()
+{
+    bvh_.reset();
+    std::atomic_store(&topology_, std::shared_ptr<const MeshTopology>());
+    std::atomic_store(&components_, std::shared_ptr<const MeshComponents>());
+    invalidateGeometry();
 }
 
 void StlReader::checkRightHandWinding(std::ostream& out) const 
@@ -82,55 +414,194 @@ void StlReader::checkRightHandWinding(std::ostream& out) const
     if (originalFacetNormals_.size() != indexedTriangles_.size())
         return;
     
-    size_t ok = 0, wrong = 0;
+    size_t ok = 0;
     const float tol = 1e-5f;
+    const std::vector<Vec3>& normals = geometry().normals;
+    const std::vector<Vec3>& reference = originalFacetNormals_;
+    std::vector<std::pair<size_t, float>> wrong;  // (input triangle id, dot), listed in input order
     for (size_t i = 0; i < indexedTriangles_.size(); ++i) 
     {
-        Triangle t = getTriangle(i);
-        float ex = t.v1.x - t.v0.x, ey = t.v1.y - t.v0.y, ez = t.v1.z - t.v0.z;
-        float fx = t.v2.x - t.v0.x, fy = t.v2.y - t.v0.y, fz = t.v2.z - t.v0.z;
-        float nx = ey * fz - ez * fy, ny = ez * fx - ex * fz, nz = ex * fy - ey * fx;
-        float len = std::sqrt(nx * nx + ny * ny + nz * nz);
-        if (len <= 0.f)
+        const Vec3& n = normals[i];
+        if (n.x * n.x + n.y * n.y + n.z * n.z <= 0.f)  // zero-area triangle: no direction to compare
             continue;
-        nx /= len; ny /= len; nz /= len;
-        const Vec3& orig = originalFacetNormals_[i];
-        float dot = nx * orig.x + ny * orig.y + nz * orig.z;
+        const Vec3& orig = reference[i];
+        float dot = n.x * orig.x + n.y * orig.y + n.z * orig.z;
         if (dot > tol) 
             ++ok;
         else if (dot < -tol) 
-        { 
-            ++wrong; out << "  triangle " << i << " opposite winding (dot=" << dot << ")\n";
-        }
+            wrong.push_back({ originalTriangleId(i), dot });
     }
-    out << "Right-hand rule: " << ok << " OK, " << wrong << " opposite winding\n";
+    if (!triangleIds_.empty())
+        std::sort(wrong.begin(), wrong.end());
+    for (const auto& w : wrong)
+        out << "  triangle " << w.first << " opposite winding (dot=" << w.second << ")\n";
+    out << "Right-hand rule: " << ok << " OK, " << wrong.size() << " opposite winding\n";
+}
+
+void StlReader::setTriangles(const std::vector<Triangle>& triangles, const std::string& header)
+{
+    header_ = header;
+    triangles_.clear();
+    indexFacets(reinterpret_cast<const unsigned char*>(triangles.data()), sizeof(Triangle), triangles.size());
 }
 
 void StlReader::removeDuplicateVertices() 
 {
-    originalFacetNormals_.resize(triangles_.size());
-    for (size_t i = 0; i < triangles_.size(); ++i)
+    indexFacets(reinterpret_cast<const unsigned char*>(triangles_.data()), sizeof(Triangle), triangles_.size());
+    triangles_.clear();
+}
+
+const MeshTopology& StlReader::topology() const
+{
+    std::shared_ptr<const MeshTopology> t = std::atomic_load(&topology_);
+    if (!t)
+    {
+        auto built = std::make_shared<MeshTopology>();
+        built->build(indexedTriangles_);
+        t = built;
+        std::shared_ptr<const MeshTopology> expected;
+        if (!std::atomic_compare_exchange_strong(&topology_, &expected, t))
+            t = expected;
+    }
+    return *t;
+}
+
+const MeshComponents& StlReader::components() const
+{
+    std::shared_ptr<const MeshComponents> c = std::atomic_load(&components_);
+    if (!c)
     {
-        originalFacetNormals_[i] = triangles_[i].normal;
+        auto built = std::make_shared<MeshComponents>();
+        built->build(vertices_, indexedTriangles_);
+        c = built;
+        std::shared_ptr<const MeshComponents> expected;
+        if (!std::atomic_compare_exchange_strong(&components_, &expected, c))
+            c = expected;
     }
+    return *c;
+}
+
+void StlReader::indexFacets(const unsigned char* facets, size_t stride, size_t n)
+{
+    if (n > std::numeric_limits<Index>::max())
+        throw std::length_error("StlReader: more triangles than StlReader::Index can number");
+    originalFacetNormals_.resize(n);
+    triangleIds_.clear();
     vertices_.clear();
     indexedTriangles_.clear();
-    std::map<Vec3, size_t> idx;
-    auto id = [&](const Vec3& v)
-    {
-        auto it = idx.find(v);
-        if (it != idx.end())
-            return it->second;
-        size_t i = vertices_.size();
-        idx[v] = i;
-        vertices_.push_back(v);
-        return i;
-    };
-    for (const Triangle& t : triangles_)
+    indexedTriangles_.reserve(n);
+    dropDerived();
+    ArenaScope scratch(threadArena());
+    VertexWelder welder(n / 2 + 16, &scratch.arena());  // closed meshes have about half as many vertices as triangles
+    if (vertices_.capacity() >= welder.vertices().capacity())
+        welder.vertices().swap(vertices_);  // a reused reader keeps its vertex table, already paged in
+    for (size_t i = 0; i < n; ++i, facets += stride)
     {
-        indexedTriangles_.push_back({ id(t.v0), id(t.v1), id(t.v2) });
+        Triangle t;
+        std::memcpy(&t, facets, kFacetBytes);
+        originalFacetNormals_[i] = t.normal;
+        const Index a = static_cast<Index>(welder.insert(t.v0)), b = static_cast<Index>(welder.insert(t.v1)),
+            c = static_cast<Index>(welder.insert(t.v2));
+        indexedTriangles_.push_back({ a, b, c });
     }
-    triangles_.clear();
+    vertices_ = std::move(welder.vertices());
+}
+
+size_t StlReader::weldVertices(float epsilon, unsigned threads)
+{
+    if (!(epsilon > 0.f) || vertices_.size() < 2)
+        return 0;
+    ProfileScope scope("weld_epsilon");
+    std::vector<Index> remap;
+    const size_t unique = weldWithinEpsilon(vertices_, epsilon, threads, remap);
+    const size_t merged = vertices_.size() - unique;
+    scope.count("vertices_in", vertices_.size());
+    scope.count("vertices_merged", merged);
+    if (merged == 0)
+        return 0;
+    // Representatives (the first vertex of each group) keep their relative order, so the table compacts in place.
+    for (size_t v = 0, next = 0; v < vertices_.size(); ++v)
+        if (remap[v] == next)
+            vertices_[next++] = vertices_[v];
+    vertices_.resize(unique);
+    for (IndexedTri& t : indexedTriangles_)
+    {
+        t.v0 = remap[t.v0];
+        t.v1 = remap[t.v1];
+        t.v2 = remap[t.v2];
+    }
+    dropDerived();
+    return merged;
+}
+
+void StlReader::reorderSpatially(unsigned threads)
+{
+    const size_t nv = vertices_.size(), nt = indexedTriangles_.size();
+    if (nt == 0)
+        return;
+    ProfileScope scope("reorder");
+    scope.count("vertices", nv);
+    scope.count("triangles", nt);
+    std::vector<Index> order, newId(nv);
+    mortonOrder(vertices_, threads, order);
+    {
+        std::vector<Vec3> sorted(nv);
+        for (size_t k = 0; k < nv; ++k)
+        {
+            sorted[k] = vertices_[order[k]];
+            newId[order[k]] = static_cast<Index>(k);
+        }
+        vertices_.swap(sorted);
+    }
+    std::vector<Vec3> centroids(nt);
+    for (size_t i = 0; i < nt; ++i)
+    {
+        IndexedTri& t = indexedTriangles_[i];
+        t = { newId[t.v0], newId[t.v1], newId[t.v2] };
+        const Vec3& a = vertices_[t.v0];
+        const Vec3& b = vertices_[t.v1];
+        const Vec3& c = vertices_[t.v2];
+        centroids[i] = { (a.x + b.x + c.x) / 3.f, (a.y + b.y + c.y) / 3.f, (a.z + b.z + c.z) / 3.f };
+    }
+    mortonOrder(centroids, threads, order);
+    std::vector<IndexedTri> tris(nt);
+    std::vector<Index> ids(nt);
+    for (size_t k = 0; k < nt; ++k)
+    {
+        tris[k] = indexedTriangles_[order[k]];
+        ids[k] = triangleIds_.empty() ? order[k] : triangleIds_[order[k]];
+    }
+    indexedTriangles_.swap(tris);
+    triangleIds_.swap(ids);
+    if (originalFacetNormals_.size() == nt)
+    {
+        for (size_t k = 0; k < nt; ++k)
+            centroids[k] = originalFacetNormals_[order[k]];
+        originalFacetNormals_.swap(centroids);
+    }
+    dropDerived();
+}
+
+void StlReader::buildBvh()
+{
+    auto b = std::make_shared<Bvh>();
+    b->build(vertices_, indexedTriangles_);
+    bvh_ = b;
+}
+
+StlReader::Vec3 StlReader::facetNormal(const Vec3& a, const Vec3& b, const Vec3& c)
+{
+    float ex = b.x - a.x, ey = b.y - a.y, ez = b.z - a.z;
+    float fx = c.x - a.x, fy = c.y - a.y, fz = c.z - a.z;
+    Vec3 n = { ey * fz - ez * fy, ez * fx - ex * fz, ex * fy - ey * fx };
+    float len = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+    if (len > 0.f)
+    {
+        n.x /= len;
+        n.y /= len;
+        n.z /= len;
+    }
+    return n;
 }
 
 StlReader::Triangle StlReader::getTriangle(size_t i) const 
@@ -140,21 +611,55 @@ StlReader::Triangle StlReader::getTriangle(size_t i) const
     t.v0 = vertices_[id.v0];
     t.v1 = vertices_[id.v1];
     t.v2 = vertices_[id.v2];
-    float ex = t.v1.x - t.v0.x, ey = t.v1.y - t.v0.y, ez = t.v1.z - t.v0.z;
-    float fx = t.v2.x - t.v0.x, fy = t.v2.y - t.v0.y, fz = t.v2.z - t.v0.z;
-    t.normal.x = ey * fz - ez * fy;
-    t.normal.y = ez * fx - ex * fz;
-    t.normal.z = ex * fy - ey * fx;
-    float len = std::sqrt(t.normal.x * t.normal.x + t.normal.y * t.normal.y + t.normal.z * t.normal.z);
-    if (len > 0.f)
-    { 
-        t.normal.x /= len; 
-        t.normal.y /= len; 
-        t.normal.z /= len;
-    }
+    t.normal = facetNormal(t.v0, t.v1, t.v2);
     return t;
 }
 
+StlReader::Triangle StlReader::cachedTriangle(size_t i, const TriangleGeometry& g) const
+{
+    const IndexedTri& id = indexedTriangles_[i];
+    return { g.normals[i], vertices_[id.v0], vertices_[id.v1], vertices_[id.v2] };
+}
+
+const StlReader::TriangleGeometry& StlReader::geometry() const
+{
+    std::shared_ptr<const TriangleGeometry> g = std::atomic_load(&geometry_);
+    if (!g)
+    {
+        const size_t n = indexedTriangles_.size();
+        auto built = std::make_shared<TriangleGeometry>();
+        built->normals.resize(n);
+        built->edge1.resize(n);
+        built->edge2.resize(n);
+        built->centroids.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            const IndexedTri& id = indexedTriangles_[i];
+            const Vec3& a = vertices_[id.v0], b = vertices_[id.v1], c = vertices_[id.v2];
+            built->normals[i] = facetNormal(a, b, c);
+            built->edge1[i] = { b.x - a.x, b.y - a.y, b.z - a.z };
+            built->edge2[i] = { c.x - a.x, c.y - a.y, c.z - a.z };
+            built->centroids[i] = { (a.x + b.x + c.x) / 3.f, (a.y + b.y + c.y) / 3.f, (a.z + b.z + c.z) / 3.f };
+        }
+        g = built;
+        std::shared_ptr<const TriangleGeometry> expected;
+        if (!std::atomic_compare_exchange_strong(&geometry_, &expected, g))
+            g = expected;
+    }
+    return *g;
+}
+
+void StlReader::invalidateGeometry()
+{
+    std::atomic_store(&geometry_, std::shared_ptr<const TriangleGeometry>());
+}
+
+void StlReader::rebuildGeometry()
+{
+    invalidateGeometry();
+    geometry();
+}
+
 double StlReader::volume() const 
 {
     double sum = 0;
@@ -169,87 +674,71 @@ double StlReader::volume() const
 bool StlReader::volumeFromFile(const std::string& path, double& outVolume) 
 {
     StlReader r;
-    if (!r.read(path)) return false;
-    r.removeDuplicateVertices();
+    if (!r.readIndexed(path)) return false;
     outVolume = r.volume();
     return true;
 }
 
 void StlReader::writeOneFacet(std::ostream& f, const Triangle& t) 
 {
-    f << "  facet normal " << t.normal.x << " " << t.normal.y << " " << t.normal.z << "\n";
-    f << "    outer loop\n";
-    f << "      vertex " << t.v0.x << " " << t.v0.y << " " << t.v0.z << "\n";
-    f << "      vertex " << t.v1.x << " " << t.v1.y << " " << t.v1.z << "\n";
-    f << "      vertex " << t.v2.x << " " << t.v2.y << " " << t.v2.z << "\n";
-    f << "    endloop\n  endfacet\n";
+    std::string text;
+    appendAsciiFacet(text, t);
+    f.write(text.data(), static_cast<std::streamsize>(text.size()));
 }
 
-bool StlReader::writeAsciiStl(const std::string& path) const 
+bool StlReader::writeAsciiStl(const std::string& path, unsigned threads) const 
 {
-    std::ofstream f(path);
-    if (!f)
-        return false;
-    std::string name = header_;
-    while (!name.empty() && (name.back() == '\0' || name.back() == ' '))
-        name.pop_back();
-    if (name.empty())
-        name = "triangles";
-    f << "solid " << name << "\n";
-    for (size_t i = 0; i < indexedTriangles_.size(); ++i)
-        writeOneFacet(f, getTriangle(i));
-    f << "endsolid " << name << "\n";
-    return !!f;
+    const TriangleGeometry& g = geometry();
+    return writeAsciiStlFile(path, solidName(header_), indexedTriangles_.size(),
+        [&](size_t i) { return cachedTriangle(i, g); }, threads);
 }
 
 bool StlReader::writeAsciiStl(const std::string& path, const std::vector<size_t>& onlyIndices) const 
 {
-    std::ofstream f(path);
-    if (!f)
-        return false;
-    f << "solid even_hits\n";
+    std::vector<size_t> valid;
+    valid.reserve(onlyIndices.size());
     for (size_t k : onlyIndices)
-        if (k < indexedTriangles_.size()) writeOneFacet(f, getTriangle(k));
-    f << "endsolid even_hits\n";
-    return !!f;
+        if (k < indexedTriangles_.size()) valid.push_back(k);
+    return writeAsciiStlFile(path, "even_hits", valid.size(), [&](size_t i) { return getTriangle(valid[i]); }, 0);
+}
+
+bool StlReader::writeBinaryStl(const std::string& path) const
+{
+    const TriangleGeometry& g = geometry();
+    return writeBinaryRecords(path, solidName(header_), indexedTriangles_.size(),
+        [&](size_t i) { return cachedTriangle(i, g); });
 }
 
 void StlReader::addCaps(const std::vector<size_t>& triangleIndices, std::vector<Triangle>& outTriangles) const 
 {
+    size_t loops;
+    addCaps(triangleIndices, outTriangles, loops);
+}
+
+void StlReader::addCaps(const std::vector<size_t>& triangleIndices, std::vector<Triangle>& outTriangles, size_t& loops) const
+{
+    ProfileScope scope("cap_loops");
+    loops = 0;
+    ArenaScope scratch(threadArena());
+    MeshTopology topo(&scratch.arena());
+    topo.build(indexedTriangles_, triangleIndices);
+    const ScratchVector<MeshTopology::HalfEdge>& boundaryEdges = topo.boundaryEdges();
+
+    // A loop of k boundary edges gets at most k caps.
     outTriangles.clear();
+    outTriangles.reserve(triangleIndices.size() + boundaryEdges.size());
+    const TriangleGeometry& g = geometry();
     for (size_t i : triangleIndices)
         if (i < indexedTriangles_.size())
-            outTriangles.push_back(getTriangle(i));
-
-    if (vertices_.empty()) return;
-
-    struct DirectedEdge { size_t from, to, triIdx; };
-    std::map<std::pair<size_t, size_t>, std::vector<DirectedEdge>> edgeToDirected;
-    for (size_t ti : triangleIndices) 
-    {
-        if (ti >= indexedTriangles_.size()) continue;
-        const IndexedTri& id = indexedTriangles_[ti];
-        size_t v0 = id.v0, v1 = id.v1, v2 = id.v2;
-        edgeToDirected[edgeKey(v0, v1)].push_back({ v0, v1, ti });
-        edgeToDirected[edgeKey(v1, v2)].push_back({ v1, v2, ti });
-        edgeToDirected[edgeKey(v2, v0)].push_back({ v2, v0, ti });
-    }
-    std::vector<DirectedEdge> boundaryEdges;
-    for (const auto& kv : edgeToDirected) 
-    {
-        if (kv.second.size() != 1) continue;
-        boundaryEdges.push_back({ kv.second[0].from, kv.second[0].to, kv.second[0].triIdx });
-    }
+            outTriangles.push_back(cachedTriangle(i, g));
+    scope.count("boundary_edges", boundaryEdges.size());
     if (boundaryEdges.empty()) return;
+    const size_t subsetSize = outTriangles.size();
 
-    std::set<std::pair<size_t, size_t>> used;
-    std::map<size_t, std::vector<std::pair<size_t, size_t>>> nextMap;
-    for (const auto& e : boundaryEdges) 
-        nextMap[e.from].push_back({ e.to, e.triIdx });
-
-    auto capOneLoop = [&](const std::vector<size_t>& loop, size_t triIdxForNormal) 
+    auto capOneLoop = [&](const ScratchVector<Index>& loop, size_t triIdxForNormal) 
     {
         if (loop.size() < 3) return;
+        ++loops;
         float cx = 0, cy = 0, cz = 0;
         for (size_t vi : loop) 
         {
@@ -258,7 +747,7 @@ void StlReader::addCaps(const std::vector<size_t>& triangleIndices, std::vector<
         float n = (float)loop.size();
         cx /= n; cy /= n; cz /= n;
         Vec3 C = { cx, cy, cz };
-        Triangle adjTri = getTriangle(triIdxForNormal);
+        const Vec3& adjNormal = g.normals[triIdxForNormal];
         for (size_t i = 0; i < loop.size(); ++i) 
         {
             size_t a = loop[i], b = loop[(i + 1) % loop.size()];
@@ -269,7 +758,7 @@ void StlReader::addCaps(const std::vector<size_t>& triangleIndices, std::vector<
             float len = std::sqrt(nx * nx + ny * ny + nz * nz);
             if (len <= 1e-10f) continue;
             nx /= len; ny /= len; nz /= len;
-            float dot = nx * adjTri.normal.x + ny * adjTri.normal.y + nz * adjTri.normal.z;
+            float dot = nx * adjNormal.x + ny * adjNormal.y + nz * adjNormal.z;
             Triangle cap;
             cap.v0 = C;
             cap.v1 = dot >= 0.f ? va : vb;
@@ -280,156 +769,470 @@ void StlReader::addCaps(const std::vector<size_t>& triangleIndices, std::vector<
         }
     };
 
+    // Loops are traced over boundaryByFrom(): used marks its edges, next[s] is the first edge out of slot s that
+    // may still be unused and loopPos[s] is the slot's index in the loop being traced (npos when absent). Every
+    // cursor only moves forward, so tracing is linear in the boundary edges. The loops, their order and their
+    // sub-loop splits are those of the original set-based walk, including its stop on reaching vertex 0.
+    const ScratchVector<MeshTopology::HalfEdge>& byFrom = topo.boundaryByFrom();
+    const size_t npos = static_cast<size_t>(-1);
+    Arena* arena = &scratch.arena();
+    ScratchVector<char> used(byFrom.size(), 0, arena);
+    ScratchVector<size_t> next(topo.boundaryVertexCount(), 0, arena), loopPos(topo.boundaryVertexCount(), npos, arena);
+    for (size_t s = 0; s < next.size(); ++s)
+        next[s] = topo.boundaryOutBegin(s);
+    ScratchVector<Index> loop(arena), triOnLoop(arena);
+    ScratchVector<size_t> loopSlots(arena);
+    size_t startCursor = 0;
     for (;;) 
     {
-        size_t from = 0, to = 0, triIdx = 0;
-        bool found = false;
-        for (const auto& e : boundaryEdges) 
-        {
-            if (used.count({ e.from, e.to })) continue;
-            from = e.from; to = e.to; triIdx = e.triIdx; found = true;
-            break;
-        }
-        if (!found) break;
-
-        std::vector<size_t> loop;
-        std::vector<size_t> triOnLoop;
-        size_t start = from;
-        loop.push_back(from);
-        triOnLoop.push_back(triIdx);
-        used.insert({ from, to });
-        loop.push_back(to);
-        triOnLoop.push_back(triIdx);
-        from = to;
-        to = loop.back();
+        while (startCursor < boundaryEdges.size() && used[topo.boundaryPosition(startCursor)])
+            ++startCursor;
+        if (startCursor == boundaryEdges.size()) break;
+
+        const size_t first = topo.boundaryPosition(startCursor);
+        const Index start = byFrom[first].from;
+        Index to = byFrom[first].to;
+        size_t toSlot = topo.boundaryToSlot(first);
+        used[first] = 1;
+        loop.assign({ start, to });
+        triOnLoop.assign({ byFrom[first].tri, byFrom[first].tri });
+        loopSlots.assign({ topo.boundaryFromSlot(first), toSlot });
+        loopPos[loopSlots[0]] = 0;
+        if (toSlot != MeshTopology::kNoSlot) loopPos[toSlot] = 1;
         while (to != start) 
         {
-            size_t nextV = 0, nextTri = 0;
-            for (const auto& p : nextMap[to]) 
-            {
-                if (used.count({ to, p.first })) continue;
-                nextV = p.first; nextTri = p.second; break;
-            }
-            if (nextV == 0) break;
+            // A vertex without outgoing boundary edges can only be the loop's last one, so the walk stops there.
+            if (toSlot == MeshTopology::kNoSlot) break;
+            size_t& p = next[toSlot];
+            const size_t end = topo.boundaryOutBegin(toSlot + 1);
+            while (p < end && used[p]) ++p;
+            if (p == end || byFrom[p].to == 0) break;
 
-            auto it = std::find(loop.begin(), loop.end(), nextV);
-            if (it == loop.end()) 
+            const Index nextV = byFrom[p].to;
+            const size_t nextSlot = topo.boundaryToSlot(p);
+            const size_t idx = nextSlot == MeshTopology::kNoSlot ? npos : loopPos[nextSlot];
+            used[p] = 1;
+            if (idx == npos) 
             {
-                used.insert({ to, nextV });
                 loop.push_back(nextV);
-                triOnLoop.push_back(nextTri);
-                from = to;
+                triOnLoop.push_back(byFrom[p].tri);
+                loopSlots.push_back(nextSlot);
+                if (nextSlot != MeshTopology::kNoSlot) loopPos[nextSlot] = loop.size() - 1;
                 to = nextV;
+                toSlot = nextSlot;
                 continue;
             }
-            if (nextV == start) 
-            {
-                used.insert({ to, nextV });
-                break;
-            }
-            size_t idx = static_cast<size_t>(it - loop.begin());
-            std::vector<size_t> subLoop(loop.begin() + idx, loop.end());
-            used.insert({ to, nextV });
+            if (nextV == start) break;
+            ScratchVector<Index> subLoop(loop.begin() + idx, loop.end(), arena);
             capOneLoop(subLoop, triOnLoop[idx]);
+            for (size_t k = idx + 1; k < loopSlots.size(); ++k)
+                if (loopSlots[k] != MeshTopology::kNoSlot) loopPos[loopSlots[k]] = npos;
             loop.resize(idx + 1);
             triOnLoop.resize(idx + 1);
+            loopSlots.resize(idx + 1);
             to = loop.back();
+            toSlot = loopSlots.back();
         }
         capOneLoop(loop, triOnLoop[0]);
+        for (size_t s : loopSlots)
+            if (s != MeshTopology::kNoSlot) loopPos[s] = npos;
     }
+    scope.count("boundary_loops", loops);
+    scope.count("cap_triangles", outTriangles.size() - subsetSize);
 }
 
 void StlReader::computeFluidMesh(std::vector<Triangle>& outFluid, std::ostream& cleanMeshOut,
     float originOffset, float tMin, float tEps) const
 {
+    FluidOptions opts;
+    opts.originOffset = originOffset;
+    opts.tMin = tMin;
+    opts.tEps = tEps;
+    computeFluidMesh(outFluid, cleanMeshOut, opts);
+}
+
+void StlReader::classifyEvenHit(std::vector<size_t>& evenHitTriangles, const FluidOptions& opts) const
+{
+    ProfileScope scope("even_hit");
+    evenHitTriangles.clear();
+    uint64_t cacheKey = 0;
+    if (!opts.cacheDir.empty())
+    {
+        ProfileScope cacheScope("cache_lookup");
+        cacheKey = evenHitCacheKey(vertices_, indexedTriangles_, opts, opts.threads);
+        if (loadEvenHitCache(opts.cacheDir, cacheKey, indexedTriangles_.size(), evenHitTriangles))
+        {
+            cacheScope.count("hits", 1);
+            scope.count("even_hit_triangles", evenHitTriangles.size());
+            return;
+        }
+        cacheScope.count("misses", 1);
+    }
+    std::shared_ptr<const Bvh> accel = bvh_;
+    if (!opts.bruteForce && !accel)
+    {
+        ProfileScope bvhScope("build_bvh");
+        auto local = std::make_shared<Bvh>();
+        local->build(vertices_, indexedTriangles_);
+        accel = local;
+    }
+    const size_t n = indexedTriangles_.size();
+    // Brute force walks the triangles in index order; the BVH carries its own buffer in leaf order.
+    TriangleSoA flat;
+    if (opts.bruteForce)
+        flat.build(vertices_, indexedTriangles_);
+    const TriangleSoA& soa = opts.bruteForce ? flat : accel->soa();
+    const Bvh* tree = opts.bruteForce ? nullptr : accel.get();
+    const TriangleGeometry& geo = geometry();
+    const unsigned threads = resolveThreadCount(opts.threads);
+    // Per-worker hit scratch, and ray-triangle tests / hits for --profile tallied per worker.
+    std::vector<RayHits> scratch(threads);
+    std::vector<std::pair<uint64_t, uint64_t>> stats(threads);
+    std::vector<RobustCast> robust(opts.robust ? threads : 0);
+    for (RobustCast& r : robust) {
+        r.vertices = &vertices_;
+        r.triangles = &indexedTriangles_;
+    }
+    auto robustFor = [&](unsigned worker) { return opts.robust ? &robust[worker] : nullptr; };
+
+    // label[i]: 1 even-hit, 0 not, negative: still needs its own ray.
+    ArenaScope scratchScope(threadArena());
+    Arena* arena = &scratchScope.arena();
+    ScratchVector<int8_t> label(n, -1, arena);
+    size_t lineCount = 0, lineLabelled = 0, anyHitRays = 0;
+    if (opts.classifier == Classifier::RayReuse && n > 0)
+    {
+        ProfileScope lineScope("lines");
+        // Group by the axis closest to the normal (degenerate triangles keep their own ray), then split each
+        // group into kTiles x kTiles columns by projected centroid. A line along the group's axis only labels
+        // triangles of its own group and column, so columns run in parallel and the labels do not depend on
+        // the thread count. Within a column lines go through the centroid of each triangle not yet labelled.
+        constexpr size_t kTiles = 64;
+        static_assert(3 * kTiles * kTiles <= UINT32_MAX, "column ids must fit uint32_t");
+        float lo[3] = { geo.centroids[0].x, geo.centroids[0].y, geo.centroids[0].z }, hi[3] = { lo[0], lo[1], lo[2] };
+        for (const Vec3& p : vertices_)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], axisComponent(p, a));
+                hi[a] = std::max(hi[a], axisComponent(p, a));
+            }
+        }
+        auto tileIndex = [&](float x, int a) {
+            const float ext = hi[a] - lo[a];
+            const size_t t = ext > 0.f ? static_cast<size_t>((x - lo[a]) / ext * kTiles) : 0;
+            return std::min(t, kTiles - 1);
+        };
+        ScratchVector<int8_t> family(n, -1, arena);
+        ScratchVector<std::pair<uint32_t, Index>> byColumn(arena);  // (column, triangle)
+        byColumn.reserve(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            const float ax = std::fabs(geo.normals[i].x), ay = std::fabs(geo.normals[i].y), az = std::fabs(geo.normals[i].z);
+            if (!(ax + ay + az > 0.f))
+                continue;
+            const int a = ax >= ay && ax >= az ? 0 : (ay >= az ? 1 : 2);
+            family[i] = static_cast<int8_t>(a);
+            const size_t column = (static_cast<size_t>(a) * kTiles + tileIndex(axisComponent(geo.centroids[i], (a + 1) % 3), (a + 1) % 3)) * kTiles
+                + tileIndex(axisComponent(geo.centroids[i], (a + 2) % 3), (a + 2) % 3);
+            byColumn.push_back({ static_cast<uint32_t>(column), static_cast<Index>(i) });
+        }
+        std::sort(byColumn.begin(), byColumn.end());
+        ScratchVector<uint32_t> columnOf(n, UINT32_MAX, arena);
+        ScratchVector<size_t> columnStart(arena);
+        for (size_t k = 0; k < byColumn.size(); ++k)
+        {
+            columnOf[byColumn[k].second] = byColumn[k].first;
+            if (k == 0 || byColumn[k].first != byColumn[k - 1].first)
+                columnStart.push_back(k);
+        }
+        columnStart.push_back(byColumn.size());
+        const size_t columns = columnStart.size() - 1;
+        std::vector<size_t> linesPerWorker(threads, 0);
+        parallelFor(columns, 1, threads, [&](size_t begin, size_t end, unsigned worker) {
+            RayHits& hits = scratch[worker];
+            std::vector<float> crossings;
+            for (size_t col = begin; col < end; ++col) {
+                const uint32_t column = byColumn[columnStart[col]].first;
+                for (size_t k = columnStart[col]; k < columnStart[col + 1]; ++k) {
+                    const size_t i = byColumn[k].second;
+                    if (label[i] != -1) continue;
+                    label[i] = -2;  // needs its own ray unless this line labels it
+                    const int a = family[i];
+                    const Vec3& c = geo.centroids[i];
+                    const float base = lo[a] - 1.f - 0.01f * (hi[a] - lo[a]);
+                    const Vec3 ro = { a == 0 ? base : c.x, a == 1 ? base : c.y, a == 2 ? base : c.z };
+                    const Vec3 rd = { a == 0 ? 1.f : 0.f, a == 1 ? 1.f : 0.f, a == 2 ? 1.f : 0.f };
+                    ++linesPerWorker[worker];
+                    castRay(soa, tree, ro, rd, n, 0.f, hits, stats[worker].first, robustFor(worker));
+                    stats[worker].second += hits.size();
+                    // Two hits closer than tEps mean the line grazes an edge or vertex: its crossings are not
+                    // trustworthy, and neither is a line crossing the surface an odd number of times. Robust
+                    // crossings are exact, so close hits are separate crossings there.
+                    bool clean = (hits.size() & 1) == 0;
+                    crossings.clear();
+                    for (size_t h = 0; clean && h < hits.size(); ++h) {
+                        if (!opts.robust && !crossings.empty() && hits[h].first - crossings.back() <= opts.tEps) clean = false;
+                        crossings.push_back(hits[h].first);
+                    }
+                    if (!clean) continue;
+                    for (size_t h = 0; h < hits.size(); ++h) {
+                        const size_t j = hits[h].second;
+                        if (columnOf[j] != column || label[j] >= 0) continue;
+                        // Crossings beyond tMin on the side the normal faces, as j's own ray would count them.
+                        const float t = hits[h].first;
+                        const size_t ahead = axisComponent(geo.normals[j], a) > 0.f
+                            ? static_cast<size_t>(crossings.end() - std::upper_bound(crossings.begin(), crossings.end(), t + opts.tMin))
+                            : static_cast<size_t>(std::lower_bound(crossings.begin(), crossings.end(), t - opts.tMin) - crossings.begin());
+                        label[j] = static_cast<int8_t>(ahead > 0 && (ahead & 1) == 0);
+                    }
+                }
+            }
+        });
+        for (size_t l : linesPerWorker)
+            lineCount += l;
+        for (int8_t l : label)
+            lineLabelled += l >= 0;
+        lineScope.count("lines", lineCount);
+        lineScope.count("labelled_triangles", lineLabelled);
+    }
+
+    else if (opts.classifier == Classifier::WindingNumber && n > 0)
+    {
+        ProfileScope windingScope("winding_number");
+        // In front of the triangle outside the material (winding number below 1/2), and the normal ray is
+        // blocked by some other triangle (the any-hit stand-in for "non-zero crossings").
+        WindingNumberTree winding;
+        if (!opts.bruteForce)
+            winding.build(*accel, vertices_, indexedTriangles_);
+        std::vector<uint64_t> exactPerWorker(threads, 0), raysPerWorker(threads, 0);
+        const size_t grain = std::max<size_t>(64, n / (static_cast<size_t>(threads) * 32 + 1));
+        parallelFor(n, grain, threads, [&](size_t begin, size_t end, unsigned worker) {
+            for (size_t i = begin; i < end; ++i) {
+                const Vec3& c = geo.centroids[i];
+                const Vec3& nrm = geo.normals[i];
+                const Vec3 q = { c.x + opts.originOffset * nrm.x, c.y + opts.originOffset * nrm.y, c.z + opts.originOffset * nrm.z };
+                const double w = opts.bruteForce ? WindingNumberTree::exact(q, vertices_, indexedTriangles_)
+                                                 : winding.evaluate(q, &exactPerWorker[worker]);
+                bool enclosed = false;
+                if (w < 0.5) {
+                    ++raysPerWorker[worker];
+                    enclosed = anyHit(soa, tree, q, nrm, i, opts.tMin, stats[worker].first, robustFor(worker));
+                    stats[worker].second += enclosed;
+                }
+                label[i] = enclosed ? 1 : 0;
+            }
+        });
+        for (unsigned w = 0; w < threads; ++w)
+        {
+            anyHitRays += raysPerWorker[w];
+            if (!opts.bruteForce)
+                windingScope.count("exact_solid_angles", exactPerWorker[w]);
+        }
+        // Brute force sums every triangle's solid angle for every query.
+        if (opts.bruteForce)
+            windingScope.count("exact_solid_angles", static_cast<uint64_t>(n) * indexedTriangles_.size());
+        windingScope.count("queries", n);
+    }
+
+    // Triangles no line labelled (all of them for PerTriangle): a ray from just above the centroid along the normal.
+    ScratchVector<size_t> pending(arena);
+    pending.reserve(n - lineLabelled);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (label[i] < 0) pending.push_back(i);
+        else if (label[i] > 0) evenHitTriangles.push_back(i);
+    }
+    size_t gpuRays = 0;
+    if (opts.backend == RayBackend::Gpu && !opts.robust && tree && !pending.empty())
+    {
+        // The device counts every pending ray's hits; rays with more hits than it keeps stay pending.
+        ProfileScope gpuScope("gpu");
+        std::vector<uint32_t> rays(pending.begin(), pending.end()), counts;
+        if (gpuDistinctHitCounts(*tree, geo, rays, opts.originOffset, opts.tMin, opts.tEps, counts))
+        {
+            size_t kept = 0;
+            for (size_t p = 0; p < pending.size(); ++p)
+            {
+                if (counts[p] == kGpuHitOverflow) pending[kept++] = pending[p];
+                else if (counts[p] > 0 && (counts[p] & 1) == 0) evenHitTriangles.push_back(pending[p]);
+            }
+            gpuRays = pending.size() - kept;
+            pending.resize(kept);
+        }
+        gpuScope.count("rays", gpuRays);
+    }
+    std::vector<std::vector<size_t>> perWorker(threads);
+    const size_t grain = std::max<size_t>(64, pending.size() / (static_cast<size_t>(threads) * 32 + 1));
+    parallelFor(pending.size(), grain, threads, [&](size_t begin, size_t end, unsigned worker) {
+        RayHits& hits = scratch[worker];
+        for (size_t p = begin; p < end; ++p) {
+            const size_t i = pending[p];
+            const Vec3& c = geo.centroids[i];
+            const Vec3& nrm = geo.normals[i];
+            Vec3 rayOrig = { c.x + opts.originOffset * nrm.x, c.y + opts.originOffset * nrm.y, c.z + opts.originOffset * nrm.z };
+            castRay(soa, tree, rayOrig, nrm, i, opts.tMin, hits, stats[worker].first, robustFor(worker));
+            stats[worker].second += hits.size();
+            // Hits within tEps are taken for one crossing seen by both triangles at a shared edge; robust
+            // crossings already count such an edge once.
+            int distinctHits = opts.robust ? static_cast<int>(hits.size()) : 0;
+            float lastT = -1e30f;
+            for (size_t h = 0; !opts.robust && h < hits.size(); ++h) {
+                if (hits[h].first - lastT > opts.tEps) { ++distinctHits; lastT = hits[h].first; }
+            }
+            if (distinctHits > 0 && (distinctHits & 1) == 0)
+                perWorker[worker].push_back(i);
+        }
+    });
+    // Chunks are stolen in any order, so the merged list is sorted afterwards.
+    for (const std::vector<size_t>& w : perWorker)
+        evenHitTriangles.insert(evenHitTriangles.end(), w.begin(), w.end());
+    std::sort(evenHitTriangles.begin(), evenHitTriangles.end());
+    if (!opts.cacheDir.empty())
+    {
+        ProfileScope cacheScope("cache_store");
+        cacheScope.count("stored", storeEvenHitCache(opts.cacheDir, cacheKey, n, evenHitTriangles) ? 1 : 0);
+    }
+    if (scope.active())
+    {
+        scope.count("rays", lineCount + anyHitRays + gpuRays + pending.size());
+        for (const auto& st : stats)
+        {
+            scope.count("ray_triangle_tests", st.first);
+            scope.count("hits", st.second);
+        }
+        for (const RobustCast& r : robust)
+        {
+            scope.count("robust_float_signs", r.stats.floatSigns);
+            scope.count("robust_double_signs", r.stats.doubleSigns);
+            scope.count("robust_exact_signs", r.stats.exactSigns);
+        }
+        scope.count("even_hit_triangles", evenHitTriangles.size());
+    }
+}
+
+void StlReader::computeFluidMesh(std::vector<Triangle>& outFluid, std::ostream& cleanMeshOut, const FluidOptions& opts) const
+{
+    ProfileScope scope("compute_fluid_mesh");
     outFluid.clear();
     std::vector<size_t> evenHitTriangles;
-    for (size_t i = 0; i < indexedTriangles_.size(); ++i) {
-        Triangle tri = getTriangle(i);
-        float cx = (tri.v0.x + tri.v1.x + tri.v2.x) / 3.f;
-        float cy = (tri.v0.y + tri.v1.y + tri.v2.y) / 3.f;
-        float cz = (tri.v0.z + tri.v1.z + tri.v2.z) / 3.f;
-        Vec3 rayOrig = { cx + originOffset * tri.normal.x, cy + originOffset * tri.normal.y, cz + originOffset * tri.normal.z };
-        Vec3 rayDir = { tri.normal.x, tri.normal.y, tri.normal.z };
-        std::vector<std::pair<float, size_t>> hits;
-        for (size_t k = 0; k < indexedTriangles_.size(); ++k) {
-            if (k == i) continue;
-            float t;
-            if (rayIntersect(k, rayOrig, rayDir, t) && t > tMin)
-                hits.push_back({ t, k });
+    classifyEvenHit(evenHitTriangles, opts);
+    // Caps are appended after the subset; reverse them so they face the fluid region's outside.
+    auto flipCaps = [](std::vector<Triangle>& tris, size_t firstCap) {
+        for (size_t i = firstCap; i < tris.size(); ++i) {
+            std::swap(tris[i].v1, tris[i].v2);
+            tris[i].normal.x = -tris[i].normal.x;
+            tris[i].normal.y = -tris[i].normal.y;
+            tris[i].normal.z = -tris[i].normal.z;
         }
-        std::sort(hits.begin(), hits.end());
-        int distinctHits = 0;
-        float lastT = -1e30f;
-        for (const auto& h : hits) {
-            if (h.first - lastT > tEps) { ++distinctHits; lastT = h.first; }
+    };
+    const MeshComponents& comps = components();
+    if (comps.count() <= 1)
+    {
+        addCaps(evenHitTriangles, outFluid);
+        {
+            ProfileScope flipScope("cap_flip");
+            flipCaps(outFluid, evenHitTriangles.size());
+            flipScope.count("cap_triangles", outFluid.size() - evenHitTriangles.size());
         }
-        if (distinctHits > 0 && (distinctHits & 1) == 0)
-            evenHitTriangles.push_back(i);
+        cleanMesh(outFluid, cleanMeshOut);
+        scope.count("triangles", outFluid.size());
+        return;
     }
-    addCaps(evenHitTriangles, outFluid);
-    for (size_t i = evenHitTriangles.size(); i < outFluid.size(); ++i) {
-        std::swap(outFluid[i].v1, outFluid[i].v2);
-        outFluid[i].normal.x = -outFluid[i].normal.x;
-        outFluid[i].normal.y = -outFluid[i].normal.y;
-        outFluid[i].normal.z = -outFluid[i].normal.z;
+
+    // Boundary loops and welded vertices never span components, so each component's selection is capped and
+    // cleaned on its own; the parts are concatenated in component order.
+    ProfileScope componentScope("components");
+    std::vector<std::vector<size_t>> subsets;
+    comps.split(evenHitTriangles, subsets);
+    std::vector<size_t> tasks;
+    for (size_t c = 0; c < subsets.size(); ++c)
+        if (!subsets[c].empty()) tasks.push_back(c);
+    std::vector<std::vector<Triangle>> parts(tasks.size());
+    std::vector<CleanCounts> counts(tasks.size());
+    std::vector<size_t> caps(tasks.size(), 0), loops(tasks.size(), 0);
+    parallelFor(tasks.size(), 1, resolveThreadCount(opts.threads), [&](size_t begin, size_t end, unsigned) {
+        ProfileMute mute;  // stages run concurrently here; the totals go on componentScope
+        for (size_t k = begin; k < end; ++k) {
+            const std::vector<size_t>& subset = subsets[tasks[k]];
+            addCaps(subset, parts[k], loops[k]);
+            caps[k] = parts[k].size() - subset.size();
+            flipCaps(parts[k], subset.size());
+            cleanMesh(parts[k], counts[k]);
+        }
+    });
+    CleanCounts total;
+    size_t totalCaps = 0, totalLoops = 0;
+    for (size_t k = 0; k < tasks.size(); ++k)
+    {
+        outFluid.insert(outFluid.end(), parts[k].begin(), parts[k].end());
+        total.duplicates += counts[k].duplicates;
+        total.vertexRefs += counts[k].vertexRefs;
+        total.uniqueVertices += counts[k].uniqueVertices;
+        total.degenerate += counts[k].degenerate;
+        total.nonManifoldEdges += counts[k].nonManifoldEdges;
+        total.before += counts[k].before;
+        total.after += counts[k].after;
+        totalCaps += caps[k];
+        totalLoops += loops[k];
     }
-    cleanMesh(outFluid, cleanMeshOut);
+    printCleanReport(total, cleanMeshOut);
+    componentScope.count("components", comps.count());
+    componentScope.count("fluid_components", tasks.size());
+    componentScope.count("boundary_loops", totalLoops);
+    componentScope.count("cap_triangles", totalCaps);
+    scope.count("triangles", outFluid.size());
 }
 
 void StlReader::cleanMesh(std::vector<Triangle>& triangles, std::ostream& out) 
 {
+    CleanCounts counts;
+    cleanMesh(triangles, counts);
+    printCleanReport(counts, out);
+}
+
+void StlReader::cleanMesh(std::vector<Triangle>& triangles, CleanCounts& counts)
+{
+    ProfileScope scope("clean_mesh");
+    counts = CleanCounts();
     const size_t initialTris = triangles.size();
-    if (initialTris == 0) { out << "No triangles.\n"; return; }
-
-    std::vector<Vec3> verts;
-    std::map<Vec3, size_t> vToIdx;
-    auto getIdx = [&](const Vec3& v) {
-        auto it = vToIdx.find(v);
-        if (it != vToIdx.end()) return it->second;
-        size_t i = verts.size();
-        vToIdx[v] = i;
-        verts.push_back(v);
-        return i;
-    };
+    if (initialTris == 0) return;
+
+    ArenaScope scratch(threadArena());
+    Arena* arena = &scratch.arena();
+    VertexWelder welder(initialTris / 2 + 16, arena);
+    const std::vector<Vec3>& verts = welder.vertices();
 
-    std::vector<std::array<size_t, 3>> indexed;
+    std::vector<IndexedTri> indexed;
+    indexed.reserve(initialTris);
     size_t degenerate = 0;
     for (const Triangle& t : triangles) 
     {
-        size_t i = getIdx(t.v0), j = getIdx(t.v1), k = getIdx(t.v2);
+        const Index i = static_cast<Index>(welder.insert(t.v0)), j = static_cast<Index>(welder.insert(t.v1)),
+            k = static_cast<Index>(welder.insert(t.v2));
         if (i == j || j == k || k == i) { ++degenerate; continue; }
-        indexed.push_back({{ i, j, k }});
+        indexed.push_back({ i, j, k });
     }
 
-    const size_t totalVertexRefs = initialTris * 3;
-
-    std::set<std::array<size_t, 3>> seen;
-    std::vector<std::array<size_t, 3>> uniqueTris;
-    size_t dupTris = 0;
-    for (const auto& tri : indexed) 
+    MeshTopology topo(arena);
+    topo.build(indexed);
+    const std::vector<size_t>& dups = topo.duplicateFaces();
+    const size_t dupTris = dups.size();
+    std::vector<IndexedTri> uniqueTris;
+    uniqueTris.reserve(indexed.size() - dupTris);
+    for (size_t i = 0, d = 0; i < indexed.size(); ++i) 
     {
-        std::array<size_t, 3> key = {{ tri[0], tri[1], tri[2] }};
-        std::sort(key.begin(), key.end());
-        if (!seen.insert(key).second) { ++dupTris; continue; }
-        uniqueTris.push_back(tri);
+        if (d < dups.size() && dups[d] == i) { ++d; continue; }
+        uniqueTris.push_back(indexed[i]);
     }
 
-    size_t dupEdges = 0;
-    std::map<std::pair<size_t, size_t>, int> edgeCount;
-    for (const auto& tri : uniqueTris) 
-    {
-        edgeCount[edgeKey(tri[0], tri[1])]++;
-        edgeCount[edgeKey(tri[1], tri[2])]++;
-        edgeCount[edgeKey(tri[2], tri[0])]++;
-    }
-    for (const auto& kv : edgeCount)
-        if (kv.second > 2) ++dupEdges;
+    topo.build(uniqueTris);
+    const size_t dupEdges = topo.nonManifoldEdgeCount();
 
     triangles.clear();
     for (const auto& tri : uniqueTris) 
     {
-        const Vec3& a = verts[tri[0]], b = verts[tri[1]], c = verts[tri[2]];
+        const Vec3& a = verts[tri.v0], b = verts[tri.v1], c = verts[tri.v2];
         float ex = b.x - a.x, ey = b.y - a.y, ez = b.z - a.z;
         float fx = c.x - a.x, fy = c.y - a.y, fz = c.z - a.z;
         float nx = ey * fz - ez * fy, ny = ez * fx - ex * fz, nz = ex * fy - ey * fx;
@@ -442,22 +1245,37 @@ void StlReader::cleanMesh(std::vector<Triangle>& triangles, std::ostream& out)
         triangles.push_back(t);
     }
 
+    counts.duplicates = dupTris;
+    counts.vertexRefs = initialTris * 3;
+    counts.uniqueVertices = verts.size();
+    counts.degenerate = degenerate;
+    counts.nonManifoldEdges = dupEdges;
+    counts.before = initialTris;
+    counts.after = triangles.size();
+    scope.count("triangles_in", initialTris);
+    scope.count("triangles_out", triangles.size());
+    scope.count("unique_vertices", verts.size());
+}
+
+void StlReader::printCleanReport(const CleanCounts& c, std::ostream& out)
+{
+    if (c.before == 0) { out << "No triangles.\n"; return; }
     out << "Clean triangles report:\n";
-    out << "  Duplicate triangles removed: " << dupTris << "\n";
-    out << "  Vertices: " << totalVertexRefs << " refs -> " << verts.size() << " unique (merged " << (totalVertexRefs - verts.size()) << " duplicate positions)\n";
-    out << "  Degenerate triangles removed: " << degenerate << "\n";
-    if (dupEdges > 0) out << "  Non-manifold edges (shared by >2 triangles): " << dupEdges << "\n";
-    out << "  Triangles before: " << initialTris << "  after: " << triangles.size() << "\n";
+    out << "  Duplicate triangles removed: " << c.duplicates << "\n";
+    out << "  Vertices: " << c.vertexRefs << " refs -> " << c.uniqueVertices << " unique (merged " << (c.vertexRefs - c.uniqueVertices) << " duplicate positions)\n";
+    out << "  Degenerate triangles removed: " << c.degenerate << "\n";
+    if (c.nonManifoldEdges > 0) out << "  Non-manifold edges (shared by >2 triangles): " << c.nonManifoldEdges << "\n";
+    out << "  Triangles before: " << c.before << "  after: " << c.after << "\n";
+}
+
+bool StlReader::writeAsciiStlFromTriangles(const std::string& path, const std::vector<Triangle>& triangles, unsigned threads) 
+{
+    return writeAsciiStlFile(path, "fluid", triangles.size(), [&](size_t i) { return triangles[i]; }, threads);
 }
 
-bool StlReader::writeAsciiStlFromTriangles(const std::string& path, const std::vector<Triangle>& triangles) 
+bool StlReader::writeBinaryStlFromTriangles(const std::string& path, const std::vector<Triangle>& triangles)
 {
-    std::ofstream f(path);
-    if (!f) return false;
-    f << "solid fluid\n";
-    for (const Triangle& t : triangles) writeOneFacet(f, t);
-    f << "endsolid fluid\n";
-    return !!f;
+    return writeBinaryRecords(path, "fluid", triangles.size(), [&](size_t i) { return triangles[i]; });
 }
 
 bool StlReader::checkWatertight(std::ostream& out) const 
@@ -465,38 +1283,20 @@ bool StlReader::checkWatertight(std::ostream& out) const
     if (indexedTriangles_.empty()) { out << "Watertight: no triangles\n"; return false; }
 
     const float areaEps = 1e-10f;
-    int duplicateTriangles = 0;
-    std::set<std::array<size_t, 3>> seen;
-    for (const IndexedTri& id : indexedTriangles_) 
-    {
-        std::array<size_t, 3> key = {{ id.v0, id.v1, id.v2 }};
-        std::sort(key.begin(), key.end());
-        if (!seen.insert(key).second) ++duplicateTriangles;
-    }
+    const MeshTopology& topo = topology();
+    const size_t duplicateTriangles = topo.duplicateFaces().size();
     if (duplicateTriangles > 0)
         out << "Duplicate triangles: " << duplicateTriangles << "\n";
 
-    std::map<std::pair<size_t, size_t>, int> edgeCount;
-    for (const IndexedTri& id : indexedTriangles_) 
-    {
-        edgeCount[edgeKey(id.v0, id.v1)]++;
-        edgeCount[edgeKey(id.v1, id.v2)]++;
-        edgeCount[edgeKey(id.v2, id.v0)]++;
-    }
-    int boundaryEdges = 0, nonManifoldEdges = 0;
-    for (const auto& kv : edgeCount) 
-    {
-        if (kv.second == 1) ++boundaryEdges;
-        else if (kv.second > 2) ++nonManifoldEdges;
-    }
-    out << "Edges: " << edgeCount.size() << " unique; " << boundaryEdges << " boundary (count=1), " << nonManifoldEdges << " non-manifold (count>2)\n";
+    const size_t boundaryEdges = topo.boundaryEdgeCount(), nonManifoldEdges = topo.nonManifoldEdgeCount();
+    out << "Edges: " << topo.edgeCount() << " unique; " << boundaryEdges << " boundary (count=1), " << nonManifoldEdges << " non-manifold (count>2)\n";
 
     int degenerate = 0;
-    for (const IndexedTri& id : indexedTriangles_) 
+    const TriangleGeometry& g = geometry();
+    for (size_t i = 0; i < indexedTriangles_.size(); ++i) 
     {
-        const Vec3& a = vertices_[id.v0], b = vertices_[id.v1], c = vertices_[id.v2];
-        float ex = b.x - a.x, ey = b.y - a.y, ez = b.z - a.z;
-        float fx = c.x - a.x, fy = c.y - a.y, fz = c.z - a.z;
+        const float ex = g.edge1[i].x, ey = g.edge1[i].y, ez = g.edge1[i].z;
+        const float fx = g.edge2[i].x, fy = g.edge2[i].y, fz = g.edge2[i].z;
         float nx = ey * fz - ez * fy, ny = ez * fx - ex * fz, nz = ex * fy - ey * fx;
         float area2 = nx * nx + ny * ny + nz * nz;
         if (area2 <= areaEps * areaEps) ++degenerate;
@@ -512,8 +1312,8 @@ bool StlReader::checkWatertight(std::ostream& out) const
 
 bool StlReader::rayIntersect(size_t triIndex, const Vec3& ro, const Vec3& rd, float& t_out) const 
 {
-    Triangle t = getTriangle(triIndex);
-    const Vec3& v0 = t.v0, v1 = t.v1, v2 = t.v2;
+    const IndexedTri& id = indexedTriangles_.at(triIndex);
+    const Vec3& v0 = vertices_[id.v0], v1 = vertices_[id.v1], v2 = vertices_[id.v2];
     const float eps = 1e-6f;
     float e1x = v1.x - v0.x, e1y = v1.y - v0.y, e1z = v1.z - v0.z;
     float e2x = v2.x - v0.x, e2y = v2.y - v0.y, e2z = v2.z - v0.z;
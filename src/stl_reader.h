@@ -1,10 +1,16 @@
 #ifndef STL_READER_H
 #define STL_READER_H
 
+#include <cstdint>
 #include <iosfwd>
+#include <memory>
 #include <string>
 #include <vector>
 
+class Bvh;
+class MeshComponents;
+class MeshTopology;
+
 class StlReader {
 public:
     struct Vec3 {
@@ -19,16 +25,152 @@ public:
         Vec3 normal;
         Vec3 v0, v1, v2;
     };
-    struct IndexedTri { size_t v0, v1, v2; };
+    /** Vertex and triangle numbers of the indexed mesh, its edge tables and the cleaned fluid mesh. 32-bit by
+     *  default, which halves IndexedTri and edge records against size_t; build with -DSTL_TOOL_WIDE_INDEX for
+     *  size_t. A mesh with more triangles than Index can number is rejected when indexed. */
+#ifdef STL_TOOL_WIDE_INDEX
+    typedef size_t Index;
+#else
+    typedef uint32_t Index;
+#endif
+    struct IndexedTri { Index v0, v1, v2; };
+    /** Per-triangle geometry in contiguous arrays (entry i is triangle i): unit normal exactly as getTriangle()
+     *  computes it, edges v1 - v0 and v2 - v0, centroid (v0 + v1 + v2) / 3. */
+    struct TriangleGeometry {
+        std::vector<Vec3> normals;
+        std::vector<Vec3> edge1, edge2;
+        std::vector<Vec3> centroids;
+    };
+
+    /** How the even-hit pass decides each triangle. PerTriangle casts one ray from every triangle along its normal.
+     *  RayReuse labels every triangle an axis-aligned line crosses from that line's hits, casting per-triangle rays
+     *  only for triangles no line labelled cleanly. WindingNumber selects a triangle when the fast generalized
+     *  winding number just in front of it is below 1/2 and its normal ray hits another triangle, so small gaps and
+     *  overlaps do not flip the result. */
+    enum class Classifier { PerTriangle, RayReuse, WindingNumber };
+
+    /** Where the even-hit pass casts its per-triangle rays. Gpu uses the CUDA backend of `./build.sh gpu`
+     *  (gpu_raycast.h) when a device is present and needs the BVH (not with bruteForce); otherwise, and for rays
+     *  the device could not finish, the CPU casts them. Results are the same either way. */
+    enum class RayBackend { Cpu, Gpu };
+
+    /** Tuning for computeFluidMesh(). bruteForce tests every ray against every triangle instead of using the BVH (for comparison).
+     *  threads is the worker count for the even-hit pass (0 = one per hardware thread); results do not depend on it. */
+    struct FluidOptions {
+        float originOffset = 1e-4f;
+        float tMin = 1e-2f;
+        float tEps = 1e-4f;
+        bool bruteForce = false;
+        unsigned threads = 0;
+        Classifier classifier = Classifier::PerTriangle;
+        RayBackend backend = RayBackend::Cpu;
+        /** Decide every ray-triangle crossing exactly (robust_ray.h) instead of with the float kernel and tEps:
+         *  a ray through a shared edge or vertex counts it once, so hit parities no longer depend on rounding.
+         *  Most signs still settle in float; rays stay on the CPU. */
+        bool robust = false;
+        /** When not empty, the even-hit selection is looked up in and stored to this directory (see
+         *  even_hit_cache.h); a hit skips ray casting and the temporary BVH build. */
+        std::string cacheDir;
+    };
+
+    /** Options for read(). fastAscii parses ASCII files with the mapped, multithreaded token parser (tolerates any
+     *  whitespace layout); false selects the original line-by-line parser. threads: 0 = one per hardware thread. */
+    struct ReadOptions {
+        bool fastAscii = true;
+        unsigned threads = 0;
+        /** readIndexed(): after the bit-exact weld, weldVertices(weldEpsilon, threads) when positive. */
+        float weldEpsilon = 0.f;
+        /** readIndexed(): finish with reorderSpatially(threads). */
+        bool spatialOrder = false;
+    };
 
+    StlReader() = default;
+    StlReader(const StlReader&) = default;
+    StlReader& operator=(const StlReader&) = default;
+    /** Moves hand the mesh buffers and caches over without copying; the source is left empty. */
+    StlReader(StlReader&&) noexcept = default;
+    StlReader& operator=(StlReader&&) noexcept = default;
+
+    /** Load an ASCII or binary STL into the raw triangle list. Binary files are read from a memory mapping and
+     *  rejected if shorter than the triangle count in their header implies. Every read() / readIndexed() also
+     *  accepts gzip or zstd compressed STL (e.g. .stl.gz, .stl.zst; recognized by content), decompressed into a
+     *  buffer the reader keeps; false if this build lacks the codec (compressionSupported()). */
     bool read(const std::string& path);
+    bool read(const std::string& path, const ReadOptions& opts);
+    /** read() followed by removeDuplicateVertices(); binary files are welded straight from the mapped records without building the raw triangle list. */
+    bool readIndexed(const std::string& path);
+    bool readIndexed(const std::string& path, const ReadOptions& opts);
+    /** read() / readIndexed() of STL bytes already in memory (size bytes at data, e.g. received over the network),
+     *  without a temporary file. The bytes are not kept. */
+    bool read(const void* data, size_t size);
+    bool read(const void* data, size_t size, const ReadOptions& opts);
+    bool readIndexed(const void* data, size_t size);
+    bool readIndexed(const void* data, size_t size, const ReadOptions& opts);
+    /** read() / readIndexed() of a stream up to its end. The bytes are collected in a buffer the reader keeps for
+     *  the next call. False if the stream fails before its end or the bytes are not a valid STL. */
+    bool read(std::istream& in);
+    bool read(std::istream& in, const ReadOptions& opts);
+    bool readIndexed(std::istream& in);
+    bool readIndexed(std::istream& in, const ReadOptions& opts);
+    /** Empty the reader for another mesh, keeping the capacity of its buffers, so a long-lived reader serving
+     *  request after request does not allocate and page in its tables again. Drops the BVH and caches. */
+    void reset();
+    /** Move the vertex table and indexed triangles out into the given vectors (whose old contents are
+     *  discarded), leaving the reader as after reset(). */
+    void takeMesh(std::vector<Vec3>& vertices, std::vector<IndexedTri>& triangles);
+    /** Index an in-memory triangle list as readIndexed() indexes a file (header set to `header`), e.g. a mesh just
+     *  produced by computeFluidMesh(), so it can be checked without writing and re-reading it. */
+    void setTriangles(const std::vector<Triangle>& triangles, const std::string& header = std::string());
+    /** Merge identical vertex positions into vertices() and build indexedTriangles(). Discards any previously built BVH. */
     void removeDuplicateVertices();
+    /** Snap together vertices of vertices() closer than epsilon (chains of close points become one vertex; see
+     *  weldWithinEpsilon()) and renumber indexedTriangles(). Triangles that collapse are kept, so per-triangle
+     *  data stays aligned; the checks report them as degenerate and cleanMesh() drops them. Discards the BVH and
+     *  cached adjacency when anything merges. Returns the number of vertices removed. */
+    size_t weldVertices(float epsilon, unsigned threads = 0);
+    /** Renumber vertices by the Morton code of their position and triangles by the Morton code of their centroid,
+     *  so that geometry close in space is close in memory for the BVH build, the edge tables and ray traversal
+     *  (exporters often write facets in no spatial order). originalTriangleId() maps the new numbers back to the
+     *  order the triangles were read in, and the winding report lists triangles by those ids. Results that
+     *  depend on triangle order (the written solid, the fluid mesh's facet order, float sums such as volume())
+     *  follow the new order. Discards the BVH and cached adjacency. */
+    void reorderSpatially(unsigned threads = 0);
+    /** Position of triangle i in the input before any reorderSpatially() (i if the mesh was not reordered). */
+    size_t originalTriangleId(size_t i) const { return triangleIds_.empty() ? i : triangleIds_[i]; }
+    /** originalTriangleId() for every triangle; empty if the mesh was not reordered. */
+    const std::vector<Index>& originalTriangleIds() const { return triangleIds_; }
+    /** The facet normals stored in the file, one per indexed triangle (the reference of checkRightHandWinding());
+     *  another size when the triangles did not come from facets. */
+    const std::vector<Vec3>& originalFacetNormals() const { return originalFacetNormals_; }
+    /** Build the ray-casting BVH over indexedTriangles(). Call after removeDuplicateVertices(); computeFluidMesh() builds a temporary one otherwise. */
+    void buildBvh();
+    /** BVH from buildBvh(), or null if not built. */
+    const Bvh* bvh() const { return bvh_.get(); }
+
+    /** Edge / face adjacency of indexedTriangles(), built on first use and kept until the mesh is re-indexed.
+     *  Safe to call from several threads (concurrent first calls may each build it; one result is kept). */
+    const MeshTopology& topology() const;
+    /** Connected components of indexedTriangles() with their bounding boxes and volumes; cached and thread safe
+     *  as for topology(). */
+    const MeshComponents& components() const;
+
+    /** Geometry cache for indexedTriangles(), built on first use and reused by the even-hit pass, addCaps(), the
+     *  writers and the checks (about 48 bytes per triangle). Dropped when the mesh is re-indexed; thread safety as
+     *  for topology(). */
+    const TriangleGeometry& geometry() const;
+    /** Free the geometry cache; the next geometry() call rebuilds it. */
+    void invalidateGeometry();
+    /** Recompute the geometry cache now. */
+    void rebuildGeometry();
 
     const std::string& header() const { return header_; }
     size_t triangleCount() const { return indexedTriangles_.size(); }
     const std::vector<Vec3>& vertices() const { return vertices_; }
     const std::vector<IndexedTri>& indexedTriangles() const { return indexedTriangles_; }
     Triangle getTriangle(size_t i) const;
+    /** Unit normal of (a, b, c) by the right-hand rule, as getTriangle() computes it (the raw cross product if its
+     *  length is zero). */
+    static Vec3 facetNormal(const Vec3& a, const Vec3& b, const Vec3& c);
     /** Volume (signed tetrahedron sum from origin). Call after removeDuplicateVertices(). */
     double volume() const;
 
@@ -38,20 +180,36 @@ public:
     /** Check if vertex order (v0,v1,v2) matches right-hand rule vs original facet normals. Call after removeDuplicateVertices(). */
     void checkRightHandWinding(std::ostream& out) const;
 
-    /** Write set of triangles as ASCII STL. Call after removeDuplicateVertices(). Returns false on write error. */
-    bool writeAsciiStl(const std::string& path) const;
+    /** Write set of triangles as ASCII STL (shortest round-trip floats, formatted on `threads` workers, 0 = hardware
+     *  concurrency; output bytes do not depend on it). Call after removeDuplicateVertices(). Returns false on write error. */
+    bool writeAsciiStl(const std::string& path, unsigned threads = 0) const;
     /** Write only triangles whose indices are in onlyIndices (sorted, unique). */
     bool writeAsciiStl(const std::string& path, const std::vector<size_t>& onlyIndices) const;
 
+    /** Write set of triangles as binary STL (50-byte records, normals from geometry; the header carries the solid name writeAsciiStl() uses). Call after removeDuplicateVertices(). Returns false on write error. */
+    bool writeBinaryStl(const std::string& path) const;
+
     /** Append cap triangles to close boundary loops of the given triangle subset. Fills outTriangles with original subset + caps. */
     void addCaps(const std::vector<size_t>& triangleIndices, std::vector<Triangle>& outTriangles) const;
 
-    /** Compute fluid set of triangles: even-hit interior selection, addCaps, flip cap normals, cleanMesh. Call after removeDuplicateVertices(). Fills outFluid. */
+    /** Compute fluid set of triangles: even-hit interior selection, addCaps, flip cap normals, cleanMesh. Call after removeDuplicateVertices(). Fills outFluid.
+     *  Selection always casts against the whole mesh (a body inside another's cavity changes its crossings). When
+     *  the mesh has several connected components, capping and cleaning run per component as parallel tasks:
+     *  outFluid then lists the components in order and the clean report is their sum. Calls on distinct readers
+     *  may run concurrently from several threads (scratch memory and profile nesting are per thread). */
     void computeFluidMesh(std::vector<Triangle>& outFluid, std::ostream& cleanMeshOut,
         float originOffset = 1e-4f, float tMin = 1e-2f, float tEps = 1e-4f) const;
+    void computeFluidMesh(std::vector<Triangle>& outFluid, std::ostream& cleanMeshOut, const FluidOptions& opts) const;
+
+    /** Even-hit pass of computeFluidMesh(): indices (ascending) of triangles whose centroid ray has an even, non-zero number of distinct hits.
+     *  With opts.cacheDir set, a stored result for the same mesh and settings is returned instead of casting. */
+    void classifyEvenHit(std::vector<size_t>& evenHitTriangles, const FluidOptions& opts) const;
 
-    /** Write a list of triangles to an ASCII STL file (e.g. output from addCaps). */
-    static bool writeAsciiStlFromTriangles(const std::string& path, const std::vector<Triangle>& triangles);
+    /** Write a list of triangles to an ASCII STL file (e.g. output from addCaps); threads as for writeAsciiStl(). */
+    static bool writeAsciiStlFromTriangles(const std::string& path, const std::vector<Triangle>& triangles, unsigned threads = 0);
+
+    /** Write a list of triangles to a binary STL file. */
+    static bool writeBinaryStlFromTriangles(const std::string& path, const std::vector<Triangle>& triangles);
 
     /** Write one facet to stream. */
     static void writeOneFacet(std::ostream& f, const Triangle& t);
@@ -66,11 +224,42 @@ public:
     bool checkWatertight(std::ostream& out) const;
 
 private:
+    /** Counts behind the cleanMesh() report; summed over components by computeFluidMesh(). */
+    struct CleanCounts {
+        size_t duplicates = 0, vertexRefs = 0, uniqueVertices = 0, degenerate = 0, nonManifoldEdges = 0;
+        size_t before = 0, after = 0;
+    };
+    static void cleanMesh(std::vector<Triangle>& triangles, CleanCounts& counts);
+    /** addCaps() that also returns the number of boundary loops capped. */
+    void addCaps(const std::vector<size_t>& triangleIndices, std::vector<Triangle>& outTriangles, size_t& loops) const;
+    static void printCleanReport(const CleanCounts& counts, std::ostream& out);
+
+    /** Original getline/sscanf ASCII parser (ReadOptions::fastAscii = false). */
+    bool readAsciiLines(std::istream& in);
+    /** Read in to its end into streamBuffer_. */
+    bool readStream(std::istream& in);
+    /** If bytes are gzip or zstd, decompress them into inflated_ and point bytes / size there. False if they
+     *  cannot be decompressed. */
+    bool inflateInput(const unsigned char*& bytes, size_t& size);
+    /** Drop the BVH, topology, components and geometry cache after the mesh changed. */
+    void dropDerived();
+    /** Weld n facets laid out like Triangle (normal, v0, v1, v2 as 12 floats), stride bytes apart. */
+    void indexFacets(const unsigned char* facets, size_t stride, size_t n);
+    /** getTriangle(i) with the normal taken from g. */
+    Triangle cachedTriangle(size_t i, const TriangleGeometry& g) const;
+
     std::string header_;
     std::vector<Triangle> triangles_;
     std::vector<Vec3> vertices_;
     std::vector<IndexedTri> indexedTriangles_;
     std::vector<Vec3> originalFacetNormals_;
+    std::vector<Index> triangleIds_;  // input id of each triangle after reorderSpatially(); empty = identity
+    std::vector<unsigned char> streamBuffer_;  // bytes of the last read(std::istream&)
+    std::vector<unsigned char> inflated_;      // decompressed bytes of the last compressed input
+    std::shared_ptr<const Bvh> bvh_;
+    mutable std::shared_ptr<const MeshTopology> topology_;  // accessed with std::atomic_load / atomic_store
+    mutable std::shared_ptr<const MeshComponents> components_;  // likewise
+    mutable std::shared_ptr<const TriangleGeometry> geometry_;  // likewise
 };
 
 #endif
@@ -0,0 +1,480 @@
+#include "stl_stream.h"
+#include "ascii_stl.h"
+#include "mapped_file.h"
+#include "stl_reader.h"
+#include "vertex_weld.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace {
+typedef StlReader::Vec3 Vec3;
+typedef StlReader::Triangle Triangle;
+
+const size_t kBinaryHeaderSize = 84;
+const size_t kBinaryRecordSize = 50;
+const size_t kFacetBytes = 48;
+const size_t kBatchFacets = 1 << 16;
+const size_t kMinAsciiFacetBytes = 64;  // shortest plausible facet text, to bound the facet count of an ASCII file
+
+// Sequential reader of the facets of a mapped STL, one batch at a time. Pages already consumed are released.
+class FacetSource {
+public:
+    bool open(const std::string& path)
+    {
+        if (!map_.open(path))
+            return false;
+        ascii_ = map_.size() >= 5 && std::memcmp(map_.data(), "solid", 5) == 0;
+        if (ascii_)
+        {
+            const void* nl = std::memchr(map_.data(), '\n', map_.size());
+            pos_ = nl ? static_cast<size_t>(static_cast<const unsigned char*>(nl) - map_.data()) + 1 : map_.size();
+            estimate_ = map_.size() / kMinAsciiFacetBytes + 1;
+            return true;
+        }
+        if (map_.size() < kBinaryHeaderSize)
+            return false;
+        uint32_t count;
+        std::memcpy(&count, map_.data() + 80, 4);
+        if ((map_.size() - kBinaryHeaderSize) / kBinaryRecordSize < count)
+            return false;
+        pos_ = kBinaryHeaderSize;
+        remaining_ = count;
+        estimate_ = count;
+        return true;
+    }
+
+    /** Upper bound on the number of facets (exact for binary files). */
+    uint64_t estimate() const { return estimate_; }
+    /** A parse error, or an ASCII file without facets (which StlReader::read() rejects too; a binary file may
+     *  declare zero). Meaningful once next() has returned false. */
+    bool failed() const { return failed_ || (ascii_ && !produced_); }
+
+    /** Replace batch with the next facets; false at the end of the input or on a parse error. */
+    bool next(std::vector<Triangle>& batch)
+    {
+        batch.clear();
+        if (ascii_)
+        {
+            if (!parseAsciiFacets(reinterpret_cast<const char*>(map_.data()), map_.size(), pos_, kBatchFacets, batch))
+                failed_ = true;
+        }
+        else
+        {
+            batch.resize(static_cast<size_t>(std::min<uint64_t>(remaining_, kBatchFacets)));
+            for (Triangle& t : batch)
+            {
+                std::memcpy(&t, map_.data() + pos_, kFacetBytes);
+                pos_ += kBinaryRecordSize;
+            }
+            remaining_ -= batch.size();
+        }
+        map_.releaseBefore(pos_);
+        produced_ = produced_ || !batch.empty();
+        return !failed_ && !batch.empty();
+    }
+
+private:
+    MappedFile map_;
+    bool ascii_ = false;
+    bool failed_ = false;
+    bool produced_ = false;
+    size_t pos_ = 0;
+    uint64_t remaining_ = 0;
+    uint64_t estimate_ = 0;
+};
+
+// Temporary file written through a buffer. It is reopened in append mode on every flush, so thousands of
+// buckets never hold thousands of descriptors; the file is removed once loaded or on destruction.
+class SpillFile {
+public:
+    SpillFile(const std::string& path, size_t bufferBytes) : path_(path), capacity_(bufferBytes) {}
+    ~SpillFile() { discard(); }
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    void append(const void* p, size_t n)
+    {
+        if (buffer_.size() + n > capacity_)
+            flush();
+        buffer_.insert(buffer_.end(), static_cast<const char*>(p), static_cast<const char*>(p) + n);
+    }
+
+    bool ok() const { return ok_; }
+
+    template <class T>
+    bool load(std::vector<T>& out)
+    {
+        flush();
+        out.resize(static_cast<size_t>(bytes_ / sizeof(T)));
+        if (bytes_ > 0)
+        {
+            std::ifstream f(path_, std::ios::binary);
+            f.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(out.size() * sizeof(T)));
+            ok_ = ok_ && f.gcount() == static_cast<std::streamsize>(out.size() * sizeof(T));
+        }
+        discard();
+        return ok_;
+    }
+
+private:
+    void flush()
+    {
+        if (buffer_.empty())
+            return;
+        std::ofstream f(path_, std::ios::binary | std::ios::app);
+        f.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        ok_ = ok_ && !!f;
+        bytes_ += buffer_.size();
+        buffer_.clear();
+    }
+
+    void discard()
+    {
+        if (bytes_ > 0)
+            std::remove(path_.c_str());
+        bytes_ = 0;
+        std::vector<char>().swap(buffer_);
+    }
+
+    std::string path_;
+    size_t capacity_;
+    std::vector<char> buffer_;
+    uint64_t bytes_ = 0;
+    bool ok_ = true;
+};
+
+// At most three bucket sets are alive at once (vertex and reference buckets while welding; reference, edge and
+// face buckets while triangles are rebuilt), so each set's write buffers get a twelfth of memoryBytes and the
+// bucket being processed, with its working tables, gets the remaining three quarters.
+size_t bufferBudget(size_t memoryBytes) { return memoryBytes / 12; }
+size_t workBudget(size_t memoryBytes) { return memoryBytes - 3 * bufferBudget(memoryBytes); }
+
+// Fixed number of spill files holding records of type T, whose write buffers share bufferBytes.
+template <class T>
+class Buckets {
+public:
+    Buckets(const std::string& prefix, size_t count, size_t bufferBytes)
+    {
+        const size_t buffer = std::min<size_t>(std::max<size_t>(bufferBytes / count, 4096), 1 << 20);
+        for (size_t b = 0; b < count; ++b)
+            files_.emplace_back(new SpillFile(prefix + "_" + std::to_string(b) + ".tmp", buffer));
+    }
+
+    size_t size() const { return files_.size(); }
+    void add(size_t b, const T& rec) { files_[b]->append(&rec, sizeof rec); }
+    /** Read bucket b back (and delete its file). */
+    bool load(size_t b, std::vector<T>& out) { return files_[b]->load(out); }
+    bool ok() const
+    {
+        for (const auto& f : files_)
+            if (!f->ok()) return false;
+        return true;
+    }
+
+private:
+    std::vector<std::unique_ptr<SpillFile>> files_;
+};
+
+// Buckets needed so that `records` records of `bytesPerRecord` working bytes each fit the work budget per bucket.
+size_t bucketCount(uint64_t records, size_t bytesPerRecord, size_t memoryBytes)
+{
+    const uint64_t perBucket = std::max<uint64_t>(workBudget(memoryBytes) / bytesPerRecord, 1);
+    return static_cast<size_t>(std::max<uint64_t>((records + perBucket - 1) / perBucket, 1));
+}
+
+std::string spillPrefix(const StreamOptions& opts)
+{
+    static std::atomic<unsigned> counter(0);
+    const std::string dir = opts.spillDir.empty() ? std::string(".") : opts.spillDir;
+    return dir + "/stl_stream_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "_" +
+        std::to_string(counter++);
+}
+
+inline uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t floatBits(float f)
+{
+    f += 0.f;  // -0 -> +0, as VertexWelder keys
+    uint32_t u;
+    std::memcpy(&u, &f, 4);
+    return u;
+}
+
+inline uint64_t positionHash(const Vec3& v)
+{
+    return mix(floatBits(v.x) ^ mix(floatBits(v.y) ^ mix(floatBits(v.z))));
+}
+
+struct VertexRef {
+    Vec3 position;
+    uint32_t pad;
+    uint64_t ref;  // 3 * triangle + corner
+};
+struct RefId {
+    uint64_t ref, id;
+};
+struct EdgeKey {
+    uint64_t lo, hi;
+    bool operator<(const EdgeKey& o) const { return lo != o.lo ? lo < o.lo : hi < o.hi; }
+    bool operator==(const EdgeKey& o) const { return lo == o.lo && hi == o.hi; }
+};
+struct FaceKey {
+    uint64_t v[3];
+    bool operator<(const FaceKey& o) const { return std::lexicographical_compare(v, v + 3, o.v, o.v + 3); }
+    bool operator==(const FaceKey& o) const { return v[0] == o.v[0] && v[1] == o.v[1] && v[2] == o.v[2]; }
+};
+
+// Working bytes per record while a bucket is processed: the record plus, for vertices, a worst-case share of the
+// welding table (16-byte slots at load factor 1/2 and the 12-byte position).
+const size_t kVertexRefWorkBytes = sizeof(VertexRef) + 44;
+const size_t kRefIdWorkBytes = sizeof(RefId) + sizeof(uint64_t);
+
+// The three passes of an out-of-core weld. partition() reads the file once, accumulating the per-triangle totals
+// of StreamReport and sending every vertex reference to a bucket by position hash. weld() welds each bucket on its
+// own and sends (reference, id) pairs to buckets by reference range. forEachTriangle() rebuilds each range and
+// reports every triangle's vertex ids in file order.
+class StreamWelder {
+public:
+    explicit StreamWelder(const StreamOptions& opts) : opts_(opts), prefix_(spillPrefix(opts)) {}
+
+    bool partition(const std::string& path, StreamReport& report)
+    {
+        FacetSource src;
+        if (!src.open(path))
+            return false;
+        vertexBuckets_.reset(new Buckets<VertexRef>(prefix_ + "_v",
+            bucketCount(src.estimate() * 3, kVertexRefWorkBytes, opts_.memoryBytes), bufferBudget(opts_.memoryBytes)));
+        Buckets<VertexRef>& buckets = *vertexBuckets_;
+        const float areaEps = 1e-10f, windingTol = 1e-5f;  // as checkWatertight() / checkRightHandWinding()
+        double sum = 0.;
+        std::vector<Triangle> batch;
+        uint64_t ref = 0;
+        while (src.next(batch))
+        {
+            for (const Triangle& t : batch)
+            {
+                const Vec3& a = t.v0;
+                const Vec3& b = t.v1;
+                const Vec3& c = t.v2;
+                sum += (a.x * (b.y * c.z - b.z * c.y) + a.y * (b.z * c.x - b.x * c.z) + a.z * (b.x * c.y - b.y * c.x)) / 6.0;
+                float ex = b.x - a.x, ey = b.y - a.y, ez = b.z - a.z;
+                float fx = c.x - a.x, fy = c.y - a.y, fz = c.z - a.z;
+                float nx = ey * fz - ez * fy, ny = ez * fx - ex * fz, nz = ex * fy - ey * fx;
+                if (nx * nx + ny * ny + nz * nz <= areaEps * areaEps) ++report.degenerateTriangles;
+                const Vec3 n = StlReader::facetNormal(a, b, c);
+                if (n.x * n.x + n.y * n.y + n.z * n.z > 0.f)
+                {
+                    const float dot = n.x * t.normal.x + n.y * t.normal.y + n.z * t.normal.z;
+                    if (dot > windingTol) ++report.windingOk;
+                    else if (dot < -windingTol) ++report.windingOpposite;
+                }
+                for (const Vec3* v : { &a, &b, &c })
+                {
+                    const VertexRef r = { *v, 0, ref++ };
+                    buckets.add(static_cast<size_t>(positionHash(*v) % buckets.size()), r);
+                }
+            }
+        }
+        if (src.failed())
+            return false;
+        report.triangles = triangles_ = ref / 3;
+        report.volume = sum < 0 ? -sum : sum;
+        return buckets.ok();
+    }
+
+    /** Weld every vertex bucket; unique positions are appended to vertexOut (if given) in id order. */
+    bool weld(std::ostream* vertexOut, uint64_t& uniqueVertices)
+    {
+        const uint64_t refs = triangles_ * 3;
+        // Each range of references is rebuilt as an id array at once; ranges hold whole triangles.
+        rangeRefs_ = std::max<uint64_t>(workBudget(opts_.memoryBytes) / kRefIdWorkBytes / 3 * 3, 3);
+        refBuckets_.reset(new Buckets<RefId>(prefix_ + "_r",
+            static_cast<size_t>(std::max<uint64_t>((refs + rangeRefs_ - 1) / rangeRefs_, 1)), bufferBudget(opts_.memoryBytes)));
+        uint64_t base = 0;
+        std::vector<VertexRef> recs;
+        for (size_t b = 0; b < vertexBuckets_->size(); ++b)
+        {
+            if (!vertexBuckets_->load(b, recs))
+                return false;
+            VertexWelder welder(recs.size() / 4 + 16);
+            for (const VertexRef& r : recs)
+                refBuckets_->add(static_cast<size_t>(r.ref / rangeRefs_), { r.ref, base + welder.insert(r.position) });
+            const std::vector<Vec3>& verts = welder.vertices();
+            if (vertexOut && !verts.empty())
+                vertexOut->write(reinterpret_cast<const char*>(verts.data()),
+                    static_cast<std::streamsize>(verts.size() * sizeof(Vec3)));
+            base += verts.size();
+        }
+        vertexBuckets_.reset();
+        uniqueVertices = base;
+        return refBuckets_->ok() && (!vertexOut || !!*vertexOut);
+    }
+
+    /** Call fn(v0, v1, v2) with the vertex ids of every triangle, in file order. */
+    template <class Fn>
+    bool forEachTriangle(Fn&& fn)
+    {
+        std::vector<RefId> recs;
+        std::vector<uint64_t> ids;
+        for (size_t k = 0; k < refBuckets_->size(); ++k)
+        {
+            if (!refBuckets_->load(k, recs))
+                return false;
+            const uint64_t first = k * rangeRefs_;
+            ids.assign(static_cast<size_t>(std::min(rangeRefs_, triangles_ * 3 - first)), 0);
+            for (const RefId& r : recs)
+                ids[static_cast<size_t>(r.ref - first)] = r.id;
+            for (size_t i = 0; i + 2 < ids.size(); i += 3)
+                fn(ids[i], ids[i + 1], ids[i + 2]);
+        }
+        refBuckets_.reset();
+        return true;
+    }
+
+    uint64_t triangles() const { return triangles_; }
+    const std::string& prefix() const { return prefix_; }
+
+private:
+    StreamOptions opts_;
+    std::string prefix_;
+    uint64_t triangles_ = 0;
+    uint64_t rangeRefs_ = 3;
+    std::unique_ptr<Buckets<VertexRef>> vertexBuckets_;
+    std::unique_ptr<Buckets<RefId>> refBuckets_;
+};
+} // namespace
+
+bool streamVolume(const std::string& path, double& volume)
+{
+    FacetSource src;
+    if (!src.open(path))
+        return false;
+    double sum = 0.;
+    std::vector<Triangle> batch;
+    while (src.next(batch))
+    {
+        for (const Triangle& t : batch)
+        {
+            const Vec3& a = t.v0;
+            const Vec3& b = t.v1;
+            const Vec3& c = t.v2;
+            sum += (a.x * (b.y * c.z - b.z * c.y) + a.y * (b.z * c.x - b.x * c.z) + a.z * (b.x * c.y - b.y * c.x)) / 6.0;
+        }
+    }
+    if (src.failed())
+        return false;
+    volume = sum < 0 ? -sum : sum;
+    return true;
+}
+
+bool streamWeld(const std::string& path, const std::string& vertexPath, const std::string& indexPath,
+    uint64_t& uniqueVertices, const StreamOptions& opts)
+{
+    StreamWelder welder(opts);
+    StreamReport report;
+    if (!welder.partition(path, report))
+        return false;
+    std::ofstream vf(vertexPath, std::ios::binary);
+    if (!vf || !welder.weld(&vf, uniqueVertices))
+        return false;
+    std::ofstream ixf(indexPath, std::ios::binary);
+    if (!ixf)
+        return false;
+    if (!welder.forEachTriangle([&](uint64_t a, uint64_t b, uint64_t c) {
+            const uint64_t tri[3] = { a, b, c };
+            ixf.write(reinterpret_cast<const char*>(tri), sizeof tri);
+        }))
+        return false;
+    return !!vf.flush() && !!ixf.flush();
+}
+
+bool streamValidate(const std::string& path, StreamReport& report, const StreamOptions& opts)
+{
+    report = StreamReport();
+    StreamWelder welder(opts);
+    if (!welder.partition(path, report) || !welder.weld(nullptr, report.uniqueVertices))
+        return false;
+
+    const uint64_t n = welder.triangles();
+    Buckets<EdgeKey> edges(welder.prefix() + "_e", bucketCount(n * 3, sizeof(EdgeKey), opts.memoryBytes),
+        bufferBudget(opts.memoryBytes));
+    Buckets<FaceKey> faces(welder.prefix() + "_f", bucketCount(n, sizeof(FaceKey), opts.memoryBytes),
+        bufferBudget(opts.memoryBytes));
+    if (!welder.forEachTriangle([&](uint64_t a, uint64_t b, uint64_t c) {
+            FaceKey f = { { a, b, c } };
+            std::sort(f.v, f.v + 3);
+            faces.add(static_cast<size_t>(mix(f.v[0] ^ mix(f.v[1] ^ mix(f.v[2]))) % faces.size()), f);
+            const uint64_t v[3] = { a, b, c };
+            for (int k = 0; k < 3; ++k)
+            {
+                const EdgeKey e = { std::min(v[k], v[(k + 1) % 3]), std::max(v[k], v[(k + 1) % 3]) };
+                edges.add(static_cast<size_t>(mix(e.lo ^ mix(e.hi)) % edges.size()), e);
+            }
+        }))
+        return false;
+
+    std::vector<EdgeKey> edgeRecs;
+    for (size_t b = 0; b < edges.size(); ++b)
+    {
+        if (!edges.load(b, edgeRecs))
+            return false;
+        std::sort(edgeRecs.begin(), edgeRecs.end());
+        for (size_t i = 0; i < edgeRecs.size();)
+        {
+            size_t j = i + 1;
+            while (j < edgeRecs.size() && edgeRecs[j] == edgeRecs[i]) ++j;
+            ++report.uniqueEdges;
+            if (j - i == 1) ++report.boundaryEdges;
+            else if (j - i > 2) ++report.nonManifoldEdges;
+            i = j;
+        }
+    }
+    std::vector<EdgeKey>().swap(edgeRecs);
+    std::vector<FaceKey> faceRecs;
+    for (size_t b = 0; b < faces.size(); ++b)
+    {
+        if (!faces.load(b, faceRecs))
+            return false;
+        std::sort(faceRecs.begin(), faceRecs.end());
+        for (size_t i = 1; i < faceRecs.size(); ++i)
+            if (faceRecs[i] == faceRecs[i - 1]) ++report.duplicateTriangles;
+    }
+    return edges.ok() && faces.ok();
+}
+
+void printStreamReport(const StreamReport& r, std::ostream& out)
+{
+    if (r.triangles == 0)
+    {
+        out << "Watertight: no triangles\n";
+        out << "Right-hand rule: 0 OK, 0 opposite winding\n";
+        out << "Volume: " << std::fixed << std::setprecision(10) << r.volume << "\n";
+        return;
+    }
+    if (r.duplicateTriangles > 0)
+        out << "Duplicate triangles: " << r.duplicateTriangles << "\n";
+    out << "Edges: " << r.uniqueEdges << " unique; " << r.boundaryEdges << " boundary (count=1), "
+        << r.nonManifoldEdges << " non-manifold (count>2)\n";
+    if (r.degenerateTriangles > 0)
+        out << "Degenerate triangles (zero area): " << r.degenerateTriangles << "\n";
+    out << "Vertices: " << r.uniqueVertices << " unique (from " << r.triangles << " triangles)\n";
+    out << "Watertight: " << (r.watertight() ? "yes" : "no") << "\n";
+    out << "Right-hand rule: " << r.windingOk << " OK, " << r.windingOpposite << " opposite winding\n";
+    out << "Volume: " << std::fixed << std::setprecision(10) << r.volume << "\n";
+}
@@ -0,0 +1,59 @@
+#ifndef STL_STREAM_H
+#define STL_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+/** Out-of-core processing of STL files too large for StlReader (whose binary reader stops at 100M triangles and
+ *  keeps several copies of the mesh). The input is read sequentially from a memory mapping in batches; vertex,
+ *  edge and face records are hash-partitioned into temporary bucket files under spillDir and each bucket is then
+ *  processed on its own, so working memory stays near memoryBytes whatever the mesh size: a quarter of it holds
+ *  the write buffers of the bucket files and the rest the one bucket being processed. It can go over when hashing
+ *  makes a bucket larger than its share (the bucket is still loaded whole) or when the budget is so small against
+ *  the mesh that every bucket file is down to its 4 KB minimum buffer. Results match the in-memory checks on the
+ *  same file. */
+struct StreamOptions {
+    size_t memoryBytes = size_t(512) << 20;
+    std::string spillDir = ".";
+};
+
+/** Totals from streamValidate(), the counterparts of checkWatertight() / checkRightHandWinding() / volume(). */
+struct StreamReport {
+    uint64_t triangles = 0;
+    uint64_t uniqueVertices = 0;
+    uint64_t uniqueEdges = 0;
+    uint64_t boundaryEdges = 0;
+    uint64_t nonManifoldEdges = 0;
+    uint64_t duplicateTriangles = 0;
+    uint64_t degenerateTriangles = 0;
+    uint64_t windingOk = 0;
+    uint64_t windingOpposite = 0;
+    double volume = 0.;
+
+    bool watertight() const
+    {
+        return triangles > 0 && duplicateTriangles == 0 && boundaryEdges == 0 && nonManifoldEdges == 0 && degenerateTriangles == 0;
+    }
+};
+
+/** Volume of the STL at path in one sequential pass (signed tetrahedron sum, as StlReader::volume()). */
+bool streamVolume(const std::string& path, double& volume);
+
+/** Weld the STL at path out of core. Writes the unique positions to vertexPath (float32 x, y, z per vertex) and
+ *  the triangles to indexPath (uint64 v0, v1, v2 per triangle, in file order). Vertices are numbered bucket by
+ *  bucket, in first-occurrence order within a bucket, so the numbering depends on memoryBytes. */
+bool streamWeld(const std::string& path, const std::string& vertexPath, const std::string& indexPath,
+    uint64_t& uniqueVertices, const StreamOptions& opts = StreamOptions());
+
+/** Weld, edge / duplicate-face / degenerate checks, right-hand rule and volume of the STL at path, out of core.
+ *  A binary file declaring zero triangles succeeds with zero counts; false on an unreadable, short or malformed
+ *  file and on an ASCII file without facets, as StlReader::read(). */
+bool streamValidate(const std::string& path, StreamReport& report, const StreamOptions& opts = StreamOptions());
+
+/** Print a report in the layout of checkWatertight() and checkRightHandWinding() (without the per-triangle
+ *  winding lines), followed by the volume. */
+void printStreamReport(const StreamReport& report, std::ostream& out);
+
+#endif
@@ -0,0 +1,243 @@
+#include "vertex_weld.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+inline uint32_t floatKey(float f)
+{
+    f += 0.f;  // -0 -> +0
+    uint32_t u;
+    std::memcpy(&u, &f, 4);
+    return u;
+}
+
+inline size_t hashKey(const uint32_t k[3])
+{
+    uint64_t h = k[0] * 0x9E3779B97F4A7C15ull;
+    h ^= k[1] * 0xC2B2AE3D27D4EB4Full;
+    h ^= k[2] * 0x165667B19E3779F9ull;
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    return static_cast<size_t>(h);
+}
+
+// Grid cell of coordinate x; non-finite and out-of-range values land in the outermost cells.
+inline int64_t cellCoord(float x, double inverseCell)
+{
+    const double c = std::floor(static_cast<double>(x) * inverseCell);
+    const double limit = 4e18;
+    if (!(c > -limit)) return static_cast<int64_t>(-limit);
+    return static_cast<int64_t>(std::min(c, limit));
+}
+
+inline size_t hashCell(const int64_t c[3])
+{
+    const uint32_t k[3] = { static_cast<uint32_t>(c[0] ^ (c[0] >> 32)), static_cast<uint32_t>(c[1] ^ (c[1] >> 32)),
+        static_cast<uint32_t>(c[2] ^ (c[2] >> 32)) };
+    return hashKey(k);
+}
+
+StlReader::Index findRoot(std::vector<StlReader::Index>& parent, StlReader::Index x)
+{
+    while (parent[x] != x)
+    {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+} // namespace
+
+VertexWelder::VertexWelder(size_t expectedUnique, Arena* arena) : slots_(arena)
+{
+    size_t cap = 16;
+    while (cap < expectedUnique * 2) cap <<= 1;
+    rehash(cap);
+    vertices_.reserve(expectedUnique);
+}
+
+void VertexWelder::rehash(size_t capacity)
+{
+    ScratchVector<Slot> old(slots_.get_allocator());
+    old.swap(slots_);
+    Slot empty = { { 0, 0, 0 }, kEmpty };
+    slots_.assign(capacity, empty);
+    mask_ = capacity - 1;
+    for (const Slot& s : old)
+    {
+        if (s.id == kEmpty) continue;
+        size_t i = hashKey(s.key) & mask_;
+        while (slots_[i].id != kEmpty) i = (i + 1) & mask_;
+        slots_[i] = s;
+    }
+}
+
+size_t VertexWelder::insert(const StlReader::Vec3& v)
+{
+    const uint32_t key[3] = { floatKey(v.x), floatKey(v.y), floatKey(v.z) };
+    size_t i = hashKey(key) & mask_;
+    for (;;)
+    {
+        Slot& s = slots_[i];
+        if (s.id == kEmpty) break;
+        if (s.key[0] == key[0] && s.key[1] == key[1] && s.key[2] == key[2])
+            return s.id;
+        i = (i + 1) & mask_;
+    }
+    const size_t id = vertices_.size();
+    if (id >= kEmpty)
+        throw std::length_error("VertexWelder: more than 2^32 - 1 unique vertices");
+    Slot& s = slots_[i];
+    std::memcpy(s.key, key, sizeof key);
+    s.id = static_cast<uint32_t>(id);
+    vertices_.push_back(v);
+    if ((vertices_.size() + 1) * 2 > slots_.size())
+        rehash(slots_.size() * 2);
+    return id;
+}
+
+size_t weldWithinEpsilon(const std::vector<StlReader::Vec3>& vertices, float epsilon, unsigned threads,
+    std::vector<StlReader::Index>& remap)
+{
+    typedef StlReader::Index Index;
+    const size_t n = vertices.size();
+    remap.resize(n);
+    for (size_t v = 0; v < n; ++v)
+        remap[v] = static_cast<Index>(v);
+    if (n < 2 || !(epsilon > 0.f))
+        return n;
+
+    // Bin the vertices: an open-addressing table maps cell coordinates to a cell number, then a counting sort
+    // lists each cell's vertices in ascending id order.
+    const unsigned workers = resolveThreadCount(threads);
+    const double inverseCell = 1.0 / epsilon;
+    std::vector<int64_t> coords(n * 3);
+    parallelFor(n, 16384, workers, [&](size_t begin, size_t end, unsigned) {
+        for (size_t v = begin; v < end; ++v) {
+            coords[3 * v] = cellCoord(vertices[v].x, inverseCell);
+            coords[3 * v + 1] = cellCoord(vertices[v].y, inverseCell);
+            coords[3 * v + 2] = cellCoord(vertices[v].z, inverseCell);
+        }
+    });
+    const uint32_t kNone = 0xFFFFFFFFu;
+    struct CellSlot {
+        int64_t key[3];
+        uint32_t cell;  // kNone when unused
+    };
+    size_t capacity = 16;
+    while (capacity < n * 2) capacity <<= 1;
+    const size_t mask = capacity - 1;
+    std::vector<CellSlot> table(capacity, CellSlot{ { 0, 0, 0 }, kNone });
+    auto lookup = [&](const int64_t c[3]) {
+        size_t i = hashCell(c) & mask;
+        while (table[i].cell != kNone && (table[i].key[0] != c[0] || table[i].key[1] != c[1] || table[i].key[2] != c[2]))
+            i = (i + 1) & mask;
+        return i;
+    };
+    // One bit per hash value of every occupied cell (16 bits per vertex, so it stays in cache): most neighbour
+    // cells of a surface point are empty, and this rejects them without touching the table.
+    size_t bits = 64;
+    while (bits < n * 16) bits <<= 1;
+    std::vector<uint64_t> occupied(bits / 64, 0);
+    std::vector<uint32_t> cellOf(n);
+    std::vector<size_t> cellFirst;  // a vertex of each cell, whose coords are the cell's key
+    for (size_t v = 0; v < n; ++v)
+    {
+        const size_t h = hashCell(&coords[3 * v]) & (bits - 1);
+        occupied[h / 64] |= uint64_t(1) << (h % 64);
+        CellSlot& slot = table[lookup(&coords[3 * v])];
+        if (slot.cell == kNone)
+        {
+            std::memcpy(slot.key, &coords[3 * v], sizeof slot.key);
+            slot.cell = static_cast<uint32_t>(cellFirst.size());
+            cellFirst.push_back(v);
+        }
+        cellOf[v] = slot.cell;
+    }
+    const size_t cells = cellFirst.size();
+    std::vector<size_t> cellStart(cells + 1, 0);
+    for (size_t v = 0; v < n; ++v)
+        ++cellStart[cellOf[v] + 1];
+    for (size_t c = 0; c < cells; ++c)
+        cellStart[c + 1] += cellStart[c];
+    std::vector<Index> members(n);
+    {
+        std::vector<size_t> next(cellStart.begin(), cellStart.end() - 1);
+        for (size_t v = 0; v < n; ++v)
+            members[next[cellOf[v]]++] = static_cast<Index>(v);
+    }
+
+    // Joins are made as pairs are found, so memory stays linear however many points share a cell. First each cell
+    // is joined on its own; cells are disjoint, so workers union into the shared parent table without locks, and a
+    // member already joined to the one it is compared with needs no distance test.
+    const double eps2 = static_cast<double>(epsilon) * epsilon;
+    auto close = [&](Index a, Index b) {
+        const double dx = static_cast<double>(vertices[a].x) - vertices[b].x;
+        const double dy = static_cast<double>(vertices[a].y) - vertices[b].y;
+        const double dz = static_cast<double>(vertices[a].z) - vertices[b].z;
+        return dx * dx + dy * dy + dz * dz <= eps2;
+    };
+    // Union by lower root, so each group's root is its lowest id whatever order the joins come in.
+    auto unite = [](std::vector<Index>& parent, Index a, Index b) {
+        a = findRoot(parent, a);
+        b = findRoot(parent, b);
+        if (a < b) parent[b] = a;
+        else if (b < a) parent[a] = b;
+    };
+    std::vector<Index> parent(remap);
+    parallelFor(cells, 256, workers, [&](size_t begin, size_t end, unsigned) {
+        for (size_t c = begin; c < end; ++c) {
+            const size_t b0 = cellStart[c], b1 = cellStart[c + 1];
+            for (size_t i = b0; i < b1; ++i)
+                for (size_t j = i + 1; j < b1; ++j)
+                    if (findRoot(parent, members[i]) != findRoot(parent, members[j]) && close(members[i], members[j]))
+                        unite(parent, members[i], members[j]);
+            for (size_t i = b0; i < b1; ++i)
+                parent[members[i]] = findRoot(parent, members[i]);
+        }
+    });
+
+    // Then each cell against the 13 neighbours that follow it in (dx, dy, dz) order. Parents are read-only here,
+    // and a worker keeps one link per pair of cell groups, tested only until some pair of their members is close.
+    // Points of one cell in different groups are more than epsilon apart, so a cell of finite points holds a few
+    // groups at most and the links total a small multiple of the cell count; they are united serially afterwards.
+    static const int kForward[13][3] = { { 0, 0, 1 }, { 0, 1, -1 }, { 0, 1, 0 }, { 0, 1, 1 }, { 1, -1, -1 },
+        { 1, -1, 0 }, { 1, -1, 1 }, { 1, 0, -1 }, { 1, 0, 0 }, { 1, 0, 1 }, { 1, 1, -1 }, { 1, 1, 0 }, { 1, 1, 1 } };
+    std::vector<std::vector<std::pair<Index, Index>>> links(workers);
+    parallelFor(cells, 256, workers, [&](size_t begin, size_t end, unsigned worker) {
+        std::vector<std::pair<Index, Index>>& out = links[worker];
+        for (size_t c = begin; c < end; ++c) {
+            const size_t b0 = cellStart[c], b1 = cellStart[c + 1];
+            const int64_t* key = &coords[3 * cellFirst[c]];
+            for (const int* d : kForward) {
+                const int64_t nk[3] = { key[0] + d[0], key[1] + d[1], key[2] + d[2] };
+                const size_t h = hashCell(nk) & (bits - 1);
+                if (!(occupied[h / 64] >> (h % 64) & 1)) continue;
+                const uint32_t other = table[lookup(nk)].cell;
+                if (other == kNone) continue;
+                const size_t found = out.size();
+                for (size_t i = b0; i < b1; ++i)
+                    for (size_t j = cellStart[other]; j < cellStart[other + 1]; ++j) {
+                        const std::pair<Index, Index> link(parent[members[i]], parent[members[j]]);
+                        if (std::find(out.begin() + found, out.end(), link) == out.end() && close(members[i], members[j]))
+                            out.push_back(link);
+                    }
+            }
+        }
+    });
+    for (const auto& list : links)
+        for (const auto& p : list)
+            unite(parent, p.first, p.second);
+    size_t groups = 0;
+    for (size_t v = 0; v < n; ++v)
+    {
+        const Index root = findRoot(parent, static_cast<Index>(v));
+        remap[v] = root == v ? static_cast<Index>(groups++) : remap[root];
+    }
+    return groups;
+}
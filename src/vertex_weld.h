@@ -0,0 +1,52 @@
+#ifndef VERTEX_WELD_H
+#define VERTEX_WELD_H
+
+#include "arena.h"
+#include "stl_reader.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/** Merges bit-identical vertex positions, numbering unique vertices in first-occurrence order (the order the
+ *  previous std::map<Vec3, size_t> welding produced). Open-addressing hash table with linear probing, keyed on
+ *  the float bit patterns; -0 is folded into +0 so keys agree with Vec3::operator<. */
+class VertexWelder {
+public:
+    /** expectedUnique sizes the table up front; it grows as needed. With an arena the hash table is taken from
+     *  it; the vertex list always lives on the heap so it can be moved out. */
+    explicit VertexWelder(size_t expectedUnique = 0, Arena* arena = nullptr);
+
+    /** Id of v, adding it as a new vertex if not seen before. */
+    size_t insert(const StlReader::Vec3& v);
+
+    size_t size() const { return vertices_.size(); }
+    /** Unique positions in id order; take with std::move when done. */
+    std::vector<StlReader::Vec3>& vertices() { return vertices_; }
+    const std::vector<StlReader::Vec3>& vertices() const { return vertices_; }
+
+private:
+    struct Slot {
+        uint32_t key[3];
+        uint32_t id;  // kEmpty when unused
+    };
+    static const uint32_t kEmpty = 0xFFFFFFFFu;
+
+    void rehash(size_t capacity);
+
+    ScratchVector<Slot> slots_;
+    size_t mask_ = 0;
+    std::vector<StlReader::Vec3> vertices_;
+};
+
+/** Tolerance weld of an already bit-exact welded vertex table: vertices closer than epsilon (Euclidean) are
+ *  joined, transitively, so a chain of close points becomes one vertex. Points are binned into a uniform hash
+ *  grid of cell size epsilon; each cell is compared with itself and its 13 forward neighbours, so cost stays
+ *  linear for well-spread points. Memory is linear in any case; time grows with the square of the points per
+ *  cell, so an epsilon far above the spacing of the vertices is slow. Cells are processed on `threads` workers
+ *  (0 = all hardware threads). On return remap[v] is the new id of vertex v: every group keeps its lowest old id
+ *  as representative, and the representatives are renumbered in their old order. Returns the number of groups (vertices.size() when
+ *  nothing is merged or epsilon is not positive). */
+size_t weldWithinEpsilon(const std::vector<StlReader::Vec3>& vertices, float epsilon, unsigned threads,
+    std::vector<StlReader::Index>& remap);
+
+#endif
@@ -0,0 +1,177 @@
+#include "winding_number.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const double kPi = 3.14159265358979323846;
+
+// Area-weighted normal (half the cross product) and centroid of triangle (a, b, c).
+void triangleMoments(const StlReader::Vec3& a, const StlReader::Vec3& b, const StlReader::Vec3& c, double an[3], double centroid[3])
+{
+    const double ex = b.x - a.x, ey = b.y - a.y, ez = b.z - a.z;
+    const double fx = c.x - a.x, fy = c.y - a.y, fz = c.z - a.z;
+    an[0] = 0.5 * (ey * fz - ez * fy);
+    an[1] = 0.5 * (ez * fx - ex * fz);
+    an[2] = 0.5 * (ex * fy - ey * fx);
+    centroid[0] = (static_cast<double>(a.x) + b.x + c.x) / 3.;
+    centroid[1] = (static_cast<double>(a.y) + b.y + c.y) / 3.;
+    centroid[2] = (static_cast<double>(a.z) + b.z + c.z) / 3.;
+}
+} // namespace
+
+double triangleSolidAngle(const StlReader::Vec3& q, const StlReader::Vec3& a, const StlReader::Vec3& b, const StlReader::Vec3& c)
+{
+    const double ax = a.x - q.x, ay = a.y - q.y, az = a.z - q.z;
+    const double bx = b.x - q.x, by = b.y - q.y, bz = b.z - q.z;
+    const double cx = c.x - q.x, cy = c.y - q.y, cz = c.z - q.z;
+    const double la = std::sqrt(ax * ax + ay * ay + az * az);
+    const double lb = std::sqrt(bx * bx + by * by + bz * bz);
+    const double lc = std::sqrt(cx * cx + cy * cy + cz * cz);
+    const double det = ax * (by * cz - bz * cy) - ay * (bx * cz - bz * cx) + az * (bx * cy - by * cx);
+    const double div = la * lb * lc + (ax * bx + ay * by + az * bz) * lc + (bx * cx + by * cy + bz * cz) * la
+        + (cx * ax + cy * ay + cz * az) * lb;
+    return 2. * std::atan2(det, div);
+}
+
+void WindingNumberTree::build(const Bvh& bvh, const std::vector<StlReader::Vec3>& vertices,
+    const std::vector<StlReader::IndexedTri>& triangles)
+{
+    bvh_ = &bvh;
+    vertices_ = &vertices;
+    triangles_ = &triangles;
+    const std::vector<Bvh::Node>& nodes = bvh.nodes();
+    const std::vector<uint32_t>& prims = bvh.primIndices();
+    moments_.assign(nodes.size(), Moment());
+    // Area sums per node; children follow their parent in the depth-first layout, so a reverse sweep sees both
+    // children before the parent.
+    std::vector<double> area(nodes.size(), 0.);
+    for (size_t ni = nodes.size(); ni-- > 0;)
+    {
+        const Bvh::Node& n = nodes[ni];
+        Moment& m = moments_[ni];
+        double weighted[3] = { 0., 0., 0. };
+        if (n.count > 0)
+        {
+            for (uint32_t k = n.offset; k < n.offset + n.count; ++k)
+            {
+                const StlReader::IndexedTri& t = triangles[prims[k]];
+                double an[3], centroid[3];
+                triangleMoments(vertices[t.v0], vertices[t.v1], vertices[t.v2], an, centroid);
+                const double ar = std::sqrt(an[0] * an[0] + an[1] * an[1] + an[2] * an[2]);
+                for (int a = 0; a < 3; ++a)
+                {
+                    m.normal[a] += an[a];
+                    weighted[a] += ar * centroid[a];
+                }
+                area[ni] += ar;
+            }
+        }
+        else
+        {
+            for (uint32_t child : { static_cast<uint32_t>(ni + 1), n.offset })
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    m.normal[a] += moments_[child].normal[a];
+                    weighted[a] += area[child] * moments_[child].center[a];
+                }
+                area[ni] += area[child];
+            }
+        }
+        for (int a = 0; a < 3; ++a)
+            m.center[a] = area[ni] > 0. ? weighted[a] / area[ni] : 0.5 * (n.bmin[a] + n.bmax[a]);
+        // First moment about the centre just found: from the triangles in a leaf, else shifted from the children.
+        if (n.count > 0)
+        {
+            for (uint32_t k = n.offset; k < n.offset + n.count; ++k)
+            {
+                const StlReader::IndexedTri& t = triangles[prims[k]];
+                double an[3], centroid[3];
+                triangleMoments(vertices[t.v0], vertices[t.v1], vertices[t.v2], an, centroid);
+                for (int i = 0; i < 3; ++i)
+                    for (int j = 0; j < 3; ++j)
+                        m.first[3 * i + j] += an[i] * (centroid[j] - m.center[j]);
+            }
+        }
+        else
+        {
+            for (uint32_t child : { static_cast<uint32_t>(ni + 1), n.offset })
+            {
+                const Moment& cm = moments_[child];
+                for (int i = 0; i < 3; ++i)
+                    for (int j = 0; j < 3; ++j)
+                        m.first[3 * i + j] += cm.first[3 * i + j] + cm.normal[i] * (cm.center[j] - m.center[j]);
+            }
+        }
+        m.radius2 = 0.;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            double d2 = 0.;
+            for (int a = 0; a < 3; ++a)
+            {
+                const double d = ((corner >> a) & 1 ? n.bmax[a] : n.bmin[a]) - m.center[a];
+                d2 += d * d;
+            }
+            m.radius2 = std::max(m.radius2, d2);
+        }
+    }
+}
+
+double WindingNumberTree::evaluate(const StlReader::Vec3& q, uint64_t* exactTriangles) const
+{
+    if (moments_.empty())
+        return 0.;
+    const std::vector<Bvh::Node>& nodes = bvh_->nodes();
+    const std::vector<uint32_t>& prims = bvh_->primIndices();
+    const double far2 = kFarRatio * kFarRatio;
+    double sum = 0.;
+    uint64_t exactCount = 0;
+    uint32_t stack[128];  // deeper than any Bvh
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0)
+    {
+        const uint32_t ni = stack[--sp];
+        const Bvh::Node& n = nodes[ni];
+        const Moment& m = moments_[ni];
+        const double dx = m.center[0] - q.x, dy = m.center[1] - q.y, dz = m.center[2] - q.z;
+        const double d2 = dx * dx + dy * dy + dz * dz;
+        if (d2 > far2 * m.radius2)
+        {
+            // The node's solid angle about its centroid r = center - q: dipole N . r / |r|^3 plus the first-order
+            // term M : J(r) with J = I / |r|^3 - 3 r r^T / |r|^5.
+            const double inv3 = 1. / (d2 * std::sqrt(d2)), inv5 = inv3 / d2;
+            const double r[3] = { dx, dy, dz };
+            double rMr = 0.;
+            for (int i = 0; i < 3; ++i)
+                rMr += r[i] * (m.first[3 * i] * r[0] + m.first[3 * i + 1] * r[1] + m.first[3 * i + 2] * r[2]);
+            sum += (m.normal[0] * dx + m.normal[1] * dy + m.normal[2] * dz) * inv3
+                + (m.first[0] + m.first[4] + m.first[8]) * inv3 - 3. * rMr * inv5;
+            continue;
+        }
+        if (n.count > 0)
+        {
+            for (uint32_t k = n.offset; k < n.offset + n.count; ++k)
+            {
+                const StlReader::IndexedTri& t = (*triangles_)[prims[k]];
+                sum += triangleSolidAngle(q, (*vertices_)[t.v0], (*vertices_)[t.v1], (*vertices_)[t.v2]);
+            }
+            exactCount += n.count;
+            continue;
+        }
+        stack[sp++] = n.offset;
+        stack[sp++] = ni + 1;
+    }
+    if (exactTriangles)
+        *exactTriangles += exactCount;
+    return sum / (4. * kPi);
+}
+
+double WindingNumberTree::exact(const StlReader::Vec3& q, const std::vector<StlReader::Vec3>& vertices,
+    const std::vector<StlReader::IndexedTri>& triangles)
+{
+    double sum = 0.;
+    for (const StlReader::IndexedTri& t : triangles)
+        sum += triangleSolidAngle(q, vertices[t.v0], vertices[t.v1], vertices[t.v2]);
+    return sum / (4. * kPi);
+}
@@ -3,11 +3,18 @@ set -e
 cd "$(dirname "$0")"
 CXX="${CXX:-clang++}"
 SDK=$(xcrun --show-sdk-path 2>/dev/null || true)
+# -ffp-contract=off: no fused multiply-add, so the scalar ray test rounds exactly as the vector kernels (and the
+# GPU build, --fmad=false) do; clang fuses a*b + c*d by default on arm64.
 if [ -n "$SDK" ]; then
   CXXINC="$SDK/usr/include/c++/v1"
-  CXXFLAGS="-std=c++17 -isysroot $SDK -stdlib=libc++ -I$CXXINC -I../src"
+  CXXFLAGS="-std=c++17 -ffp-contract=off -pthread -isysroot $SDK -stdlib=libc++ -I$CXXINC -I../src"
 else
-  CXXFLAGS="-std=c++17 -I../src"
+  CXXFLAGS="-std=c++17 -ffp-contract=off -pthread -I../src"
 fi
-$CXX $CXXFLAGS -o test_runner test_runner.cpp ../src/stl_reader.cpp
+# gzip / zstd compressed STL where zlib / libzstd are installed (header and library both found).
+have() { printf '#include <%s>\nint main() { return 0; }\n' "$1" | $CXX $CXXFLAGS $EXTRA_CXXFLAGS -x c++ - -o /dev/null "$2" >/dev/null 2>&1; }
+LIBS=""
+if have zlib.h -lz; then CXXFLAGS="$CXXFLAGS -DSTL_TOOL_ZLIB"; LIBS="$LIBS -lz"; fi
+if have zstd.h -lzstd; then CXXFLAGS="$CXXFLAGS -DSTL_TOOL_ZSTD"; LIBS="$LIBS -lzstd"; fi
+$CXX $CXXFLAGS $EXTRA_CXXFLAGS -o test_runner test_runner.cpp ../src/stl_reader.cpp ../src/compressed_io.cpp ../src/bvh.cpp ../src/parallel.cpp ../src/ray_kernel.cpp ../src/robust_ray.cpp ../src/mapped_file.cpp ../src/ascii_stl.cpp ../src/vertex_weld.cpp ../src/mesh_topology.cpp ../src/mesh_components.cpp ../src/morton.cpp ../src/arena.cpp ../src/even_hit_cache.cpp ../src/batch.cpp ../src/gpu_raycast_stub.cpp ../src/winding_number.cpp ../src/stl_stream.cpp ../src/fast_validate.cpp ../src/profile.cpp $LIBS
 echo "Run tests: ./test_runner (from tests/ directory)"
@@ -1,11 +1,40 @@
 #include "stl_reader.h"
+#include "arena.h"
+#include "batch.h"
+#include "bvh.h"
+#include "compressed_io.h"
+#include "even_hit_cache.h"
+#include "fast_validate.h"
+#include "gpu_raycast.h"
+#include "mesh_components.h"
+#include "mesh_topology.h"
+#include "morton.h"
+#include "parallel.h"
+#include "profile.h"
+#include "ray_kernel.h"
+#include "robust_ray.h"
+#include "stl_stream.h"
+#include "vertex_weld.h"
+#include "winding_number.h"
 #include <cassert>
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 static const char* simple_stl() {
@@ -15,6 +44,66 @@ static const char* simple_stl() {
     return paths[1];
 }
 
+static StlReader::Triangle makeTri(const StlReader::Vec3& a, const StlReader::Vec3& b, const StlReader::Vec3& c) {
+    StlReader::Triangle t{};
+    t.v0 = a; t.v1 = b; t.v2 = c;
+    float ex = b.x - a.x, ey = b.y - a.y, ez = b.z - a.z;
+    float fx = c.x - a.x, fy = c.y - a.y, fz = c.z - a.z;
+    float nx = ey * fz - ez * fy, ny = ez * fx - ex * fz, nz = ex * fy - ey * fx;
+    float len = std::sqrt(nx * nx + ny * ny + nz * nz);
+    if (len > 0.f) { t.normal.x = nx / len; t.normal.y = ny / len; t.normal.z = nz / len; }
+    return t;
+}
+
+// UV sphere, outward winding (inward = true reverses it, e.g. for a cavity wall).
+static void appendSphere(std::vector<StlReader::Triangle>& tris, float cx, float cy, float cz, float radius,
+    int slices, int stacks, bool inward) {
+    auto point = [&](int i, int j) {
+        const float pi = 3.14159265358979f;
+        float theta = pi * i / stacks, phi = 2.f * pi * (j % slices) / slices;
+        return StlReader::Vec3{ cx + radius * std::sin(theta) * std::cos(phi), cy + radius * std::sin(theta) * std::sin(phi),
+            cz + radius * std::cos(theta) };
+    };
+    auto add = [&](const StlReader::Vec3& a, const StlReader::Vec3& b, const StlReader::Vec3& c) {
+        tris.push_back(inward ? makeTri(a, c, b) : makeTri(a, b, c));
+    };
+    for (int i = 0; i < stacks; ++i) {
+        for (int j = 0; j < slices; ++j) {
+            StlReader::Vec3 p00 = point(i, j), p01 = point(i, j + 1), p10 = point(i + 1, j), p11 = point(i + 1, j + 1);
+            if (i > 0) add(p00, p10, p01);
+            if (i + 1 < stacks) add(p01, p10, p11);
+        }
+    }
+}
+
+// Hollow ball: outer sphere plus an inward-facing inner cavity, read back through an STL file.
+static bool readHollowBall(StlReader& r, const char* path) {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.f, 0.f, 0.f, 2.f, 24, 12, false);
+    appendSphere(tris, 0.f, 0.f, 0.f, 1.f, 16, 8, true);
+    if (!StlReader::writeAsciiStlFromTriangles(path, tris)) return false;
+    bool ok = r.read(path);
+    std::remove(path);
+    if (ok) r.removeDuplicateVertices();
+    return ok;
+}
+
+// Minimal binary STL writer for tests: 80-byte header, count, 50-byte records. declaredCount overrides the header count.
+static bool writeBinaryStlForTest(const char* path, const std::vector<StlReader::Triangle>& tris, long declaredCount = -1) {
+    std::ofstream f(path, std::ios::binary);
+    if (!f) return false;
+    char header[80] = "binary test";
+    f.write(header, 80);
+    uint32_t n = static_cast<uint32_t>(declaredCount >= 0 ? declaredCount : static_cast<long>(tris.size()));
+    f.write(reinterpret_cast<const char*>(&n), 4);
+    for (const StlReader::Triangle& t : tris) {
+        f.write(reinterpret_cast<const char*>(&t), 48);
+        const char attr[2] = { 0, 0 };
+        f.write(attr, 2);
+    }
+    return !!f;
+}
+
 static void test_volume_from_file() {
     const char* path = simple_stl();
     double vol = 0.;
@@ -183,6 +272,1448 @@ static void test_geometry_quality_report_content() {
     assert(s.find("Right-hand rule:") != std::string::npos && "report should contain Right-hand rule");
 }
 
+// --- BVH: every triangle lands in exactly one leaf, leaves respect the size limit
+static void test_bvh_structure() {
+    StlReader r;
+    assert(readHollowBall(r, "test_bvh_ball.stl"));
+    Bvh bvh;
+    bvh.build(r.vertices(), r.indexedTriangles(), 4);
+    assert(!bvh.empty() && bvh.triangleCount() == r.triangleCount());
+    std::vector<int> seen(r.triangleCount(), 0);
+    for (const Bvh::Node& n : bvh.nodes()) {
+        if (n.count == 0) continue;
+        assert(n.count <= 4 && "leaf size limit");
+        for (uint32_t i = n.offset; i < n.offset + n.count; ++i) ++seen[bvh.primIndices()[i]];
+    }
+    for (int c : seen) assert(c == 1 && "each triangle in exactly one leaf");
+}
+
+// --- BVH even-hit pass selects the same triangles as brute force
+static void test_bvh_matches_brute_force() {
+    StlReader r;
+    assert(readHollowBall(r, "test_bvh_ball.stl"));
+    StlReader::FluidOptions opts;
+    std::vector<size_t> withBvh, brute;
+    r.classifyEvenHit(withBvh, opts);  // no BVH built yet: temporary one
+    r.buildBvh();
+    assert(r.bvh() != nullptr);
+    std::vector<size_t> withBuilt;
+    r.classifyEvenHit(withBuilt, opts);
+    opts.bruteForce = true;
+    r.classifyEvenHit(brute, opts);
+    assert(!brute.empty() && "cavity wall should be even-hit");
+    assert(withBvh == brute && withBuilt == brute && "BVH and brute force agree");
+}
+
+// --- parallelFor: every item visited exactly once, worker ids in range
+static void test_parallel_for_covers_range() {
+    const size_t n = 1000;
+    std::vector<int> visits(n, 0);
+    parallelFor(n, 7, 4, [&](size_t begin, size_t end, unsigned worker) {
+        assert(worker < 4 && begin < end && end <= n);
+        for (size_t i = begin; i < end; ++i) ++visits[i];
+    });
+    for (int v : visits) assert(v == 1 && "each item once");
+    const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    assert(resolveThreadCount(0) == hw && resolveThreadCount(1) == 1);
+    assert(resolveThreadCount(~0u) == hw * kMaxOversubscription && "huge requests are capped");
+}
+
+// --- Multithreaded even-hit pass matches the serial result
+static void test_even_hit_thread_count_invariant() {
+    StlReader r;
+    assert(readHollowBall(r, "test_threads_ball.stl"));
+    r.buildBvh();
+    StlReader::FluidOptions opts;
+    opts.threads = 1;
+    std::vector<size_t> serial, parallel;
+    r.classifyEvenHit(serial, opts);
+    opts.threads = 5;
+    r.classifyEvenHit(parallel, opts);
+    assert(!serial.empty() && serial == parallel && "thread count does not change result");
+}
+
+// --- Packet ray kernel: every supported ISA reproduces the scalar rayIntersect() hits and distances
+static void test_ray_kernel_matches_scalar() {
+    StlReader r;
+    assert(readHollowBall(r, "test_kernel_ball.stl"));
+    TriangleSoA soa;
+    soa.build(r.vertices(), r.indexedTriangles());
+    assert(soa.size() == r.triangleCount());
+    const RayKernelIsa original = activeRayKernel();
+    unsigned seed = 12345u;
+    auto rnd = [&]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.f * 2.f - 1.f; };
+    for (RayKernelIsa isa : { RayKernelIsa::Scalar, RayKernelIsa::Sse, RayKernelIsa::Avx2, RayKernelIsa::Neon }) {
+        if (!setRayKernel(isa)) continue;
+        unsigned rngState = seed;
+        for (int ray = 0; ray < 50; ++ray) {
+            StlReader::Vec3 ro{ 0.3f * rnd(), 0.3f * rnd(), 0.3f * rnd() };
+            StlReader::Vec3 rd{ rnd(), rnd(), rnd() };
+            float len = std::sqrt(rd.x * rd.x + rd.y * rd.y + rd.z * rd.z);
+            rd.x /= len; rd.y /= len; rd.z /= len;
+            const float o[3] = { ro.x, ro.y, ro.z }, d[3] = { rd.x, rd.y, rd.z };
+            for (size_t first = 0; first < soa.size(); first += 5) {
+                size_t n = std::min<size_t>(kRayBlock, soa.size() - first);
+                float t[kRayBlock];
+                unsigned mask = intersectRayBlock(soa, first, n, o, d, t);
+                for (size_t k = 0; k < n; ++k) {
+                    float ts = 0.f;
+                    bool hit = r.rayIntersect(soa.ids[first + k], ro, rd, ts);
+                    assert(hit == ((mask >> k) & 1u) && "kernel hit mask matches scalar");
+                    assert((!hit || t[k] == ts) && "kernel distance matches scalar");
+                }
+            }
+        }
+        seed = rngState;
+    }
+    setRayKernel(original);
+}
+
+// --- Binary STL: mapped read, direct readIndexed weld, truncated file rejected
+static void test_binary_read_mapped() {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.f, 0.f, 0.f, 1.f, 12, 6, false);
+    const char* path = "test_binary_ball.stl";
+    assert(writeBinaryStlForTest(path, tris));
+    StlReader a, b;
+    assert(a.read(path) && "binary read");
+    a.removeDuplicateVertices();
+    assert(b.readIndexed(path) && "binary readIndexed");
+    assert(a.triangleCount() == tris.size() && b.triangleCount() == tris.size());
+    assert(a.vertices().size() == b.vertices().size());
+    for (size_t i = 0; i < a.vertices().size(); ++i)
+        assert(!(a.vertices()[i] < b.vertices()[i]) && !(b.vertices()[i] < a.vertices()[i]) && "same vertex numbering");
+    for (size_t i = 0; i < a.triangleCount(); ++i)
+        assert(a.indexedTriangles()[i].v0 == b.indexedTriangles()[i].v0 && a.indexedTriangles()[i].v2 == b.indexedTriangles()[i].v2);
+    assert(std::fabs(a.volume() - b.volume()) < 1e-12);
+    assert(b.header().compare(0, 11, "binary test") == 0);
+
+    assert(writeBinaryStlForTest(path, tris, static_cast<long>(tris.size()) + 1));
+    StlReader c;
+    assert(!c.read(path) && "header count beyond file size rejected");
+    assert(!c.readIndexed(path) && "header count beyond file size rejected (indexed)");
+    std::remove(path);
+}
+
+// --- Fast ASCII parser: multi-chunk threaded parse matches the original line parser exactly
+static void test_ascii_fast_matches_legacy() {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.5f, -1.25f, 3.f, 7.f, 120, 60, false);  // ~3 MB of text: several parse chunks
+    const char* path = "test_ascii_large.stl";
+    assert(StlReader::writeAsciiStlFromTriangles(path, tris));
+    StlReader fast, legacy;
+    StlReader::ReadOptions opts;
+    opts.threads = 4;
+    assert(fast.read(path, opts));
+    opts.fastAscii = false;
+    assert(legacy.read(path, opts));
+    assert(fast.header() == legacy.header());
+    fast.removeDuplicateVertices();
+    legacy.removeDuplicateVertices();
+    assert(fast.triangleCount() == tris.size() && legacy.triangleCount() == tris.size());
+    assert(fast.vertices().size() == legacy.vertices().size());
+    for (size_t i = 0; i < fast.vertices().size(); ++i)
+        assert(!(fast.vertices()[i] < legacy.vertices()[i]) && !(legacy.vertices()[i] < fast.vertices()[i]));
+    for (size_t i = 0; i < fast.triangleCount(); ++i)
+        assert(fast.indexedTriangles()[i].v1 == legacy.indexedTriangles()[i].v1);
+    std::remove(path);
+}
+
+// --- Fast ASCII parser: loose layout (split facet normal, tabs, upper case, missing outer loop, CRLF)
+static void test_ascii_loose_format() {
+    const char* path = "test_ascii_loose.stl";
+    {
+        std::ofstream f(path, std::ios::binary);
+        f << "solid loose\r\n"
+          << "facet\n  normal 0 0\n 1\r\n outer loop\n vertex 0 0 0\n vertex +1 0 0 vertex 0 1 0\nendloop endfacet\n"
+          << "\tFACET NORMAL 0 0 1\tVERTEX 1e0 1 0\tVERTEX 0 1 0 VERTEX 1 0 0\n"
+          << "facet normal bad 0 0\n outer loop\n vertex 0 0 0\n vertex 1 0 0\n vertex 0 1 0\n endloop\n endfacet\n"
+          << "endsolid loose\n";
+    }
+    StlReader r;
+    assert(r.read(path) && "loose ASCII parses");
+    r.removeDuplicateVertices();
+    assert(r.triangleCount() == 2 && "malformed normal skips only that facet");
+    assert(r.vertices().size() == 4);
+    {
+        std::ofstream f(path, std::ios::binary);
+        f << "solid broken\nfacet normal 0 0 1\n outer loop\n vertex 0 0 0\n vertex 1 x 0\n vertex 0 1 0\nendloop\nendfacet\n";
+    }
+    StlReader bad;
+    assert(!bad.read(path) && "malformed vertex fails the read");
+    std::remove(path);
+}
+
+// --- VertexWelder: same first-occurrence numbering as a std::map<Vec3, size_t> weld, -0 merged with +0
+static void test_vertex_welder_matches_map() {
+    unsigned seed = 777u;
+    auto rnd = [&]() { seed = seed * 1664525u + 1013904223u; return seed >> 16; };
+    std::vector<StlReader::Vec3> refs;
+    for (int i = 0; i < 20000; ++i)
+        refs.push_back({ static_cast<float>(rnd() % 17) * 0.5f, static_cast<float>(rnd() % 13), static_cast<float>(rnd() % 11) - 5.f });
+    refs.push_back({ -0.f, 0.f, 0.f });
+    refs.push_back({ 0.f, -0.f, 0.f });
+    std::map<StlReader::Vec3, size_t> ref;
+    VertexWelder welder(4);  // start small to exercise rehashing
+    for (const StlReader::Vec3& v : refs) {
+        auto it = ref.find(v);
+        size_t expected = it != ref.end() ? it->second : ref.size();
+        if (it == ref.end()) ref[v] = expected;
+        assert(welder.insert(v) == expected && "first-occurrence numbering");
+    }
+    assert(welder.size() == ref.size());
+}
+
+// --- Binary writers: exact roundtrip through writeBinaryStl / writeBinaryStlFromTriangles
+static void test_binary_write_roundtrip() {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.1f, 0.2f, 0.3f, 1.7f, 10, 5, false);
+    const char* path = "test_binary_out.stl";
+    assert(StlReader::writeBinaryStlFromTriangles(path, tris) && "binary write");
+    StlReader r;
+    assert(r.readIndexed(path) && "binary output reads back");
+    assert(r.triangleCount() == tris.size());
+    assert(r.header().compare(0, 5, "solid") != 0 && "binary header must not look like ASCII");
+    const StlReader::Triangle t = r.getTriangle(3);
+    assert(t.v0.x == tris[3].v0.x && t.v1.y == tris[3].v1.y && t.v2.z == tris[3].v2.z && "bit-exact vertices");
+    const double vol = r.volume();
+    assert(r.writeBinaryStl(path) && "writeBinaryStl");
+    double again = 0.;
+    assert(StlReader::volumeFromFile(path, again) && again == vol && "volume survives binary roundtrip exactly");
+    StlReader back;
+    assert(back.readIndexed(path) && back.header() == r.header() && "rewriting keeps the header label");
+
+    // The solid name of an ASCII input carries over to binary output, as it does to ASCII output.
+    r.setTriangles(tris, "solid named_part");
+    assert(r.writeBinaryStl(path));
+    assert(back.readIndexed(path) && back.header().find("named_part") != std::string::npos && "binary header keeps the solid name");
+    assert(back.header().compare(0, 5, "solid") != 0);
+    assert(!StlReader::writeBinaryStlFromTriangles("", tris) && "write to empty path should fail");
+    std::remove(path);
+}
+
+static std::string readFileBytes(const char* path) {
+    std::ifstream f(path, std::ios::binary);
+    std::ostringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+// --- ASCII writer: fixed facet layout, shortest round-trip floats, bytes independent of the thread count
+static void test_ascii_writer_stable_and_exact() {
+    StlReader::Triangle t = makeTri({ 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 0.5f, 0.f });
+    std::ostringstream one;
+    StlReader::writeOneFacet(one, t);
+    assert(one.str() == "  facet normal 0 0 1\n    outer loop\n      vertex 0 0 0\n      vertex 1 0 0\n      vertex 0 0.5 0\n"
+                        "    endloop\n  endfacet\n" && "facet layout");
+
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.1f, -0.3f, 2.7f, 3.3f, 200, 100, false);  // > 2 formatting ranges
+    const char* a = "test_ascii_w1.stl";
+    const char* b = "test_ascii_w3.stl";
+    assert(StlReader::writeAsciiStlFromTriangles(a, tris, 1) && StlReader::writeAsciiStlFromTriangles(b, tris, 3));
+    const std::string bytes = readFileBytes(a);
+    assert(!bytes.empty() && bytes == readFileBytes(b) && "same bytes for 1 and 3 threads");
+    StlReader r;
+    assert(r.read(a));
+    r.removeDuplicateVertices();
+    assert(r.triangleCount() == tris.size());
+    for (size_t i = 0; i < tris.size(); i += 97) {
+        StlReader::Triangle back = r.getTriangle(i);
+        assert(back.v0.x == tris[i].v0.x && back.v1.y == tris[i].v1.y && back.v2.z == tris[i].v2.z && "floats round-trip exactly");
+    }
+    std::remove(a);
+    std::remove(b);
+}
+
+static void test_set_triangles_matches_file() {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, -0.4f, 0.25f, 1.1f, 2.3f, 14, 7, false);
+    const char* path = "test_in_memory.stl";
+    assert(StlReader::writeAsciiStlFromTriangles(path, tris) && "write");
+    StlReader fromFile;
+    assert(fromFile.readIndexed(path));
+    StlReader inMemory;
+    inMemory.setTriangles(tris, "solid mem");
+    assert(inMemory.header() == "solid mem");
+    assert(inMemory.triangleCount() == fromFile.triangleCount());
+    assert(inMemory.vertices().size() == fromFile.vertices().size());
+    for (size_t i = 0; i < inMemory.triangleCount(); ++i) {
+        const StlReader::IndexedTri& a = inMemory.indexedTriangles()[i];
+        const StlReader::IndexedTri& b = fromFile.indexedTriangles()[i];
+        assert(a.v0 == b.v0 && a.v1 == b.v1 && a.v2 == b.v2 && "same welding as the written file");
+    }
+    assert(inMemory.volume() == fromFile.volume() && "in-memory volume equals re-read volume");
+    std::ostringstream a, b;
+    inMemory.checkWatertight(a);
+    inMemory.checkRightHandWinding(a);
+    fromFile.checkWatertight(b);
+    fromFile.checkRightHandWinding(b);
+    assert(a.str() == b.str() && "in-memory report equals re-read report");
+    // A reversed facet: the input lists it, the copy written with recomputed normals does not.
+    std::swap(tris[3].v1, tris[3].v2);
+    assert(StlReader::writeAsciiStlFromTriangles(path, tris));
+    StlReader misWound, written;
+    assert(misWound.readIndexed(path) && misWound.writeAsciiStl(path) && written.readIndexed(path));
+    std::ostringstream input, reread;
+    misWound.checkRightHandWinding(input);
+    written.checkRightHandWinding(reread);
+    assert(input.str().find(" 1 opposite winding") != std::string::npos);
+    const std::string all = "Right-hand rule: " + std::to_string(written.triangleCount()) + " OK, 0 opposite winding\n";
+    assert(reread.str() == all && "written normals follow the winding");
+    std::remove(path);
+}
+
+static void test_mesh_topology_matches_maps() {
+    // Random small-index triangles give boundary, manifold and non-manifold edges plus repeated faces.
+    std::vector<StlReader::IndexedTri> tris;
+    uint32_t seed = 12345;
+    auto rnd = [&]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) % 40; };
+    while (tris.size() < 600) {
+        StlReader::Index a = rnd(), b = rnd(), c = rnd();
+        if (a == b || b == c || c == a) continue;
+        tris.push_back({ a, b, c });
+        if (tris.size() % 7 == 0) tris.push_back({ c, a, b });  // same face, rotated
+    }
+    std::vector<size_t> subset;
+    for (size_t i = 0; i < tris.size(); i += 3) subset.push_back(i);
+    subset.push_back(tris.size() + 5);  // out of range: ignored
+
+    for (int useSubset = 0; useSubset < 2; ++useSubset) {
+        std::vector<size_t> order;
+        if (useSubset) order.assign(subset.begin(), subset.end() - 1);
+        else for (size_t i = 0; i < tris.size(); ++i) order.push_back(i);
+        MeshTopology topo;
+        if (useSubset) topo.build(tris, subset);
+        else topo.build(tris);
+
+        std::map<std::pair<size_t, size_t>, std::vector<std::pair<size_t, size_t>>> edges;
+        std::map<std::vector<size_t>, size_t> firstFace;
+        std::vector<size_t> dups;
+        for (size_t ti : order) {
+            const StlReader::IndexedTri& t = tris[ti];
+            const size_t v[3] = { t.v0, t.v1, t.v2 };
+            for (int k = 0; k < 3; ++k) {
+                size_t a = v[k], b = v[(k + 1) % 3];
+                edges[{ std::min(a, b), std::max(a, b) }].push_back({ a, b });
+            }
+            std::vector<size_t> key(v, v + 3);
+            std::sort(key.begin(), key.end());
+            if (!firstFace.insert({ key, ti }).second) dups.push_back(ti);
+        }
+        std::sort(dups.begin(), dups.end());
+        assert(topo.duplicateFaces() == dups && "duplicate faces");
+        assert(topo.edgeCount() == edges.size() && "unique edges");
+        size_t boundary = 0, nonManifold = 0, e = 0;
+        for (const auto& kv : edges) {
+            const MeshTopology::HalfEdge& h = topo.halfEdges()[topo.edgeBegin(e)];
+            assert(h.lo == kv.first.first && h.hi == kv.first.second && "edges in map order");
+            assert(topo.edgeBegin(e + 1) - topo.edgeBegin(e) == kv.second.size() && "edge use count");
+            if (kv.second.size() == 1) {
+                const MeshTopology::HalfEdge& b = topo.boundaryEdges()[boundary++];
+                assert(b.from == kv.second[0].first && b.to == kv.second[0].second && "boundary direction");
+                bool listed = false;
+                const auto out = topo.boundaryFrom(b.from);
+                for (const MeshTopology::HalfEdge* p = out.first; p != out.second; ++p) {
+                    assert(p->from == b.from);
+                    listed = listed || (p->to == b.to && p->tri == b.tri);
+                }
+                assert(listed && "boundaryFrom lists the edge");
+            }
+            if (kv.second.size() > 2) ++nonManifold;
+            ++e;
+        }
+        assert(topo.boundaryEdgeCount() == boundary && topo.nonManifoldEdgeCount() == nonManifold);
+    }
+}
+
+static void test_geometry_cache_matches_get_triangle() {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.3f, -1.2f, 0.7f, 1.9f, 12, 6, false);
+    tris.push_back(makeTri({ 0, 0, 0 }, { 1, 1, 1 }, { 2, 2, 2 }));  // zero area: normal falls back to the raw cross product
+    StlReader r;
+    r.setTriangles(tris);
+    const StlReader::TriangleGeometry& g = r.geometry();
+    assert(g.normals.size() == r.triangleCount() && g.centroids.size() == r.triangleCount());
+    for (size_t i = 0; i < r.triangleCount(); ++i) {
+        const StlReader::Triangle t = r.getTriangle(i);
+        assert(std::memcmp(&g.normals[i], &t.normal, sizeof t.normal) == 0 && "cached normal is bit-identical");
+        assert(g.edge1[i].x == t.v1.x - t.v0.x && g.edge1[i].y == t.v1.y - t.v0.y && g.edge1[i].z == t.v1.z - t.v0.z);
+        assert(g.edge2[i].x == t.v2.x - t.v0.x && g.edge2[i].y == t.v2.y - t.v0.y && g.edge2[i].z == t.v2.z - t.v0.z);
+        assert(g.centroids[i].y == (t.v0.y + t.v1.y + t.v2.y) / 3.f);
+    }
+    assert(&r.geometry() == &g && "cache is reused");
+    r.rebuildGeometry();
+    assert(r.geometry().normals.size() == r.triangleCount());
+
+    // Re-indexing drops the cache, so it follows the new mesh.
+    std::vector<StlReader::Triangle> fewer(tris.begin(), tris.begin() + 10);
+    r.setTriangles(fewer);
+    assert(r.geometry().normals.size() == 10 && "cache rebuilt for the new mesh");
+    r.invalidateGeometry();
+    std::ostringstream report;
+    r.checkRightHandWinding(report);
+    assert(report.str().find("Right-hand rule: 10 OK") != std::string::npos);
+}
+
+static void test_stream_validate_matches_in_memory() {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.5f, -0.25f, 2.f, 1.3f, 18, 9, false);
+    tris.erase(tris.begin() + 7);                                  // hole: boundary edges
+    tris.push_back(tris[20]);                                     // duplicate face
+    tris.push_back(makeTri({ 0, 0, 0 }, { 1, 0, 0 }, { 2, 0, 0 }));  // degenerate
+    std::swap(tris[30].v1, tris[30].v2);                          // one opposite winding
+    const char* asciiPath = "test_stream.stl";
+    const char* binaryPath = "test_stream_bin.stl";
+    assert(StlReader::writeAsciiStlFromTriangles(asciiPath, tris));
+    writeBinaryStlForTest(binaryPath, tris, static_cast<uint32_t>(tris.size()));
+    StreamOptions opts;
+    opts.memoryBytes = 2048;  // forces dozens of spill buckets
+    opts.spillDir = ".";
+    for (const char* path : { asciiPath, binaryPath }) {
+        StlReader r;
+        assert(r.readIndexed(path));
+        std::ostringstream expected;
+        r.checkWatertight(expected);
+        std::ostringstream winding;
+        r.checkRightHandWinding(winding);
+        const std::string w = winding.str();
+        expected << w.substr(w.find("Right-hand rule:"));
+        expected << "Volume: " << std::fixed << std::setprecision(10) << r.volume() << "\n";
+
+        StreamReport report;
+        assert(streamValidate(path, report, opts) && "streaming validate");
+        std::ostringstream got;
+        printStreamReport(report, got);
+        assert(got.str() == expected.str() && "streaming report equals in-memory report");
+        assert(!report.watertight() && report.duplicateTriangles == 1 && report.degenerateTriangles == 1);
+        double vol = 0.;
+        assert(streamVolume(path, vol) && vol == r.volume());
+
+        uint64_t unique = 0;
+        assert(streamWeld(path, "test_stream.vtx", "test_stream.idx", unique, opts) && unique == r.vertices().size());
+        const std::string vtx = readFileBytes("test_stream.vtx"), idx = readFileBytes("test_stream.idx");
+        assert(vtx.size() == unique * 12 && idx.size() == tris.size() * 24);
+        const float* pos = reinterpret_cast<const float*>(vtx.data());
+        const uint64_t* ids = reinterpret_cast<const uint64_t*>(idx.data());
+        for (size_t t = 0; t < tris.size(); ++t) {
+            const StlReader::Vec3* v[3] = { &tris[t].v0, &tris[t].v1, &tris[t].v2 };
+            for (int k = 0; k < 3; ++k) {
+                const float* p = pos + 3 * ids[3 * t + k];
+                assert(p[0] == v[k]->x && p[1] == v[k]->y && p[2] == v[k]->z && "welded ids point at the right positions");
+            }
+        }
+    }
+    StreamReport missing;
+    assert(!streamValidate("nonexistent_stream.stl", missing, opts));
+
+    // A well-formed file without triangles reads, and reports as the in-memory checks do.
+    const char* emptyPath = "test_stream_empty.stl";
+    writeBinaryStlForTest(emptyPath, {}, 0);
+    {
+        StlReader r;
+        assert(r.readIndexed(emptyPath));
+        std::ostringstream expected;
+        assert(!r.checkWatertight(expected));
+        r.checkRightHandWinding(expected);
+        expected << "Volume: " << std::fixed << std::setprecision(10) << r.volume() << "\n";
+        StreamReport empty;
+        assert(streamValidate(emptyPath, empty, opts) && "empty file is not a read failure");
+        assert(empty.triangles == 0 && !empty.watertight());
+        std::ostringstream got;
+        printStreamReport(empty, got);
+        assert(got.str() == expected.str() && "empty streaming report equals in-memory report");
+        double vol = 1.;
+        assert(streamVolume(emptyPath, vol) && vol == 0.);
+    }
+    // An ASCII file without facets fails in both modes.
+    {
+        std::ofstream f(emptyPath, std::ios::binary);
+        f << "solid x\nendsolid x\n";
+    }
+    {
+        StlReader r;
+        assert(!r.readIndexed(emptyPath));
+        StreamReport empty;
+        assert(!streamValidate(emptyPath, empty, opts) && "ASCII without facets is a read failure");
+        double vol = 0.;
+        assert(!streamVolume(emptyPath, vol));
+    }
+    std::remove(emptyPath);
+    std::remove(asciiPath);
+    std::remove(binaryPath);
+    std::remove("test_stream.vtx");
+    std::remove("test_stream.idx");
+}
+
+// --- Ray-reuse classifier: same even-hit set as per-triangle rays, for any thread count and with brute force
+static void test_ray_reuse_matches_per_triangle() {
+    StlReader r;
+    assert(readHollowBall(r, "test_reuse_ball.stl"));
+    StlReader::FluidOptions opts;
+    std::vector<size_t> perTriangle;
+    r.classifyEvenHit(perTriangle, opts);
+    assert(!perTriangle.empty());
+    opts.classifier = StlReader::Classifier::RayReuse;
+    for (unsigned threads : { 1u, 4u }) {
+        opts.threads = threads;
+        std::vector<size_t> reuse;
+        r.classifyEvenHit(reuse, opts);
+        assert(reuse == perTriangle && "line labels match per-triangle rays");
+    }
+    opts.bruteForce = true;
+    std::vector<size_t> brute;
+    r.classifyEvenHit(brute, opts);
+    assert(brute == perTriangle && "ray reuse without the BVH");
+    std::vector<StlReader::Triangle> fluidReuse, fluidPerTriangle;
+    std::ostringstream discard;
+    r.computeFluidMesh(fluidReuse, discard, opts);
+    opts.classifier = StlReader::Classifier::PerTriangle;
+    r.computeFluidMesh(fluidPerTriangle, discard, opts);
+    assert(fluidReuse.size() == fluidPerTriangle.size() && !fluidReuse.empty());
+}
+
+// --- Winding-number classifier: matches even-hit on a closed ball, tree matches the exact sum, and a hole in the
+//     outer skin (which lets some cavity rays escape) does not lose cavity triangles
+static void test_winding_number_classifier() {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.f, 0.f, 0.f, 2.f, 24, 12, false);
+    const size_t outerCount = tris.size();
+    appendSphere(tris, 0.f, 0.f, 0.f, 1.f, 16, 8, true);
+    StlReader r;
+    r.setTriangles(tris);
+    r.buildBvh();
+    StlReader::FluidOptions opts;
+    std::vector<size_t> evenHit;
+    r.classifyEvenHit(evenHit, opts);
+    assert(evenHit.size() == tris.size() - outerCount && evenHit.front() == outerCount && "even-hit selects the cavity");
+    opts.classifier = StlReader::Classifier::WindingNumber;
+    for (unsigned threads : { 1u, 3u }) {
+        opts.threads = threads;
+        std::vector<size_t> winding;
+        r.classifyEvenHit(winding, opts);
+        assert(winding == evenHit && "winding number agrees on a closed mesh");
+    }
+    WindingNumberTree tree;
+    tree.build(*r.bvh(), r.vertices(), r.indexedTriangles());
+    for (const StlReader::Vec3& q : { StlReader::Vec3{ 0.f, 0.f, 0.f }, StlReader::Vec3{ 1.5f, 0.f, 0.2f },
+             StlReader::Vec3{ 0.f, 1.f + 1e-3f, 0.f }, StlReader::Vec3{ 5.f, 4.f, -3.f } }) {
+        const double fast = tree.evaluate(q), exact = WindingNumberTree::exact(q, r.vertices(), r.indexedTriangles());
+        assert(std::fabs(fast - exact) < 0.1 && "tree close to the exact sum");
+    }
+    assert(std::fabs(WindingNumberTree::exact({ 1.5f, 0.f, 0.2f }, r.vertices(), r.indexedTriangles()) - 1.) < 1e-6
+        && "inside the material");
+
+    // Open the north pole of the outer skin: cavity rays towards it escape with an odd count.
+    const size_t hole = 24;
+    std::vector<StlReader::Triangle> holed(tris.begin() + hole, tris.end());
+    StlReader h;
+    h.setTriangles(holed);
+    std::vector<size_t> holedWinding, holedEvenHit, expected;
+    h.classifyEvenHit(holedWinding, opts);
+    opts.classifier = StlReader::Classifier::PerTriangle;
+    h.classifyEvenHit(holedEvenHit, opts);
+    for (size_t i : evenHit) expected.push_back(i - hole);
+    assert(holedEvenHit.size() < expected.size() && "parity broken by the hole");
+    assert(holedWinding == expected && "winding number keeps every cavity triangle");
+}
+
+// --- Connected components: labelling, boxes and volumes; per-component capping and cleaning gives the same
+//     fluid triangles and clean report as one pass over the whole mesh
+static void test_components_split_fluid() {
+    std::vector<StlReader::Triangle> tris;
+    for (float cx : { 0.f, 10.f }) {
+        appendSphere(tris, cx, 0.f, 0.f, 2.f, 24, 12, false);
+        const long inner = static_cast<long>(tris.size());
+        appendSphere(tris, cx, 0.f, 0.f, 1.f, 16, 8, true);
+        tris.erase(tris.begin() + inner, tris.begin() + inner + 16);  // open the cavity's north cap
+    }
+    StlReader r;
+    r.setTriangles(tris);
+    const MeshComponents& comps = r.components();
+    assert(comps.count() == 4 && "two shells per ball");
+    assert(comps.componentOf().front() == 0 && comps.componentOf().back() == 3);
+    double signedSum = 0.;
+    for (size_t c = 0; c < comps.count(); ++c) {
+        const MeshComponents::Component& k = comps.components()[c];
+        signedSum += k.volume;
+        assert(comps.groupBegin(c + 1) - comps.groupBegin(c) == k.triangles);
+        for (size_t g = comps.groupBegin(c); g < comps.groupBegin(c + 1); ++g)
+            assert(comps.componentOf()[comps.grouped()[g]] == c);
+    }
+    assert(comps.components()[0].volume > 30. && comps.components()[1].volume < 0. && "outer positive, cavity negative");
+    assert(comps.components()[2].lo.x > 7.9f && comps.components()[2].hi.x < 12.1f && "second ball's box");
+    assert(std::fabs(std::fabs(signedSum) - r.volume()) < 1e-6 * r.volume());
+
+    // Reference: the whole selection capped and cleaned in one pass.
+    StlReader::FluidOptions opts;
+    std::vector<size_t> evenHit;
+    r.classifyEvenHit(evenHit, opts);
+    std::vector<StlReader::Triangle> whole;
+    r.addCaps(evenHit, whole);
+    assert(whole.size() > evenHit.size() && "open cavities get caps");
+    for (size_t i = evenHit.size(); i < whole.size(); ++i) {
+        std::swap(whole[i].v1, whole[i].v2);
+        whole[i].normal = { -whole[i].normal.x, -whole[i].normal.y, -whole[i].normal.z };
+    }
+    std::ostringstream wholeReport, splitReport;
+    StlReader::cleanMesh(whole, wholeReport);
+    std::vector<StlReader::Triangle> split;
+    opts.threads = 3;
+    r.computeFluidMesh(split, splitReport, opts);
+    assert(splitReport.str() == wholeReport.str() && "summed clean report");
+    auto key = [](const StlReader::Triangle& t) {
+        return std::vector<float>{ t.v0.x, t.v0.y, t.v0.z, t.v1.x, t.v1.y, t.v1.z, t.v2.x, t.v2.y, t.v2.z };
+    };
+    std::vector<std::vector<float>> a, b;
+    for (const auto& t : whole) a.push_back(key(t));
+    for (const auto& t : split) b.push_back(key(t));
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    assert(a == b && "same fluid triangles");
+}
+
+// The capping walk as first written (set of used edges, linear searches), kept as the reference for addCaps.
+static std::vector<StlReader::Triangle> referenceCaps(const StlReader& r, const std::vector<size_t>& subset, size_t& splits) {
+    const std::vector<StlReader::Vec3>& v = r.vertices();
+    const std::vector<StlReader::Vec3>& normals = r.geometry().normals;
+    MeshTopology topo;
+    topo.build(r.indexedTriangles(), subset);
+    std::vector<StlReader::Triangle> caps;
+    auto cap = [&](const std::vector<size_t>& loop, size_t tri) {
+        if (loop.size() < 3) return;
+        float cx = 0, cy = 0, cz = 0;
+        for (size_t vi : loop) { cx += v[vi].x; cy += v[vi].y; cz += v[vi].z; }
+        float n = (float)loop.size();
+        StlReader::Vec3 C = { cx / n, cy / n, cz / n };
+        for (size_t i = 0; i < loop.size(); ++i) {
+            const StlReader::Vec3& va = v[loop[i]], vb = v[loop[(i + 1) % loop.size()]];
+            float nx = (va.y - C.y) * (vb.z - C.z) - (va.z - C.z) * (vb.y - C.y);
+            float ny = (va.z - C.z) * (vb.x - C.x) - (va.x - C.x) * (vb.z - C.z);
+            float nz = (va.x - C.x) * (vb.y - C.y) - (va.y - C.y) * (vb.x - C.x);
+            float len = std::sqrt(nx * nx + ny * ny + nz * nz);
+            if (len <= 1e-10f) continue;
+            nx /= len; ny /= len; nz /= len;
+            const bool keep = nx * normals[tri].x + ny * normals[tri].y + nz * normals[tri].z >= 0.f;
+            StlReader::Triangle t;
+            t.v0 = C; t.v1 = keep ? va : vb; t.v2 = keep ? vb : va;
+            t.normal = keep ? StlReader::Vec3{ nx, ny, nz } : StlReader::Vec3{ -nx, -ny, -nz };
+            caps.push_back(t);
+        }
+    };
+    std::set<std::pair<size_t, size_t>> used;
+    for (;;) {
+        const MeshTopology::HalfEdge* first = nullptr;
+        for (const auto& e : topo.boundaryEdges())
+            if (!used.count({ e.from, e.to })) { first = &e; break; }
+        if (!first) break;
+        const size_t start = first->from;
+        std::vector<size_t> loop = { start, first->to }, tris = { first->tri, first->tri };
+        used.insert({ start, first->to });
+        size_t to = first->to;
+        while (to != start) {
+            size_t nextV = 0, nextTri = 0;
+            const auto out = topo.boundaryFrom(to);
+            for (const MeshTopology::HalfEdge* p = out.first; p != out.second; ++p)
+                if (!used.count({ to, p->to })) { nextV = p->to; nextTri = p->tri; break; }
+            if (nextV == 0) break;
+            used.insert({ to, nextV });
+            auto it = std::find(loop.begin(), loop.end(), nextV);
+            if (it == loop.end()) { loop.push_back(nextV); tris.push_back(nextTri); to = nextV; continue; }
+            if (nextV == start) break;
+            const size_t idx = static_cast<size_t>(it - loop.begin());
+            cap(std::vector<size_t>(it, loop.end()), tris[idx]);
+            ++splits;
+            loop.resize(idx + 1);
+            tris.resize(idx + 1);
+            to = loop.back();
+        }
+        cap(loop, tris[0]);
+    }
+    return caps;
+}
+
+static void test_add_caps_matches_set_walk() {
+    // Random selections of a sphere: many loops touching at pinch vertices, which split off sub-loops.
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.f, 0.f, 0.f, 1.f, 40, 20, false);
+    StlReader r;
+    r.setTriangles(tris);
+    uint32_t seed = 4242;
+    size_t splits = 0;
+    for (int keepPercent : { 15, 40, 60, 85 }) {
+        std::vector<size_t> subset;
+        for (size_t i = 0; i < r.triangleCount(); ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            if ((seed >> 8) % 100 < static_cast<uint32_t>(keepPercent)) subset.push_back(i);
+        }
+        std::vector<StlReader::Triangle> out;
+        r.addCaps(subset, out);
+        const std::vector<StlReader::Triangle> ref = referenceCaps(r, subset, splits);
+        assert(out.size() == subset.size() + ref.size() && "same number of caps");
+        assert(std::memcmp(out.data() + subset.size(), ref.data(), ref.size() * sizeof(StlReader::Triangle)) == 0 &&
+            "same caps in the same order");
+    }
+    assert(splits > 0 && "selections exercise sub-loop splits");
+}
+
+static void test_arena_reuses_blocks() {
+    Arena arena(4096);
+    const Arena::Mark start = arena.mark();
+    char* a = static_cast<char*>(arena.allocate(3, 1));
+    double* d = static_cast<double*>(arena.allocate(sizeof(double), alignof(double)));
+    assert(reinterpret_cast<uintptr_t>(d) % alignof(double) == 0 && "aligned");
+    arena.deallocate(d, sizeof(double));
+    assert(static_cast<void*>(arena.allocate(sizeof(double), alignof(double))) == d && "last allocation handed back");
+    void* big = arena.allocate(100000, 16);  // past the first block
+    assert(big && arena.reserved() >= 100000 + 4096);
+    const size_t reserved = arena.reserved();
+    arena.rewind(start);
+    assert(arena.allocate(3, 1) == a && "rewind reuses the first block");
+    assert(arena.allocate(100000, 16) == big && "and the cached second one");
+    assert(arena.reserved() == reserved);
+    arena.rewind(start);
+    arena.trim();
+    assert(arena.reserved() == 4096 && "trim keeps the block in use");
+
+    {
+        ArenaScope scope(arena);
+        ScratchVector<int> v(&scope.arena());
+        for (int i = 0; i < 5000; ++i) v.push_back(i);
+        assert(v[4999] == 4999);
+    }
+    assert(arena.allocate(3, 1) == a && "scope end rewinds");
+    ScratchVector<int> heap;  // no arena: plain heap allocation
+    heap.assign(1000, 7);
+    assert(heap.get_allocator().arena() == nullptr && heap[999] == 7);
+
+    // Repeated stages on one thread reuse the memory of the first call.
+    StlReader r;
+    assert(readHollowBall(r, "test_arena_ball.stl"));
+    std::vector<size_t> subset;
+    for (size_t i = 0; i < r.triangleCount(); i += 2) subset.push_back(i);
+    std::vector<StlReader::Triangle> first, again;
+    std::ostringstream discard;
+    r.addCaps(subset, first);
+    StlReader::cleanMesh(first, discard);
+    const size_t held = threadArena().reserved();
+    r.addCaps(subset, again);
+    StlReader::cleanMesh(again, discard);
+    assert(threadArena().reserved() == held && "no new blocks on the second call");
+    assert(again.size() == first.size() &&
+        std::memcmp(again.data(), first.data(), first.size() * sizeof(StlReader::Triangle)) == 0);
+}
+
+static void test_epsilon_weld() {
+    // Random points, many in tight clusters whose spread is below epsilon: grid weld against all pairs.
+    std::vector<StlReader::Vec3> pts;
+    uint32_t seed = 99;
+    auto unit = [&]() { seed = seed * 1664525u + 1013904223u; return static_cast<float>((seed >> 8) & 0xFFFF) / 65536.f; };
+    for (int c = 0; c < 400; ++c) {
+        const StlReader::Vec3 centre = { unit() * 2.f - 1.f, unit() * 2.f - 1.f, unit() };
+        const int copies = 1 + static_cast<int>(unit() * 4.f);
+        for (int k = 0; k < copies; ++k)
+            pts.push_back({ centre.x + (unit() - 0.5f) * 2e-3f, centre.y + (unit() - 0.5f) * 2e-3f, centre.z });
+    }
+    const float eps = 3e-3f;
+    std::vector<StlReader::Index> parent(pts.size());
+    for (size_t i = 0; i < pts.size(); ++i) parent[i] = static_cast<StlReader::Index>(i);
+    auto root = [&](size_t x) { while (parent[x] != x) x = parent[x]; return x; };
+    for (size_t i = 0; i < pts.size(); ++i)
+        for (size_t j = i + 1; j < pts.size(); ++j) {
+            const double dx = double(pts[i].x) - pts[j].x, dy = double(pts[i].y) - pts[j].y, dz = double(pts[i].z) - pts[j].z;
+            if (dx * dx + dy * dy + dz * dz > double(eps) * eps) continue;
+            const size_t a = root(i), b = root(j);
+            if (a != b) parent[std::max(a, b)] = static_cast<StlReader::Index>(std::min(a, b));
+        }
+    std::vector<StlReader::Index> expected(pts.size());
+    size_t groups = 0;
+    for (size_t i = 0; i < pts.size(); ++i)
+        expected[i] = root(i) == i ? static_cast<StlReader::Index>(groups++) : expected[root(i)];
+    for (unsigned threads : { 1u, 4u }) {
+        std::vector<StlReader::Index> remap;
+        assert(weldWithinEpsilon(pts, eps, threads, remap) == groups);
+        assert(remap == expected && "same groups and numbering as all pairs");
+    }
+    assert(groups < pts.size() && groups > 300);
+
+    // A sphere whose triangle corners are jittered independently is not watertight until welded.
+    std::vector<StlReader::Triangle> tris, jittered;
+    appendSphere(tris, 0.f, 0.f, 0.f, 2.f, 24, 12, false);
+    for (StlReader::Triangle t : tris) {
+        for (StlReader::Vec3* v : { &t.v0, &t.v1, &t.v2 }) { v->x += (unit() - 0.5f) * 1e-5f; v->z += (unit() - 0.5f) * 1e-5f; }
+        jittered.push_back(t);
+    }
+    StlReader exact, welded;
+    exact.setTriangles(tris);
+    welded.setTriangles(jittered);
+    std::ostringstream before, after;
+    assert(!welded.checkWatertight(before));
+    const size_t jitteredVertices = welded.vertices().size();
+    assert(jitteredVertices > tris.size());
+    // 24 x 11 ring points and the poles (the generator's south pole is not bit-identical around the ring).
+    const size_t spherePoints = 24 * 11 + 2;
+    assert(welded.weldVertices(1e-4f, 3) == jitteredVertices - spherePoints);
+    assert(welded.vertices().size() == spherePoints && "one vertex per sphere point");
+    assert(welded.checkWatertight(after) && "welded sphere is closed");
+    assert(std::fabs(welded.volume() - exact.volume()) < 1e-3 * exact.volume());
+    assert(welded.weldVertices(1e-4f) == 0 && "nothing left to merge");
+}
+
+static void test_batch_schedule() {
+    // One job: items start largest first, index order on ties.
+    const std::vector<uint64_t> weights = { 5, 40, 5, 90, 10 };
+    std::vector<size_t> order;
+    BatchOptions serial;
+    serial.jobs = 1;
+    serial.threads = 4;
+    runBatch(weights, serial, [&](size_t i, unsigned threads) {
+        assert(threads == 4 && "a lone job gets the whole budget");
+        order.push_back(i);
+    });
+    assert((order == std::vector<size_t>{ 3, 1, 4, 0, 2 }));
+
+    // Three jobs under a cap of 100: the resident total never passes it, except the lone oversized item.
+    const std::vector<uint64_t> mixed = { 60, 30, 150, 20, 50, 10, 70 };
+    BatchOptions capped;
+    capped.jobs = 3;
+    capped.threads = 3;
+    capped.maxResidentWeight = 100;
+    std::mutex m;
+    uint64_t resident = 0, peak = 0;
+    size_t running = 0, done = 0;
+    bool bigAlone = true;
+    runBatch(mixed, capped, [&](size_t i, unsigned threads) {
+        assert(threads == 1);
+        {
+            std::lock_guard<std::mutex> lock(m);
+            resident += mixed[i];
+            ++running;
+            if (mixed[i] <= capped.maxResidentWeight)
+                peak = std::max(peak, resident);
+            else if (running != 1)
+                bigAlone = false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        std::lock_guard<std::mutex> lock(m);
+        resident -= mixed[i];
+        --running;
+        ++done;
+    });
+    assert(done == mixed.size() && bigAlone && peak <= 100);
+
+    // A throwing job is rethrown once the started ones finish.
+    bool threw = false;
+    try {
+        runBatch(weights, serial, [](size_t i, unsigned) {
+            if (i == 1) throw std::runtime_error("bad part");
+        });
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Inputs from a directory (sorted, *.stl only) and from a manifest (relative to its own directory).
+    namespace fs = std::filesystem;
+    const fs::path dir = "test_batch_dir";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    StlReader r;
+    assert(r.readIndexed(simple_stl()));
+    assert(r.writeBinaryStl((dir / "b.stl").string()));
+    assert(r.writeAsciiStl((dir / "a.STL").string()));
+    std::ofstream((dir / "notes.txt").string()) << "not an input\n";
+    std::vector<std::string> paths;
+    std::string error;
+    assert(listBatchInputs(dir.string(), paths, error));
+    assert(paths.size() == 2 && fs::path(paths[0]).filename() == "a.STL" && fs::path(paths[1]).filename() == "b.stl");
+    assert(estimateTriangleCount(paths[1]) == r.triangleCount() && "binary header count");
+    assert(estimateTriangleCount(paths[0]) >= 1 && "ASCII size estimate");
+    std::ofstream((dir / "list.txt").string()) << "# parts\n  b.stl  \n\n/abs/part.stl\n";
+    assert(listBatchInputs((dir / "list.txt").string(), paths, error));
+    assert(paths.size() == 2 && paths[0] == (dir / "b.stl").string() && paths[1] == "/abs/part.stl");
+    assert(!listBatchInputs((dir / "missing.txt").string(), paths, error) && !error.empty());
+    fs::remove_all(dir);
+
+    assert(expandOutputTemplate("out/{name}", "parts/pump.stl") == "out/pump/");
+    assert(expandOutputTemplate("{name}-{name}/", "x.stl") == "x-x/");
+    assert(expandOutputTemplate("flat", "x.stl") == "flat/");
+
+    // Same stem in two directories: both would write out/part/, so the batch is refused.
+    assert(findOutputCollision("out/{name}", { "a/part.stl", "b/part.stl.gz" }, error));
+    assert(error.find("a/part.stl") != std::string::npos && error.find("b/part.stl.gz") != std::string::npos);
+    assert(findOutputCollision("out/./{name}/", { "x.stl", "other/x.stl" }, error) && "normalized paths compared");
+    assert(!findOutputCollision("out/{name}", { "a/pump.stl", "a/valve.stl" }, error));
+}
+
+static void test_even_hit_cache() {
+    namespace fs = std::filesystem;
+    const std::string dir = "test_cache_dir";
+    fs::remove_all(dir);
+    StlReader r;
+    assert(readHollowBall(r, "test_cache_ball.stl"));
+    StlReader::FluidOptions plain;
+    std::vector<size_t> expected;
+    r.classifyEvenHit(expected, plain);
+    assert(!expected.empty());
+
+    StlReader::FluidOptions cached = plain;
+    cached.cacheDir = dir;
+    const uint64_t key = evenHitCacheKey(r.vertices(), r.indexedTriangles(), cached, 1);
+    assert(key == evenHitCacheKey(r.vertices(), r.indexedTriangles(), cached, 4) && "key ignores thread count");
+    std::vector<size_t> evenHit;
+    r.classifyEvenHit(evenHit, cached);  // miss: casts and stores
+    assert(evenHit == expected && fs::exists(evenHitCachePath(dir, key)));
+
+    // A hit returns the stored list without casting: plant a different valid list under the same key.
+    const std::vector<size_t> planted = { 0, 3, 5 };
+    assert(storeEvenHitCache(dir, key, r.triangleCount(), planted));
+    r.classifyEvenHit(evenHit, cached);
+    assert(evenHit == planted);
+
+    // Other settings or another mesh use other keys.
+    StlReader::FluidOptions tweaked = cached;
+    tweaked.tMin = 2e-2f;
+    assert(evenHitCacheKey(r.vertices(), r.indexedTriangles(), tweaked, 0) != key);
+    tweaked = cached;
+    tweaked.classifier = StlReader::Classifier::RayReuse;
+    assert(evenHitCacheKey(r.vertices(), r.indexedTriangles(), tweaked, 0) != key);
+    StlReader other;
+    assert(other.readIndexed(simple_stl()));
+    assert(evenHitCacheKey(other.vertices(), other.indexedTriangles(), cached, 0) != key);
+
+    // Damaged or foreign entries are misses and get rewritten.
+    assert(!loadEvenHitCache(dir, key, r.triangleCount() + 1, evenHit) && "triangle count must match");
+    const std::vector<size_t> unsorted = { 5, 3 };
+    assert(storeEvenHitCache(dir, key, r.triangleCount(), unsorted));
+    assert(!loadEvenHitCache(dir, key, r.triangleCount(), evenHit));
+    fs::resize_file(evenHitCachePath(dir, key), 20);
+    assert(!loadEvenHitCache(dir, key, r.triangleCount(), evenHit));
+    r.classifyEvenHit(evenHit, cached);
+    assert(evenHit == expected);
+    assert(loadEvenHitCache(dir, key, r.triangleCount(), evenHit) && evenHit == expected);
+
+    std::vector<StlReader::Triangle> fluid, fluidCached;
+    std::ostringstream discard;
+    r.computeFluidMesh(fluid, discard, plain);
+    r.computeFluidMesh(fluidCached, discard, cached);
+    assert(fluid.size() == fluidCached.size() &&
+        std::memcmp(fluid.data(), fluidCached.data(), fluid.size() * sizeof(StlReader::Triangle)) == 0);
+    fs::remove_all(dir);
+}
+
+static void test_read_from_memory_and_reuse() {
+    const std::string ascii = readFileBytes(simple_stl());
+    StlReader fromFile, fromBytes, fromStream, lines;
+    assert(fromFile.readIndexed(simple_stl()));
+    assert(fromBytes.readIndexed(ascii.data(), ascii.size()));
+    std::istringstream in(ascii);
+    assert(fromStream.readIndexed(in));
+    StlReader::ReadOptions lineParser;
+    lineParser.fastAscii = false;
+    std::istringstream in2(ascii);
+    assert(lines.read(in2, lineParser));
+    lines.removeDuplicateVertices();
+    for (const StlReader* r : { &fromBytes, &fromStream, &lines }) {
+        assert(r->header() == fromFile.header() && r->triangleCount() == fromFile.triangleCount());
+        assert(r->vertices().size() == fromFile.vertices().size() && r->volume() == fromFile.volume());
+    }
+
+    // Binary bytes, and inputs that must be rejected.
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.f, 0.f, 0.f, 2.f, 24, 12, false);
+    appendSphere(tris, 0.f, 0.f, 0.f, 1.f, 16, 8, true);
+    const char* binPath = "test_memory_ball.stl";
+    assert(StlReader::writeBinaryStlFromTriangles(binPath, tris));
+    const std::string binary = readFileBytes(binPath);
+    std::remove(binPath);
+    StlReader ball;
+    assert(ball.readIndexed(binary.data(), binary.size()) && ball.triangleCount() == tris.size());
+    StlReader bad;
+    assert(!bad.readIndexed(binary.data(), binary.size() - 1) && "truncated");
+    assert(!bad.read(binary.data(), 10) && !bad.read(ascii.data(), 0));
+    std::istringstream empty("");
+    assert(!bad.read(empty));
+
+    // reset() keeps the buffers: re-reading the same mesh reuses them.
+    const StlReader::IndexedTri* triBuffer = ball.indexedTriangles().data();
+    const StlReader::Vec3* vertexBuffer = ball.vertices().data();
+    const double volume = ball.volume();
+    ball.reset();
+    assert(ball.triangleCount() == 0 && ball.vertices().empty() && ball.bvh() == nullptr);
+    assert(ball.readIndexed(binary.data(), binary.size()));
+    assert(ball.indexedTriangles().data() == triBuffer && ball.vertices().data() == vertexBuffer);
+    assert(ball.volume() == volume);
+
+    // Moves and takeMesh() hand the buffers over without copying.
+    ball.buildBvh();
+    StlReader moved(std::move(ball));
+    assert(moved.indexedTriangles().data() == triBuffer && moved.bvh() != nullptr && moved.volume() == volume);
+    std::vector<StlReader::Vec3> vertices;
+    std::vector<StlReader::IndexedTri> indexed;
+    moved.takeMesh(vertices, indexed);
+    assert(indexed.data() == triBuffer && indexed.size() == tris.size() && moved.triangleCount() == 0);
+
+    // computeFluidMesh() on distinct readers from several threads matches the serial results.
+    const int kReaders = 4;
+    std::vector<std::string> inputs(kReaders);
+    std::vector<std::vector<StlReader::Triangle>> serial(kReaders), concurrent(kReaders);
+    std::ostringstream discard;
+    for (int k = 0; k < kReaders; ++k) {
+        std::vector<StlReader::Triangle> mesh;
+        appendSphere(mesh, 0.f, 0.f, 0.f, 2.f + k, 20 + 4 * k, 10 + 2 * k, false);
+        appendSphere(mesh, 0.f, 0.f, 0.f, 1.f, 12 + 2 * k, 6 + k, true);
+        const std::string path = "test_memory_" + std::to_string(k) + ".stl";
+        assert(StlReader::writeBinaryStlFromTriangles(path, mesh));
+        inputs[k] = readFileBytes(path.c_str());
+        std::remove(path.c_str());
+        StlReader r;
+        assert(r.readIndexed(inputs[k].data(), inputs[k].size()));
+        r.computeFluidMesh(serial[k], discard, StlReader::FluidOptions());
+    }
+    std::vector<std::thread> workers;
+    for (int k = 0; k < kReaders; ++k)
+        workers.emplace_back([&, k]() {
+            StlReader r;
+            StlReader::FluidOptions opts;
+            opts.threads = 2;
+            std::ostringstream report;
+            for (int round = 0; round < 3; ++round) {
+                r.reset();
+                if (r.readIndexed(inputs[k].data(), inputs[k].size()))
+                    r.computeFluidMesh(concurrent[k], report, opts);
+            }
+        });
+    for (std::thread& t : workers)
+        t.join();
+    for (int k = 0; k < kReaders; ++k)
+        assert(!serial[k].empty() && concurrent[k].size() == serial[k].size() &&
+            std::memcmp(concurrent[k].data(), serial[k].data(), serial[k].size() * sizeof(StlReader::Triangle)) == 0);
+}
+
+static void test_gpu_backend_falls_back() {
+    // CPU-only builds link the stub: no device, and --backend gpu gives the CPU result.
+    StlReader r;
+    assert(readHollowBall(r, "test_gpu_ball.stl"));
+    r.buildBvh();
+    StlReader::FluidOptions cpu, gpu;
+    gpu.backend = StlReader::RayBackend::Gpu;
+    std::vector<size_t> expected, evenHit;
+    r.classifyEvenHit(expected, cpu);
+    r.classifyEvenHit(evenHit, gpu);
+    assert(evenHit == expected);
+    gpu.classifier = cpu.classifier = StlReader::Classifier::RayReuse;
+    r.classifyEvenHit(expected, cpu);
+    r.classifyEvenHit(evenHit, gpu);
+    assert(evenHit == expected);
+    std::vector<uint32_t> counts;
+    std::string device;
+    const std::vector<uint32_t> rays = { 0, 1, 2 };
+    const bool ran = gpuDistinctHitCounts(*r.bvh(), r.geometry(), rays, 1e-4f, 1e-2f, 1e-4f, counts);
+    assert(ran == gpuRayCastAvailable(&device));
+    assert(!ran || counts.size() == rays.size());
+}
+
+static void test_spatial_reorder() {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.f, 0.f, 0.f, 2.f, 24, 12, false);
+    appendSphere(tris, 0.f, 0.f, 0.f, 1.f, 16, 8, true);
+    uint32_t seed = 12345;
+    for (size_t i = tris.size() - 1; i > 0; --i) {  // exporter order: no spatial coherence
+        seed = seed * 1664525u + 1013904223u;
+        std::swap(tris[i], tris[seed % (i + 1)]);
+    }
+    std::swap(tris[5].v1, tris[5].v2);  // one facet wound against its stored normal
+    StlReader plain, sorted;
+    plain.setTriangles(tris);
+    sorted.setTriangles(tris);
+    assert(sorted.originalTriangleIds().empty() && sorted.originalTriangleId(7) == 7);
+    sorted.reorderSpatially(3);
+    sorted.reorderSpatially(1);  // a second pass keeps the ids pointing at the input
+    const size_t n = tris.size();
+    assert(sorted.triangleCount() == n && sorted.vertices().size() == plain.vertices().size());
+
+    std::vector<char> seen(n, 0);
+    for (size_t k = 0; k < n; ++k) {
+        const size_t i = sorted.originalTriangleId(k);
+        assert(i < n && !seen[i]);
+        seen[i] = 1;
+        const StlReader::IndexedTri& a = sorted.indexedTriangles()[k];
+        const StlReader::IndexedTri& b = plain.indexedTriangles()[i];
+        for (int c = 0; c < 3; ++c) {
+            const StlReader::Vec3& p = sorted.vertices()[c == 0 ? a.v0 : c == 1 ? a.v1 : a.v2];
+            const StlReader::Vec3& q = plain.vertices()[c == 0 ? b.v0 : c == 1 ? b.v1 : b.v2];
+            assert(p.x == q.x && p.y == q.y && p.z == q.z && "same corners in the same order");
+        }
+    }
+    std::vector<StlReader::Index> order;
+    mortonOrder(sorted.vertices(), 2, order);
+    for (size_t k = 0; k < order.size(); ++k)
+        assert(order[k] == k && "vertices are in Morton order");
+    assert(std::fabs(sorted.volume() - plain.volume()) < 1e-9 * std::fabs(plain.volume()));
+
+    // The even-hit selection is the same set of input triangles, and reports use input ids.
+    std::vector<size_t> expected, evenHit;
+    plain.classifyEvenHit(expected, StlReader::FluidOptions());
+    sorted.classifyEvenHit(evenHit, StlReader::FluidOptions());
+    for (size_t& i : evenHit) i = sorted.originalTriangleId(i);
+    std::sort(evenHit.begin(), evenHit.end());
+    assert(evenHit == expected);
+    std::ostringstream plainReport, sortedReport;
+    plain.checkRightHandWinding(plainReport);
+    sorted.checkRightHandWinding(sortedReport);
+    assert(sortedReport.str() == plainReport.str());
+    assert(plainReport.str().find("triangle 5 opposite winding") != std::string::npos);
+
+    // ReadOptions::spatialOrder does the same after reading; re-indexing drops the ids.
+    const char* path = "test_reorder.stl";
+    assert(StlReader::writeBinaryStlFromTriangles(path, tris));
+    StlReader read;
+    StlReader::ReadOptions opts;
+    opts.spatialOrder = true;
+    assert(read.readIndexed(path, opts));
+    std::remove(path);
+    assert(read.originalTriangleIds().size() == n && read.vertices().size() == sorted.vertices().size());
+    read.setTriangles(tris);
+    assert(read.originalTriangleIds().empty());
+}
+
+static void test_compressed_output() {
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.f, 0.f, 0.f, 2.f, 40, 20, false);
+    appendSphere(tris, 0.f, 0.f, 0.f, 1.f, 24, 12, true);
+    assert(StlReader::writeAsciiStlFromTriangles("test_plain.stl", tris, 3));
+    assert(StlReader::writeBinaryStlFromTriangles("test_plain_bin.stl", tris));
+    const std::string plainAscii = readFileBytes("test_plain.stl");
+    const std::string plainBinary = readFileBytes("test_plain_bin.stl");
+    StlReader plain;
+    assert(plain.readIndexed("test_plain.stl"));
+    std::remove("test_plain.stl");
+    std::remove("test_plain_bin.stl");
+
+    for (Compression c : { Compression::Gzip, Compression::Zstd }) {
+        const std::string ext = c == Compression::Gzip ? ".gz" : ".zst";
+        const std::string asciiPath = "test_compressed.stl" + ext, binaryPath = "test_compressed_bin.stl" + ext;
+        assert(compressionForPath(asciiPath) == c);
+        if (!compressionSupported(c)) {
+            assert(!StlReader::writeAsciiStlFromTriangles(asciiPath, tris) && "codec missing from this build");
+            continue;
+        }
+        // Same bytes as the plain writers once decompressed, whatever the thread count.
+        assert(StlReader::writeAsciiStlFromTriangles(asciiPath, tris, 3));
+        assert(StlReader::writeBinaryStlFromTriangles(binaryPath, tris));
+        const std::string packed = readFileBytes(asciiPath.c_str());
+        assert(compressionOfData(packed.data(), packed.size()) == c && packed.size() < plainAscii.size() / 4);
+        std::vector<unsigned char> bytes;
+        assert(decompress(packed.data(), packed.size(), c, bytes));
+        assert(std::string(bytes.begin(), bytes.end()) == plainAscii);
+        const std::string packedBinary = readFileBytes(binaryPath.c_str());
+        assert(decompress(packedBinary.data(), packedBinary.size(), c, bytes));
+        assert(std::string(bytes.begin(), bytes.end()) == plainBinary);
+
+        // Paths, memory and streams all read compressed input.
+        StlReader fromPath, fromBinary, fromBytes, fromStream;
+        assert(fromPath.readIndexed(asciiPath) && fromBinary.readIndexed(binaryPath));
+        assert(fromBytes.readIndexed(packed.data(), packed.size()));
+        std::istringstream in(packed);
+        assert(fromStream.readIndexed(in));
+        for (const StlReader* r : { &fromPath, &fromBinary, &fromBytes, &fromStream })
+            assert(r->triangleCount() == plain.triangleCount() && r->volume() == plain.volume());
+        StlReader bad;
+        assert(!bad.readIndexed(packed.data(), packed.size() - 8) && "truncated");
+        if (c == Compression::Gzip) {
+            // A forged ISIZE trailer (4 GB) fails the check without being trusted as the output size.
+            std::string forged = packed;
+            forged.replace(forged.size() - 4, 4, 4, '\xff');
+            std::vector<unsigned char> forgedBytes;
+            assert(!decompress(forged.data(), forged.size(), c, forgedBytes));
+            assert(forgedBytes.capacity() < (size_t(1) << 30) && "bounded by the compressed size");
+        }
+        std::remove(asciiPath.c_str());
+        std::remove(binaryPath.c_str());
+
+        // Several blocks through the background thread, written in odd-sized pieces.
+        std::string big;
+        for (size_t i = 0; big.size() < (size_t(3) << 20); ++i)
+            big += "line " + std::to_string(i * 7919 % 100003) + "\n";
+        CompressedWriter w;
+        assert(w.open(asciiPath));
+        for (size_t pos = 0; pos < big.size(); pos += 12345)
+            assert(w.write(big.data() + pos, std::min<size_t>(12345, big.size() - pos)));
+        assert(w.close() && !w.close());
+        const std::string packedBig = readFileBytes(asciiPath.c_str());
+        assert(decompress(packedBig.data(), packedBig.size(), c, bytes) && std::string(bytes.begin(), bytes.end()) == big);
+        std::remove(asciiPath.c_str());
+    }
+    CompressedWriter w;
+    assert(!w.open("no_such_dir/out.stl.gz") && !w.write("x", 1));
+}
+
+static void test_task_group_and_atomic_writes() {
+    // Tasks run side by side (each waits for the other to start) and the first exception comes back from wait().
+    std::mutex m;
+    std::condition_variable cv;
+    int started = 0;
+    TaskGroup tasks;
+    for (int k = 0; k < 2; ++k)
+        tasks.run([&] {
+            std::unique_lock<std::mutex> lock(m);
+            ++started;
+            cv.notify_all();
+            cv.wait(lock, [&] { return started == 2; });
+        });
+    tasks.wait();
+    assert(started == 2);
+    tasks.run([] { throw std::runtime_error("task failed"); });
+    tasks.run([&] { ++started; });
+    bool threw = false;
+    try {
+        tasks.wait();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw && started == 3);
+    tasks.wait();  // the failure is reported once
+
+    // Writers commit by rename: until close() the path keeps its old bytes, and an abandoned write leaves them
+    // and no temporary file behind.
+    const std::filesystem::path dir = "test_atomic_out";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const std::string path = (dir / "mesh.stl").string();
+    std::vector<StlReader::Triangle> tris;
+    appendSphere(tris, 0.f, 0.f, 0.f, 1.f, 12, 6, false);
+    assert(StlReader::writeAsciiStlFromTriangles(path, tris));
+    const std::string before = readFileBytes(path.c_str());
+    {
+        CompressedWriter w;
+        assert(w.open(path) && w.write("solid partial\n"));
+        assert(readFileBytes(path.c_str()) == before);
+    }
+    {
+        CompressedWriter w;
+        assert(w.open(path) && w.write("solid replaced\n") && w.close());
+        assert(readFileBytes(path.c_str()) == "solid replaced\n");
+    }
+    assert(StlReader::writeAsciiStlFromTriangles(path, tris) && readFileBytes(path.c_str()) == before);
+    size_t files = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        assert(entry.path().filename() == "mesh.stl");
+        ++files;
+    }
+    assert(files == 1);
+    std::filesystem::remove_all(dir);
+}
+
+// --- Robust crossings: rays exactly through the vertices and edges of an octahedron cross it with the right
+//     parity (once from inside, an even number of times when grazing from outside), zero determinants go to the
+//     exact stage, and the robust even-hit selection matches the default on the hollow ball
+static void test_robust_crossings() {
+    typedef StlReader::Vec3 V;
+    const V px = { 1, 0, 0 }, nx = { -1, 0, 0 }, py = { 0, 1, 0 }, ny = { 0, -1, 0 }, pz = { 0, 0, 1 }, nz = { 0, 0, -1 };
+    const V faces[8][3] = { { px, py, pz }, { py, nx, pz }, { nx, ny, pz }, { ny, px, pz },
+                            { py, px, nz }, { nx, py, nz }, { ny, nx, nz }, { px, ny, nz } };
+    RobustRayStats stats;
+    auto crossings = [&](const V& o, const V& d) {
+        int count = 0;
+        for (const auto& f : faces) {
+            double t;
+            if (robustRayCrossing(o, d, f[0], f[1], f[2], t, stats) && t > 0.)
+                ++count;
+        }
+        return count;
+    };
+    const V centre = { 0, 0, 0 };
+    assert(crossings(centre, V{ 0, 0, 1 }) == 1 && "through a vertex shared by four faces");
+    assert(crossings(centre, V{ 1, 1, 0 }) == 1 && "through an edge shared by two faces");
+    assert(crossings(centre, V{ 1, 2, 3 }) == 1 && "through a face");
+    assert(crossings(V{ 0.25f, 0.125f, 0 }, V{ -1, 0, 0 }) == 1 && "off-centre origin, through an edge");
+    assert(crossings(V{ 0, 0, -5 }, V{ 0, 0, 1 }) == 2 && "in and out through opposite vertices");
+    assert(crossings(V{ -5, 1, 0 }, V{ 1, 0, 0 }) % 2 == 0 && "grazing a vertex");
+    assert(crossings(V{ -5, 0.5f, 0.5f }, V{ 1, 0, 0 }) % 2 == 0 && "grazing along an edge");
+    assert(crossings(V{ -5, 3, 0 }, V{ 1, 0, 0 }) == 0 && "missing");
+    assert(stats.exactSigns > 0 && stats.floatSigns > stats.exactSigns);
+
+    RobustRayStats edge;
+    assert(rayEdgeOrientation(centre, V{ 1, -1, 0 }, px, py, edge) == 0 && edge.exactSigns == 1);
+    assert(rayEdgeOrientation(centre, V{ 1, -1, 1e-35f }, px, py, edge) == 1 && edge.doubleSigns == 1);
+    assert(rayEdgeOrientation(centre, V{ 1, -1, 1 }, px, py, edge) == 1 && edge.floatSigns == 1);
+
+    StlReader r;
+    assert(readHollowBall(r, "test_robust_ball.stl"));
+    StlReader::FluidOptions opts;
+    std::vector<size_t> fast, robust;
+    r.classifyEvenHit(fast, opts);
+    opts.robust = true;
+    r.classifyEvenHit(robust, opts);
+    assert(!fast.empty() && robust == fast);
+    opts.classifier = StlReader::Classifier::RayReuse;
+    std::vector<size_t> reuse;
+    r.classifyEvenHit(reuse, opts);
+    assert(reuse == fast && "robust line labels");
+    opts.classifier = StlReader::Classifier::PerTriangle;
+    opts.bruteForce = true;
+    std::vector<size_t> brute;
+    r.classifyEvenHit(brute, opts);
+    assert(brute == fast && "robust without the BVH");
+}
+
+// --- Fast validation: the sharded counts match the topology tables and the serial checks for any thread count;
+//     winding listings are capped, classes fail in order and fail-fast skips the rest
+static void test_fast_validate() {
+    // Closed box [0, 8]^3 with every face split into 8 x 8 unit squares, outward winding.
+    std::vector<StlReader::Triangle> tris;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int side = 0; side < 2; ++side) {
+            auto point = [&](int u, int v) {
+                float p[3];
+                p[axis] = side ? 8.f : 0.f;
+                p[(axis + 1) % 3] = static_cast<float>(u);
+                p[(axis + 2) % 3] = static_cast<float>(v);
+                return StlReader::Vec3{ p[0], p[1], p[2] };
+            };
+            for (int u = 0; u < 8; ++u) {
+                for (int v = 0; v < 8; ++v) {
+                    const StlReader::Vec3 a = point(u, v), b = point(u + 1, v), c = point(u + 1, v + 1), d = point(u, v + 1);
+                    tris.push_back(side ? makeTri(a, b, c) : makeTri(a, c, b));
+                    tris.push_back(side ? makeTri(a, c, d) : makeTri(a, d, c));
+                }
+            }
+        }
+    }
+    StlReader r;
+    r.setTriangles(tris);
+    std::ostringstream full;
+    const bool watertight = r.checkWatertight(full);
+    const MeshTopology& topo = r.topology();
+    FastValidateReport base;
+    for (unsigned threads : { 1u, 4u }) {
+        FastValidateOptions opts;
+        opts.threads = threads;
+        FastValidateReport rep;
+        fastValidate(r, rep, opts);
+        assert(rep.passed() && watertight && rep.counts.watertight() && !rep.stoppedEarly);
+        assert(rep.counts.uniqueEdges == topo.edgeCount() && rep.counts.boundaryEdges == 0 && rep.counts.nonManifoldEdges == 0);
+        assert(rep.counts.windingOk == r.triangleCount() && rep.counts.uniqueVertices == r.vertices().size());
+        assert(std::fabs(rep.counts.volume - 512.) < 1e-9 && std::fabs(r.volume() - 512.) < 1e-9);
+        if (threads == 1) base = rep;
+        assert(rep.counts.volume == base.counts.volume && rep.counts.uniqueEdges == base.counts.uniqueEdges);
+    }
+
+    // Reverse the vertex order of every third facet (normals kept), drop one and repeat another.
+    std::vector<StlReader::Triangle> bad = tris;
+    size_t flipped = 0;
+    for (size_t i = 0; i < bad.size(); i += 3, ++flipped)
+        std::swap(bad[i].v1, bad[i].v2);
+    bad.erase(bad.begin() + 1);
+    bad.push_back(bad[4]);
+    r.setTriangles(bad);
+    std::ostringstream serial;
+    r.checkWatertight(serial);
+    FastValidateOptions opts;
+    opts.maxListed = 3;
+    FastValidateReport rep;
+    fastValidate(r, rep, opts);
+    assert(rep.firstFailure == FastValidateFailure::Winding && !rep.stoppedEarly);
+    assert(rep.counts.windingOpposite == flipped && rep.oppositeWinding.size() == 3);
+    assert(rep.oppositeWinding[0].first == 0 && rep.oppositeWinding[1].first == 2 && rep.oppositeWinding[2].first == 5);
+    assert(rep.counts.boundaryEdges == r.topology().boundaryEdgeCount() && rep.counts.boundaryEdges == 3);
+    assert(rep.counts.nonManifoldEdges == r.topology().nonManifoldEdgeCount() && rep.counts.duplicateTriangles == 1);
+    std::ostringstream out;
+    printFastValidateReport(rep, out);
+    assert(out.str().find("  triangle 5 opposite winding") != std::string::npos);
+    assert(out.str().find("... " + std::to_string(flipped - 3) + " more opposite winding") != std::string::npos);
+    assert(out.str().find("Duplicate triangles: 1\n") != std::string::npos);
+    assert(out.str().find("Watertight: no\n") != std::string::npos);
+    assert(out.str().find("Result: FAIL (opposite winding)\n") != std::string::npos);
+
+    opts.stopOnFailure = true;
+    fastValidate(r, rep, opts);
+    assert(rep.stoppedEarly && rep.firstFailure == FastValidateFailure::Winding && rep.counts.uniqueEdges == 0);
+    out.str("");
+    printFastValidateReport(rep, out);
+    assert(out.str().find("Edges: not checked\n") != std::string::npos);
+    assert(out.str().find("Watertight: not checked\n") != std::string::npos);
+
+    // Correct winding, still open: edges are the first failure and fail-fast skips the face pass.
+    bad = tris;
+    bad.erase(bad.begin() + 1);
+    bad.push_back(bad[4]);
+    r.setTriangles(bad);
+    fastValidate(r, rep, opts);
+    assert(rep.firstFailure == FastValidateFailure::Edges && rep.stoppedEarly && rep.counts.duplicateTriangles == 0);
+    opts.stopOnFailure = false;
+    fastValidate(r, rep, opts);
+    assert(rep.firstFailure == FastValidateFailure::Edges && rep.counts.duplicateTriangles == 1);
+
+    // An empty mesh fails the gate, reported as the full validator does.
+    r.setTriangles({});
+    fastValidate(r, rep, opts);
+    assert(!rep.passed() && rep.firstFailure == FastValidateFailure::NoTriangles && !rep.counts.watertight());
+    out.str("");
+    printFastValidateReport(rep, out);
+    assert(out.str().find("Watertight: no triangles\n") != std::string::npos);
+    assert(out.str().find("Result: FAIL (no triangles)\n") != std::string::npos);
+}
+
+static void test_profile_json() {
+    // Runs last: profiling stays enabled for the rest of the process.
+    StlReader r;
+    assert(readHollowBall(r, "test_profile_ball.stl"));
+    std::vector<StlReader::Triangle> fluid;
+    std::ostringstream discard;
+    r.computeFluidMesh(fluid, discard, StlReader::FluidOptions());  // not recorded: profiling is off
+    enableProfiling();
+    {
+        ProfileScope scope("outer");
+        scope.count("items", 2);
+        scope.count("items", 3);
+        r.computeFluidMesh(fluid, discard, StlReader::FluidOptions());
+    }
+    {
+        // Brute force evaluates every triangle once per query, independent of the worker count.
+        ProfileScope scope("brute");
+        StlReader::FluidOptions opts;
+        opts.classifier = StlReader::Classifier::WindingNumber;
+        opts.bruteForce = true;
+        opts.threads = 3;
+        std::vector<size_t> evenHit;
+        r.classifyEvenHit(evenHit, opts);
+    }
+    {
+        // Stage CPU time is per thread: a task running beside this thread is credited only once waited for.
+        auto spin = [](double ms) {  // burn ms of this thread's CPU time
+            const double until = profileCpuMs() + ms;
+            while (profileCpuMs() < until) {}
+        };
+        const double before = profileCpuMs();
+        TaskGroup group;
+        group.run([&] { spin(60); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(80));
+        const double whileRunning = profileCpuMs() - before;
+        group.wait();
+        const double afterWait = profileCpuMs() - before;
+        assert(whileRunning < 30. && afterWait >= 30. && "task CPU credited to the waiting thread only");
+        const double beforeFor = profileCpuMs();
+        parallelFor(4, 1, 4, [&](size_t, size_t, unsigned) { spin(30); });
+        assert(profileCpuMs() - beforeFor >= 60. && "parallelFor workers credited to the caller");
+    }
+    const char* path = "test_profile.json";
+    assert(writeProfileJson(path));
+    const std::string json = readFileBytes(path);
+    assert(json.find("\"total\"") != std::string::npos && json.find("\"peak_rss_kb\"") != std::string::npos);
+    assert(json.find("\"name\": \"outer\"") != std::string::npos && json.find("\"items\": 5") != std::string::npos);
+    assert(json.find("\"outer/compute_fluid_mesh/even_hit\"") != std::string::npos && "nested stage names");
+    const std::string rays = "\"rays\": " + std::to_string(r.triangleCount());
+    assert(json.find(rays) != std::string::npos && "one ray per triangle");
+    const uint64_t triangles = r.triangleCount();
+    const std::string solidAngles = "\"exact_solid_angles\": " + std::to_string(triangles * triangles);
+    assert(json.find(solidAngles) != std::string::npos && "brute-force solid angles counted once");
+    assert(json.find("\"boundary_loops\"") != std::string::npos && json.find("\"ray_triangle_tests\"") != std::string::npos);
+    assert(json.find("\"name\": \"compute_fluid_mesh\"") == std::string::npos && "nothing recorded before enabling");
+    std::remove(path);
+}
+
 int main() {
     test_volume_from_file();
     test_read_triangle_count();
@@ -198,6 +1729,37 @@ int main() {
     test_write_ascii_stl_roundtrip();
     test_write_invalid_path();
     test_geometry_quality_report_content();
+    test_bvh_structure();
+    test_bvh_matches_brute_force();
+    test_parallel_for_covers_range();
+    test_even_hit_thread_count_invariant();
+    test_ray_kernel_matches_scalar();
+    test_binary_read_mapped();
+    test_ascii_fast_matches_legacy();
+    test_ascii_loose_format();
+    test_vertex_welder_matches_map();
+    test_binary_write_roundtrip();
+    test_ascii_writer_stable_and_exact();
+    test_set_triangles_matches_file();
+    test_mesh_topology_matches_maps();
+    test_geometry_cache_matches_get_triangle();
+    test_stream_validate_matches_in_memory();
+    test_ray_reuse_matches_per_triangle();
+    test_winding_number_classifier();
+    test_components_split_fluid();
+    test_add_caps_matches_set_walk();
+    test_arena_reuses_blocks();
+    test_epsilon_weld();
+    test_batch_schedule();
+    test_even_hit_cache();
+    test_read_from_memory_and_reuse();
+    test_gpu_backend_falls_back();
+    test_spatial_reorder();
+    test_compressed_output();
+    test_task_group_and_atomic_writes();
+    test_robust_crossings();
+    test_fast_validate();
+    test_profile_json();
     std::cout << "All tests passed.\n";
     return 0;
 }